@@ -0,0 +1,296 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "lsstub.h"
+
+#define MAX_REPLY 8192
+
+struct LSHandle
+{
+    const char* name;
+    GHashTable* methods;        /* "category/method" -> LSMethodFunction */
+    int priority;
+    bool public_bus;            /* client handles only */
+};
+
+struct LSPalmService
+{
+    LSHandle priv;
+    LSHandle pub;
+};
+
+struct LSMessage
+{
+    LSHandle* lsh;
+    const char* category;
+    const char* method;
+    const char* payload;
+    const char* sender;
+    bool replied;
+};
+
+static char sReply[ MAX_REPLY ];
+static guint64 sSignals = 0;
+static LSPalmService* sService = NULL;
+
+/* a call from a client handle, delivered from the main loop */
+typedef struct
+{
+    LSHandle* client;
+    LSHandle* service;
+    char* category;
+    char* method;
+    char* payload;
+    LSFilterFunc callback;
+    void* context;
+}
+StubCall;
+
+static void
+register_methods( LSHandle* lsh, const char* category, LSMethod* methods )
+{
+    if ( NULL == methods )
+        return;
+
+    if ( NULL == lsh->methods )
+        lsh->methods = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+
+    for ( ; methods->name != NULL; methods++ ) {
+        g_hash_table_insert( lsh->methods, g_strconcat( category, "/", methods->name, NULL ),
+                             (gpointer)methods->function );
+    }
+}
+
+LSPalmService*
+StubBusNew( void )
+{
+    LSPalmService* lsps = g_new0( LSPalmService, 1 );
+    lsps->priv.name = "private";
+    lsps->pub.name = "public";
+    lsps->priv.priority = lsps->pub.priority = G_PRIORITY_DEFAULT;
+    sService = lsps;
+    return lsps;
+}
+
+const char*
+StubBusCall( LSHandle* lsh, const char* category, const char* method,
+             const char* payload, const char* sender )
+{
+    char key[ 256 ];
+    LSMethodFunction function;
+    LSMessage message = { lsh, category, method, payload, sender, false };
+
+    g_snprintf( key, sizeof(key), "%s/%s", category, method );
+    function = lsh->methods ? (LSMethodFunction)g_hash_table_lookup( lsh->methods, key ) : NULL;
+    if ( NULL == function )
+        return NULL;
+
+    function( lsh, &message, NULL );
+    return message.replied ? sReply : NULL;
+}
+
+guint64
+StubBusSignalCount( void )
+{
+    return sSignals;
+}
+
+/* luna-service2 API */
+
+bool
+LSErrorInit( LSError* lserror )
+{
+    memset( lserror, 0, sizeof(*lserror) );
+    return true;
+}
+
+void
+LSErrorFree( LSError* lserror )
+{
+}
+
+bool
+LSRegisterCategory( LSHandle* lsh, const char* category, LSMethod* methods,
+                    LSSignal* signals, LSProperty* properties, LSError* lserror )
+{
+    register_methods( lsh, category, methods );
+    return true;
+}
+
+bool
+LSPalmServiceRegisterCategory( LSPalmService* lsps, const char* category,
+                               LSMethod* methods_public, LSMethod* methods_private,
+                               LSSignal* signals, void* category_user_data, LSError* lserror )
+{
+    register_methods( &lsps->pub, category, methods_public );
+    register_methods( &lsps->priv, category, methods_private );
+    return true;
+}
+
+LSHandle*
+LSPalmServiceGetPrivateConnection( LSPalmService* lsps )
+{
+    return &lsps->priv;
+}
+
+LSHandle*
+LSPalmServiceGetPublicConnection( LSPalmService* lsps )
+{
+    return &lsps->pub;
+}
+
+bool
+LSGmainAttach( LSHandle* lsh, GMainLoop* loop, LSError* lserror )
+{
+    return true;
+}
+
+bool
+LSGmainSetPriority( LSHandle* lsh, int priority, LSError* lserror )
+{
+    lsh->priority = priority;
+    return true;
+}
+
+bool
+LSRegisterPubPriv( const char* name, LSHandle** lsh, bool public_bus, LSError* lserror )
+{
+    static guint sClients = 0;
+
+    *lsh = g_new0( LSHandle, 1 );
+    (*lsh)->name = name ? g_strdup( name ) : g_strdup_printf( ":stub.%u", ++sClients );
+    (*lsh)->priority = G_PRIORITY_DEFAULT;
+    (*lsh)->public_bus = public_bus;
+    return true;
+}
+
+bool
+LSUnregister( LSHandle* lsh, LSError* lserror )
+{
+    return true;
+}
+
+bool
+LSMessageReply( LSHandle* lsh, LSMessage* message, const char* reply, LSError* lserror )
+{
+    g_strlcpy( sReply, reply, sizeof(sReply) );
+    message->replied = true;
+    return true;
+}
+
+const char*
+LSMessageGetPayload( LSMessage* message )
+{
+    return message->payload;
+}
+
+const char*
+LSMessageGetMethod( LSMessage* message )
+{
+    return message->method;
+}
+
+const char*
+LSMessageGetCategory( LSMessage* message )
+{
+    return message->category;
+}
+
+const char*
+LSMessageGetSender( LSMessage* message )
+{
+    return message->sender;
+}
+
+const char*
+LSMessageGetSenderServiceName( LSMessage* message )
+{
+    return "com.palm.storaged.bench";
+}
+
+LSHandle*
+LSMessageGetConnection( LSMessage* message )
+{
+    return message->lsh;
+}
+
+bool
+LSSignalSend( LSHandle* lsh, const char* uri, const char* payload, LSError* lserror )
+{
+    sSignals++;
+    return true;
+}
+
+static gboolean
+deliver_call( gpointer data )
+{
+    StubCall* call = data;
+    const char* reply = StubBusCall( call->service, call->category, call->method,
+                                     call->payload, call->client->name );
+    LSMessage message = { call->client, call->category, call->method,
+                          reply ? reply : "{\"returnValue\":false,\"errorText\":\"no reply\"}",
+                          "com.palm.storage", true };
+
+    if ( call->callback )
+        call->callback( call->client, &message, call->context );
+
+    g_free( call->category );
+    g_free( call->method );
+    g_free( call->payload );
+    g_free( call );
+    return FALSE;
+}
+
+/*
+ * Calls from client handles (see LSRegisterPubPriv) to the stub service are
+ * delivered from the main loop at the priority of the service connection
+ * they arrive on, like a real hub would; anything else is dropped.
+ */
+bool
+LSCallOneReply( LSHandle* lsh, const char* uri, const char* payload,
+                LSFilterFunc callback, void* context, LSMessageToken* token, LSError* lserror )
+{
+#define STUB_SERVICE_URI "luna://com.palm.storage/"
+    const char* path;
+    const char* slash;
+    StubCall* call;
+
+    if ( NULL == sService || lsh == &sService->priv || lsh == &sService->pub ||
+         strncmp( uri, STUB_SERVICE_URI, strlen( STUB_SERVICE_URI ) ) )
+        return true;
+
+    path = uri + strlen( STUB_SERVICE_URI ) - 1;
+    slash = strrchr( path, '/' );
+    if ( slash == path )
+        return true;
+
+    call = g_new( StubCall, 1 );
+    call->client = lsh;
+    call->service = lsh->public_bus ? &sService->pub : &sService->priv;
+    call->category = g_strndup( path, slash - path );
+    call->method = g_strdup( slash + 1 );
+    call->payload = g_strdup( payload );
+    call->callback = callback;
+    call->context = context;
+    g_idle_add_full( call->service->priority, deliver_call, call, NULL );
+    return true;
+}
@@ -0,0 +1,49 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_LSSTUB_H__
+#define __STORAGED_LSSTUB_H__
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+/*
+ * An in-process stand-in for the parts of luna-service2 that storaged uses.
+ * Methods registered on its handles are called synchronously with
+ * StubBusCall; replies are kept in a fixed buffer and signals are only
+ * counted, so the stand-in itself allocates nothing per call.
+ *
+ * Handles from LSRegisterPubPriv act as clients: their LSCallOneReply calls
+ * to luna://com.palm.storage/ are delivered asynchronously from the main
+ * loop, for driving the service the way bus clients would.
+ */
+
+/** a palm service whose private and public handles are stubs */
+LSPalmService* StubBusNew( void );
+
+/** call category/method on a handle as if "sender" had sent payload.
+ *
+ * @return the handler's reply, valid until the next call, or NULL if the
+ *         method doesn't exist or didn't reply */
+const char* StubBusCall( LSHandle* lsh, const char* category, const char* method,
+                         const char* payload, const char* sender );
+
+/** number of signals sent through stub handles so far */
+guint64 StubBusSignalCount( void );
+
+#endif
@@ -0,0 +1,289 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/*
+ * storaged-mount-bench: compare the mount option profiles (see
+ * src/mountopts.h) on a loop-mounted FAT image, standing in for
+ * /media/internal after MSM.  It fills the image with a tree of small
+ * files, then for each profile times a rescan from a cold cache (stat
+ * every entry, read the start of every file, as the media indexer does)
+ * and the latency of small file writes (create, write 4KiB, close).
+ * Needs root.  Destroys the contents of IMAGE.
+ *
+ *   storaged-mount-bench IMAGE [CONF]
+ *
+ * IMAGE is created (256 MiB) and formatted if it doesn't exist.  CONF is a
+ * storaged.conf defining more profiles.  Results are printed one json
+ * object per line, per profile and pattern.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "lifetime.h"
+#include "mountopts.h"
+#include "recorder.h"
+
+#define IMAGE_SIZE          (256 * 1024 * 1024)
+#define TREE_DIRS           32
+#define TREE_FILES          64          /* per directory */
+#define TREE_FILE_SIZE      (64 * 1024)
+#define SCAN_READ           4096
+#define SMALL_WRITES        512
+#define SMALL_WRITE_SIZE    4096
+
+/* mountopts.c arms its switch to the steady profile through the recorder,
+   holding storaged's lifetime; nothing here arms it, but the link needs these */
+guint
+RecorderTimeoutAdd( RecorderTimer which, gint priority, guint interval_ms,
+                    GSourceFunc function, gpointer data )
+{
+    return g_timeout_add_full( priority, interval_ms, function, data, NULL );
+}
+
+void
+RecorderTimeoutRemove( guint id )
+{
+    g_source_remove( id );
+}
+
+void
+LifetimeHold( void )
+{
+}
+
+void
+LifetimeRelease( void )
+{
+}
+
+static bool
+run( const char* command )
+{
+    int status = -1;
+    return g_spawn_command_line_sync( command, NULL, NULL, &status, NULL ) && 0 == status;
+}
+
+/**
+ * @brief write everything out and throw the page, dentry and inode caches
+ * away, so every rescan starts cold
+ */
+static void
+drop_caches( void )
+{
+    int fd;
+
+    sync();
+    fd = open( "/proc/sys/vm/drop_caches", O_WRONLY | O_CLOEXEC );
+    if ( fd >= 0 ) {
+        (void) write( fd, "3", 1 );
+        close( fd );
+    }
+}
+
+static bool
+fill_tree( const char* root )
+{
+    gchar* buffer = g_malloc( TREE_FILE_SIZE );
+    int d, f;
+    bool ok = true;
+
+    memset( buffer, 0x5a, TREE_FILE_SIZE );
+    for ( d = 0; ok && d < TREE_DIRS; d++ ) {
+        gchar* dir = g_strdup_printf( "%s/dir%02d", root, d );
+        ok = 0 == mkdir( dir, 0755 );
+        for ( f = 0; ok && f < TREE_FILES; f++ ) {
+            gchar* path = g_strdup_printf( "%s/file%03d.jpg", dir, f );
+            int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+            ok = fd >= 0 && write( fd, buffer, TREE_FILE_SIZE ) == TREE_FILE_SIZE;
+            if ( fd >= 0 )
+                close( fd );
+            g_free( path );
+        }
+        g_free( dir );
+    }
+    g_free( buffer );
+    sync();
+    return ok;
+}
+
+static guint
+scan_dir( const char* path, char* buffer )
+{
+    GDir* dir = g_dir_open( path, 0, NULL );
+    const gchar* name;
+    guint files = 0;
+
+    if ( NULL == dir )
+        return 0;
+    while ( NULL != (name = g_dir_read_name( dir )) ) {
+        gchar* child = g_build_filename( path, name, NULL );
+        struct stat st;
+
+        if ( 0 == stat( child, &st ) ) {
+            if ( S_ISDIR( st.st_mode ) ) {
+                files += scan_dir( child, buffer );
+            } else {
+                int fd = open( child, O_RDONLY | O_CLOEXEC );
+                if ( fd >= 0 ) {
+                    (void) read( fd, buffer, SCAN_READ );
+                    close( fd );
+                }
+                files++;
+            }
+        }
+        g_free( child );
+    }
+    g_dir_close( dir );
+    return files;
+}
+
+static int
+compare_us( const void* a, const void* b )
+{
+    gint64 left = *(const gint64*)a;
+    gint64 right = *(const gint64*)b;
+    return (left > right) - (left < right);
+}
+
+static void
+run_profile( const char* profile, const char* root )
+{
+    char* buffer = g_malloc( SMALL_WRITE_SIZE );
+    gint64 latencies[ SMALL_WRITES ];
+    gint64 start, total = 0;
+    guint files;
+    int i;
+
+    drop_caches();
+    start = g_get_monotonic_time();
+    files = scan_dir( root, buffer );
+    printf( "{\"bench\":\"mount\", \"profile\":\"%s\", \"pattern\":\"rescan\""
+            ", \"files\":%u, \"us\":%" G_GINT64_FORMAT "}\n",
+            profile, files, g_get_monotonic_time() - start );
+
+    gchar* dir = g_strdup_printf( "%s/writes", root );
+    (void) mkdir( dir, 0755 );
+    memset( buffer, 0xa5, SMALL_WRITE_SIZE );
+    for ( i = 0; i < SMALL_WRITES; i++ ) {
+        gchar* path = g_strdup_printf( "%s/note%03d.txt", dir, i );
+        start = g_get_monotonic_time();
+        int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+        if ( fd >= 0 ) {
+            (void) write( fd, buffer, SMALL_WRITE_SIZE );
+            close( fd );
+        }
+        latencies[i] = g_get_monotonic_time() - start;
+        total += latencies[i];
+        g_free( path );
+    }
+    qsort( latencies, SMALL_WRITES, sizeof(latencies[0]), compare_us );
+    printf( "{\"bench\":\"mount\", \"profile\":\"%s\", \"pattern\":\"small_write\""
+            ", \"writes\":%d, \"meanUs\":%" G_GINT64_FORMAT ", \"p50Us\":%" G_GINT64_FORMAT
+            ", \"p99Us\":%" G_GINT64_FORMAT ", \"maxUs\":%" G_GINT64_FORMAT "}\n",
+            profile, SMALL_WRITES, total / SMALL_WRITES, latencies[ SMALL_WRITES / 2 ],
+            latencies[ SMALL_WRITES * 99 / 100 ], latencies[ SMALL_WRITES - 1 ] );
+    fflush( stdout );
+
+    /* leave the tree as it was for the next profile */
+    for ( i = 0; i < SMALL_WRITES; i++ ) {
+        gchar* path = g_strdup_printf( "%s/note%03d.txt", dir, i );
+        (void) unlink( path );
+        g_free( path );
+    }
+    (void) rmdir( dir );
+    g_free( dir );
+    g_free( buffer );
+}
+
+int
+main( int argc, char** argv )
+{
+    gchar* root;
+    gchar* command;
+    bool created = false;
+
+    if ( argc < 2 ) {
+        fprintf( stderr, "usage: %s IMAGE [CONF]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    if ( !g_file_test( argv[1], G_FILE_TEST_EXISTS ) ) {
+        int fd = open( argv[1], O_WRONLY | O_CREAT | O_CLOEXEC, 0644 );
+        if ( fd < 0 || ftruncate( fd, IMAGE_SIZE ) != 0 ) {
+            fprintf( stderr, "%s: unable to create %s\n", argv[0], argv[1] );
+            return EXIT_FAILURE;
+        }
+        close( fd );
+        created = true;
+    }
+
+    command = g_strdup_printf( "mkfs.vfat %s", argv[1] );
+    if ( created && !run( command ) ) {
+        fprintf( stderr, "%s: unable to format %s\n", argv[0], argv[1] );
+        return EXIT_FAILURE;
+    }
+    g_free( command );
+
+    MountOptsLoadConfig( argc > 2 ? argv[2] : "/dev/null" );
+
+    root = g_strdup( "/tmp/storaged-mount-bench.XXXXXX" );
+    if ( NULL == g_mkdtemp( root ) ) {
+        fprintf( stderr, "%s: unable to create a mount point\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+    gchar* mountCommand = g_strdup_printf( "mount -t vfat -o loop %s %s", argv[1], root );
+    gchar* umountCommand = g_strdup_printf( "umount %s", root );
+    if ( !run( mountCommand ) ) {
+        fprintf( stderr, "%s: unable to mount %s on %s\n", argv[0], argv[1], root );
+        return EXIT_FAILURE;
+    }
+
+    gchar* tree = g_strdup_printf( "%s/dir00", root );
+    if ( !g_file_test( tree, G_FILE_TEST_IS_DIR ) && !fill_tree( root ) )
+        fprintf( stderr, "%s: %s is too small for the test tree\n", argv[0], argv[1] );
+    g_free( tree );
+
+    const gchar** names = MountOptsProfileNames();
+    const gchar** name;
+    for ( name = names; *name; name++ ) {
+        /* each profile starts from a fresh mount with the default options */
+        if ( !run( umountCommand ) || !run( mountCommand ) ) {
+            fprintf( stderr, "%s: unable to mount %s again\n", argv[0], argv[1] );
+            break;
+        }
+        if ( MountOptsApplyProfile( *name, root, true ) )
+            run_profile( *name, root );
+        else
+            fprintf( stderr, "%s: profile %s refused\n", argv[0], *name );
+    }
+    g_free( names );
+
+    (void) run( umountCommand );
+    g_free( umountCommand );
+    g_free( mountCommand );
+    (void) rmdir( root );
+    g_free( root );
+
+    return EXIT_SUCCESS;
+}
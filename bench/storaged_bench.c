@@ -0,0 +1,286 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/*
+ * storaged-bench: microbenchmarks of storaged's request and signal hot
+ * paths.  The real handlers from diskmode.c, erase.c and signals.c are
+ * driven through the in-process bus stand-in (lsstub.c) on top of an
+ * in-memory storage backend.
+ *
+ *   storaged-bench [ITERATIONS]
+ *
+ * Prints one json object per benchmark with ns/op and allocations/op
+ * (malloc, calloc and realloc calls, glib's included), for comparing
+ * builds.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <glib.h>
+#include <cjson/json.h>
+#include <luna-service2/lunaservice.h>
+
+#include "lsstub.h"
+#include "diskmode.h"
+#include "erase.h"
+#include "ratelimit.h"
+#include "signals.h"
+#include "util.h"
+#include "log.h"
+#include "main.h"
+
+#define DEFAULT_ITERATIONS 100000
+
+/*
+ * Count allocations by wrapping glibc's allocator.
+ */
+extern void* __libc_malloc( size_t size );
+extern void* __libc_calloc( size_t nmemb, size_t size );
+extern void* __libc_realloc( void* ptr, size_t size );
+
+static guint64 sAllocs = 0;
+
+void*
+malloc( size_t size )
+{
+    sAllocs++;
+    return __libc_malloc( size );
+}
+
+void*
+calloc( size_t nmemb, size_t size )
+{
+    sAllocs++;
+    return __libc_calloc( nmemb, size );
+}
+
+void*
+realloc( void* ptr, size_t size )
+{
+    sAllocs++;
+    return __libc_realloc( ptr, size );
+}
+
+/*
+ * A storage backend with a host connected and every operation succeeding
+ * instantly.
+ */
+static bool sExported = false;
+
+static bool
+bench_backend_open( const char* arg )
+{
+    return true;
+}
+
+static nyx_error_t
+bench_backend_get_state( int* state )
+{
+    *state = NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE | NYX_MASS_STORAGE_MODE_HOST_CONNECTED |
+             (sExported ? NYX_MASS_STORAGE_MODE_MODE_ON : 0);
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+bench_backend_set_mode( nyx_mass_storage_mode_t mode,
+                        nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    sExported = (mode == NYX_MASS_STORAGE_MODE_ENABLE);
+    *ret_status = NYX_MASS_STORAGE_MODE_SUCCESS;
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+bench_backend_erase_partition( nyx_system_erase_type_t type )
+{
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+bench_backend_register_change_callback( nyx_device_callback_function_t callback,
+                                        void* context )
+{
+    return NYX_ERROR_NONE;
+}
+
+static const StorageBackend sBenchBackend = {
+    .name = "bench",
+    .open = bench_backend_open,
+    .get_state = bench_backend_get_state,
+    .set_mode = bench_backend_set_mode,
+    .erase_partition = bench_backend_erase_partition,
+    .register_change_callback = bench_backend_register_change_callback,
+    .host_connected = NULL,
+};
+
+const StorageBackend*
+GetStorageBackend( void )
+{
+    return &sBenchBackend;
+}
+
+/*
+ * Harness
+ */
+static LSHandle* sPriv = NULL;
+static LSHandle* sPub = NULL;
+
+typedef void (*BenchFunc)( void );
+
+static gint64
+now_ns( void )
+{
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return (gint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+run( const char* name, BenchFunc func, long iterations )
+{
+    long i;
+
+    /* warm up caches, lazily built state and the allocator */
+    for ( i = 0; i < iterations / 10 + 1; i++ )
+        func();
+
+    guint64 allocs = sAllocs;
+    gint64 start = now_ns();
+    for ( i = 0; i < iterations; i++ )
+        func();
+    gint64 elapsed = now_ns() - start;
+    allocs = sAllocs - allocs;
+
+    printf( "{\"bench\":\"%s\", \"iterations\":%ld, \"nsPerOp\":%.1f, \"allocsPerOp\":%.2f}\n",
+            name, iterations, (double)elapsed / iterations, (double)allocs / iterations );
+    fflush( stdout );
+}
+
+static void
+bench_dispatch_status_query( void )
+{
+    StubBusCall( sPriv, "/diskmode", "queryMSMStatus", "{}", ":1.1" );
+}
+
+static void
+bench_dispatch_status_query_public( void )
+{
+    /* a handful of senders, each kept in tokens, so that this measures the
+       limiter's allow path rather than its throttle and drop paths */
+    static unsigned n = 0;
+    char sender[ 16 ];
+    if ( 0 == n % 32 )
+        RateLimitRefill();
+    g_snprintf( sender, sizeof(sender), ":1.%u", n++ % 32 );
+    StubBusCall( sPub, "/diskmode", "queryMSMStatus", "{}", sender );
+}
+
+static void
+bench_dispatch_cable( void )
+{
+    StubBusCall( sPriv, "/diskmode", "changed", "{\"connected\": true}", ":1.2" );
+}
+
+static void
+bench_json_parse( void )
+{
+    struct json_object* object = json_tokener_parse( "{\"user-confirmed\": true, \"enterIMasq\": false}" );
+    (void) json_object_get_boolean( json_object_object_get( object, "user-confirmed" ) );
+    json_object_put( object );
+}
+
+static void
+bench_reply_host_connected( void )
+{
+    StubBusCall( sPriv, "/diskmode", "hostIsConnected", "{}", ":1.3" );
+}
+
+static void
+bench_reply_stats( void )
+{
+    StubBusCall( sPriv, "/diskmode", "stats", "{}", ":1.3" );
+}
+
+static void
+bench_signal_avail( void )
+{
+    SignalMSMAvailChange( sPriv, true );
+}
+
+static void
+bench_signal_partition_avail( void )
+{
+    SignalPartitionAvail( sPriv, "/media/internal", true, false, false );
+}
+
+static void
+bench_history( void )
+{
+    StubBusCall( sPriv, "/storaged", "history", "{\"since\": 0}", ":1.4" );
+}
+
+static void
+bench_log_blame( void )
+{
+    log_blame( "/media/internal" );
+}
+
+static void
+bench_lifetime_timer( void )
+{
+    reset_lifetime_timer();
+}
+
+int
+main( int argc, char** argv )
+{
+    long iterations = DEFAULT_ITERATIONS;
+
+    if ( argc > 1 )
+        iterations = MAX( 10, atol( argv[1] ) );
+
+    g_log_set_default_handler( logFilter, NULL );
+
+    GMainLoop* loop = g_main_loop_new( NULL, FALSE );
+    LSPalmService* lsps = StubBusNew();
+    sPriv = LSPalmServiceGetPrivateConnection( lsps );
+    sPub = LSPalmServiceGetPublicConnection( lsps );
+
+    DispatchInit( loop );
+    LifetimeInit( loop );
+    SignalsInit( lsps );
+    DiskModeInterfaceInit( loop, sPriv, sPub, false );
+    EraseInit( loop, sPriv );
+
+    run( "dispatch_query_msm_status", bench_dispatch_status_query, iterations );
+    run( "dispatch_query_msm_status_public", bench_dispatch_status_query_public, iterations );
+    run( "dispatch_cable_changed", bench_dispatch_cable, iterations );
+    run( "json_parse", bench_json_parse, iterations );
+    run( "reply_host_is_connected", bench_reply_host_connected, iterations );
+    run( "reply_stats", bench_reply_stats, iterations / 10 );
+    run( "signal_msm_avail", bench_signal_avail, iterations );
+    run( "signal_partition_avail", bench_signal_partition_avail, iterations );
+    run( "history_full_ring", bench_history, iterations / 10 );
+    run( "log_blame", bench_log_blame, iterations / 1000 );
+    run( "reset_lifetime_timer", bench_lifetime_timer, iterations );
+
+    fprintf( stderr, "%" G_GUINT64_FORMAT " signals sent\n", StubBusSignalCount() );
+    g_main_loop_unref( loop );
+    return EXIT_SUCCESS;
+}
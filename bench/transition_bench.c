@@ -0,0 +1,152 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/*
+ * storaged-transition-bench: time full Mass Storage Mode round trips
+ * (unmount + export, then unexport + fsck + remount) and media erases
+ * against the local backend, i.e. a loop-mounted FAT image.  Needs root.
+ *
+ *   storaged-transition-bench IMAGE MOUNTPOINT [ITERATIONS]
+ *
+ * IMAGE is created (64 MiB, FAT) if it doesn't exist.  Results are printed
+ * one json object per line, per stage.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "backend.h"
+
+#define DEFAULT_ITERATIONS 20
+#define IMAGE_SIZE "64M"
+
+typedef struct
+{
+    const char* name;
+    gint64* samples;
+    int count;
+    int failures;
+}
+Stage;
+
+static int
+compare_gint64( const void* a, const void* b )
+{
+    gint64 x = *(const gint64*)a, y = *(const gint64*)b;
+    return (x > y) - (x < y);
+}
+
+static void
+report( Stage* stage )
+{
+    gint64 sum = 0;
+    int i;
+
+    qsort( stage->samples, stage->count, sizeof(gint64), compare_gint64 );
+    for ( i = 0; i < stage->count; i++ )
+        sum += stage->samples[i];
+
+    printf( "{\"bench\":\"transition\", \"stage\":\"%s\", \"iterations\":%d, \"failures\":%d"
+            ", \"meanUs\":%" G_GINT64_FORMAT ", \"p50Us\":%" G_GINT64_FORMAT ", \"maxUs\":%" G_GINT64_FORMAT "}\n",
+            stage->name, stage->count, stage->failures,
+            stage->count ? sum / stage->count : 0,
+            stage->count ? stage->samples[ stage->count / 2 ] : 0,
+            stage->count ? stage->samples[ stage->count - 1 ] : 0 );
+}
+
+static void
+run_set_mode( Stage* stage, nyx_mass_storage_mode_t mode )
+{
+    nyx_mass_storage_mode_return_code_t ret_status;
+    gint64 start = g_get_monotonic_time();
+
+    if ( LocalStorageBackend.set_mode( mode, &ret_status ) != NYX_ERROR_NONE )
+        stage->failures++;
+    stage->samples[ stage->count++ ] = g_get_monotonic_time() - start;
+}
+
+static bool
+create_image( const char* image )
+{
+    gchar* truncate = g_strdup_printf( "truncate -s " IMAGE_SIZE " %s", image );
+    gchar* mkfs = g_strdup_printf( "mkfs.vfat %s", image );
+    int status = -1;
+    bool ok = g_spawn_command_line_sync( truncate, NULL, NULL, &status, NULL ) && 0 == status &&
+              g_spawn_command_line_sync( mkfs, NULL, NULL, &status, NULL ) && 0 == status;
+
+    g_free( truncate );
+    g_free( mkfs );
+    return ok;
+}
+
+int
+main( int argc, char** argv )
+{
+    int iterations = DEFAULT_ITERATIONS;
+    int i;
+
+    if ( argc < 3 ) {
+        fprintf( stderr, "usage: %s IMAGE MOUNTPOINT [ITERATIONS]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+    if ( argc > 3 )
+        iterations = MAX( 1, atoi( argv[3] ) );
+
+    if ( !g_file_test( argv[1], G_FILE_TEST_EXISTS ) && !create_image( argv[1] ) ) {
+        fprintf( stderr, "%s: unable to create %s\n", argv[0], argv[1] );
+        return EXIT_FAILURE;
+    }
+
+    gchar* arg = g_strdup_printf( "%s:%s", argv[1], argv[2] );
+    if ( !LocalStorageBackend.open( arg ) ) {
+        fprintf( stderr, "%s: unable to open local backend on %s\n", argv[0], arg );
+        return EXIT_FAILURE;
+    }
+    g_free( arg );
+
+    /* the unmount stage runs twice per iteration, before fsck and before remount */
+    Stage enter = { "unmount", g_new0( gint64, 2 * iterations ), 0, 0 };
+    Stage leave = { "fsck", g_new0( gint64, iterations ), 0, 0 };
+    Stage remount = { "remount", g_new0( gint64, iterations ), 0, 0 };
+    Stage erase = { "erase", g_new0( gint64, iterations ), 0, 0 };
+
+    for ( i = 0; i < iterations; i++ ) {
+        run_set_mode( &enter, NYX_MASS_STORAGE_MODE_ENABLE );
+        run_set_mode( &leave, NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK );
+    }
+
+    for ( i = 0; i < iterations; i++ ) {
+        run_set_mode( &enter, NYX_MASS_STORAGE_MODE_ENABLE );
+        run_set_mode( &remount, NYX_MASS_STORAGE_MODE_DISABLE );
+    }
+
+    for ( i = 0; i < iterations; i++ ) {
+        gint64 start = g_get_monotonic_time();
+        if ( LocalStorageBackend.erase_partition( NYX_SYSTEM_ERASE_MEDIA ) != NYX_ERROR_NONE )
+            erase.failures++;
+        erase.samples[ erase.count++ ] = g_get_monotonic_time() - start;
+    }
+
+    report( &enter );
+    report( &leave );
+    report( &remount );
+    report( &erase );
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,173 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/*
+ * storaged-tuning-bench: compare the I/O tuning profiles (see src/tuning.h)
+ * on a loop device, standing in for the partition a USB host sees through
+ * the gadget LUN.  For each profile it writes the whole device
+ * sequentially, then reads it back sequentially and at random 4KiB offsets
+ * from a cold cache, the way a host copying files on and off (or indexing
+ * them) would.  Needs root.  Destroys the contents of IMAGE.
+ *
+ *   storaged-tuning-bench IMAGE [CONF]
+ *
+ * IMAGE is created (256 MiB) if it doesn't exist.  CONF is a storaged.conf
+ * defining more profiles.  Results are printed one json object per line,
+ * per profile and access pattern.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <linux/fs.h>
+#include <glib.h>
+
+#include "tuning.h"
+
+#define IMAGE_SIZE          (256 * 1024 * 1024)
+#define SEQ_BLOCK           (1024 * 1024)
+#define RANDOM_BLOCK        4096
+#define RANDOM_READS        4096
+
+/**
+ * @brief write out dirty pages and throw away the device's page cache, so
+ * every pattern starts cold
+ */
+static void
+drop_cache( int fd )
+{
+    (void) fsync( fd );
+    (void) ioctl( fd, BLKFLSBUF, 0 );
+    (void) posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+}
+
+static void
+report( const char* profile, const char* pattern, gint64 bytes, gint64 us, guint ops )
+{
+    printf( "{\"bench\":\"tuning\", \"profile\":\"%s\", \"pattern\":\"%s\""
+            ", \"bytes\":%" G_GINT64_FORMAT ", \"us\":%" G_GINT64_FORMAT
+            ", \"MBps\":%.1f, \"iops\":%.0f}\n",
+            profile, pattern, bytes, us,
+            us ? (double)bytes / us : 0.0, us ? ops * 1e6 / us : 0.0 );
+    fflush( stdout );
+}
+
+static void
+run_profile( const char* profile, const char* device, gint64 size )
+{
+    int fd = open( device, O_RDWR | O_CLOEXEC );
+    gchar* buffer = g_malloc( SEQ_BLOCK );
+    gint64 start, done;
+    guint ops, i;
+
+    if ( fd < 0 ) {
+        perror( device );
+        g_free( buffer );
+        return;
+    }
+    memset( buffer, 0x5a, SEQ_BLOCK );
+
+    drop_cache( fd );
+    start = g_get_monotonic_time();
+    for ( done = 0, ops = 0; done + SEQ_BLOCK <= size; done += SEQ_BLOCK, ops++ ) {
+        if ( pwrite( fd, buffer, SEQ_BLOCK, done ) != SEQ_BLOCK )
+            break;
+    }
+    (void) fsync( fd );
+    report( profile, "seq_write", done, g_get_monotonic_time() - start, ops );
+
+    drop_cache( fd );
+    start = g_get_monotonic_time();
+    for ( done = 0, ops = 0; done + SEQ_BLOCK <= size; done += SEQ_BLOCK, ops++ ) {
+        if ( pread( fd, buffer, SEQ_BLOCK, done ) != SEQ_BLOCK )
+            break;
+    }
+    report( profile, "seq_read", done, g_get_monotonic_time() - start, ops );
+
+    /* the same offsets for every profile */
+    GRand* rand = g_rand_new_with_seed( 42 );
+    guint32 blocks = size / RANDOM_BLOCK;
+    drop_cache( fd );
+    start = g_get_monotonic_time();
+    for ( i = 0, done = 0; i < RANDOM_READS; i++ ) {
+        off_t offset = (off_t)g_rand_int_range( rand, 0, blocks ) * RANDOM_BLOCK;
+        if ( pread( fd, buffer, RANDOM_BLOCK, offset ) == RANDOM_BLOCK )
+            done += RANDOM_BLOCK;
+    }
+    report( profile, "random_read", done, g_get_monotonic_time() - start, RANDOM_READS );
+    g_rand_free( rand );
+
+    close( fd );
+    g_free( buffer );
+}
+
+int
+main( int argc, char** argv )
+{
+    gchar* device = NULL;
+    gchar* command;
+    int status = -1;
+
+    if ( argc < 2 ) {
+        fprintf( stderr, "usage: %s IMAGE [CONF]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+
+    if ( !g_file_test( argv[1], G_FILE_TEST_EXISTS ) ) {
+        int fd = open( argv[1], O_WRONLY | O_CREAT | O_CLOEXEC, 0644 );
+        if ( fd < 0 || ftruncate( fd, IMAGE_SIZE ) != 0 ) {
+            fprintf( stderr, "%s: unable to create %s\n", argv[0], argv[1] );
+            return EXIT_FAILURE;
+        }
+        close( fd );
+    }
+
+    TuningLoadConfig( argc > 2 ? argv[2] : "/dev/null" );
+
+    command = g_strdup_printf( "losetup -f --show %s", argv[1] );
+    if ( !g_spawn_command_line_sync( command, &device, NULL, &status, NULL ) || 0 != status ) {
+        fprintf( stderr, "%s: unable to set up a loop device on %s\n", argv[0], argv[1] );
+        return EXIT_FAILURE;
+    }
+    g_free( command );
+    g_strchomp( device );
+
+    struct stat st;
+    gint64 size = (0 == stat( argv[1], &st )) ? st.st_size : IMAGE_SIZE;
+
+    const gchar** names = TuningProfileNames();
+    const gchar** name;
+    for ( name = names; *name; name++ ) {
+        TuningApplyProfile( *name, device );
+        run_profile( *name, device, size );
+        TuningRevert();
+    }
+    g_free( names );
+
+    command = g_strdup_printf( "losetup -d %s", device );
+    (void) g_spawn_command_line_sync( command, NULL, NULL, NULL, NULL );
+    g_free( command );
+    g_free( device );
+
+    return EXIT_SUCCESS;
+}
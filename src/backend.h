@@ -0,0 +1,66 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_BACKEND_H__
+#define __STORAGED_BACKEND_H__
+
+#include <stdbool.h>
+#include <nyx/nyx_client.h>
+
+/*
+ * The storage backend does the actual work behind Mass Storage Mode and
+ * erase: unmounting, exporting, checking, remounting and wiping partitions.
+ * It speaks nyx's vocabulary (NYX_MASS_STORAGE_MODE_* state bits, modes and
+ * return codes) whichever implementation is behind it.
+ */
+typedef struct StorageBackend
+{
+    const char* name;
+
+    /** open the backend; arg is the part after "name:" on the command line,
+     *  or NULL.  Returns false on failure. */
+    bool (*open)( const char* arg );
+
+    /** OR of NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE, _HOST_CONNECTED and
+     *  _MODE_ON */
+    nyx_error_t (*get_state)( int* state );
+
+    nyx_error_t (*set_mode)( nyx_mass_storage_mode_t mode,
+                             nyx_mass_storage_mode_return_code_t* ret_status );
+
+    nyx_error_t (*erase_partition)( nyx_system_erase_type_t type );
+
+    nyx_error_t (*register_change_callback)( nyx_device_callback_function_t callback,
+                                             void* context );
+
+    /** optional: told about host connects and disconnects reported by udev,
+     *  for backends that have no hardware to tell them */
+    void (*host_connected)( bool connected );
+}
+StorageBackend;
+
+/** the production backend, on top of the nyx system and mass storage mode
+ *  devices */
+extern const StorageBackend NyxStorageBackend;
+
+/** a backend for running storaged on any Linux box: it loop-mounts a FAT
+ *  image, runs the real umount, fsck.vfat, mount and mkfs.vfat against it,
+ *  and simulates the USB host ("local:IMAGE[:MOUNTPOINT]") */
+extern const StorageBackend LocalStorageBackend;
+
+#endif
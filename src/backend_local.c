@@ -0,0 +1,274 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <mntent.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "backend.h"
+
+/*
+ * The "exported" state is simulated: the image is simply left unmounted, as
+ * if a host had it.  Host connection comes from the udev notifications that
+ * storaged receives (or that a test harness sends in their place).
+ */
+
+#define DEFAULT_MOUNT_POINT "/media/internal"
+
+static gchar* sImage = NULL;
+static gchar* sMountPoint = NULL;
+static bool sExported = false;
+static bool sHostConnected = false;
+
+static nyx_device_callback_function_t sChangeCallback = NULL;
+static void* sChangeContext = NULL;
+
+static bool
+is_mounted( void )
+{
+    bool mounted = false;
+    struct mntent* ent;
+    FILE* mounts = setmntent( "/proc/self/mounts", "r" );
+
+    if ( NULL == mounts )
+        return false;
+
+    while ( NULL != (ent = getmntent( mounts )) ) {
+        if ( 0 == strcmp( ent->mnt_dir, sMountPoint ) ) {
+            mounted = true;
+            break;
+        }
+    }
+    endmntent( mounts );
+    return mounted;
+}
+
+/**
+ * @brief run a command to completion.
+ *
+ * @return its exit code, or -1 if it could not be run or was killed
+ */
+static int
+run_command( const char* argv[] )
+{
+    gchar* std_err = NULL;
+    GError* error = NULL;
+    int status = 0;
+
+    g_debug( "%s: running %s %s", __func__, argv[0], argv[1] ? argv[1] : "" );
+    if ( !g_spawn_sync( NULL, (gchar**)argv, NULL, G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL,
+                        NULL, NULL, NULL, &std_err, &status, &error ) ) {
+        g_warning( "%s: %s: %s", __func__, argv[0], error->message );
+        g_error_free( error );
+        return -1;
+    }
+
+    if ( std_err && *std_err )
+        g_debug( "%s: %s: %s", __func__, argv[0], std_err );
+    g_free( std_err );
+
+    return WIFEXITED( status ) ? WEXITSTATUS( status ) : -1;
+}
+
+static bool
+mount_image( void )
+{
+    const char* argv[] = { "mount", "-t", "vfat", "-o", "loop", sImage, sMountPoint, NULL };
+
+    if ( is_mounted() )
+        return true;
+    return 0 == run_command( argv );
+}
+
+static bool
+format_image( void )
+{
+    const char* argv[] = { "mkfs.vfat", sImage, NULL };
+    return 0 == run_command( argv );
+}
+
+/**
+ * @return true if fsck found (and fixed) problems
+ */
+static bool
+check_image( void )
+{
+    /* 0 means clean, 1 means errors were fixed */
+    const char* argv[] = { "fsck.vfat", "-a", sImage, NULL };
+    return 0 != run_command( argv );
+}
+
+static bool
+unmount_image( void )
+{
+    if ( !is_mounted() )
+        return true;
+
+    if ( 0 == umount2( sMountPoint, 0 ) )
+        return true;
+    g_debug( "%s: umount %s: %s, forcing", __func__, sMountPoint, strerror( errno ) );
+
+    if ( 0 == umount2( sMountPoint, MNT_FORCE ) )
+        return true;
+    g_warning( "%s: umount %s: %s", __func__, sMountPoint, strerror( errno ) );
+    return false;
+}
+
+static bool
+local_backend_open( const char* arg )
+{
+    gchar** parts = g_strsplit( arg ? arg : "", ":", 2 );
+
+    if ( NULL == parts[0] || '\0' == parts[0][0] ) {
+        g_critical( "%s: usage: local:IMAGE[:MOUNTPOINT]", __func__ );
+        g_strfreev( parts );
+        return false;
+    }
+
+    sImage = g_strdup( parts[0] );
+    sMountPoint = g_strdup( parts[1] ? parts[1] : DEFAULT_MOUNT_POINT );
+    g_strfreev( parts );
+
+    if ( !g_file_test( sImage, G_FILE_TEST_IS_REGULAR ) ) {
+        g_critical( "%s: %s is not a filesystem image", __func__, sImage );
+        return false;
+    }
+
+    (void) g_mkdir_with_parents( sMountPoint, 0755 );
+
+    if ( !mount_image() ) {
+        g_critical( "%s: unable to mount %s on %s", __func__, sImage, sMountPoint );
+        return false;
+    }
+
+    g_debug( "%s: %s mounted on %s", __func__, sImage, sMountPoint );
+    return true;
+}
+
+static nyx_error_t
+local_backend_get_state( int* state )
+{
+    *state = NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE;
+    if ( sHostConnected )
+        *state |= NYX_MASS_STORAGE_MODE_HOST_CONNECTED;
+    if ( sExported )
+        *state |= NYX_MASS_STORAGE_MODE_MODE_ON;
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+local_backend_set_mode( nyx_mass_storage_mode_t mode,
+                        nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    bool fsck_problem = false;
+    bool reformatted = false;
+
+    *ret_status = NYX_MASS_STORAGE_MODE_SUCCESS;
+
+    if ( mode == NYX_MASS_STORAGE_MODE_ENABLE ) {
+        if ( !unmount_image() ) {
+            *ret_status = NYX_MASS_STORAGE_MODE_UMOUNT_FAILURE;
+            return NYX_ERROR_GENERIC;
+        }
+        sExported = true;
+        return NYX_ERROR_NONE;
+    }
+
+    /* nothing to do if the partition was never handed to the host */
+    if ( !sExported && is_mounted() )
+        return NYX_ERROR_NONE;
+    sExported = false;
+
+    if ( mode == NYX_MASS_STORAGE_MODE_DISABLE ) {
+        if ( !mount_image() ) {
+            *ret_status = NYX_MASS_STORAGE_MODE_MOUNT_FAILURE;
+            return NYX_ERROR_GENERIC;
+        }
+        return NYX_ERROR_NONE;
+    }
+
+    /* NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK */
+    fsck_problem = check_image();
+
+    if ( !mount_image() ) {
+        reformatted = true;
+        (void) format_image();
+        if ( !mount_image() ) {
+            *ret_status = NYX_MASS_STORAGE_MODE_MOUNT_FAILURE_AFTER_REFORMAT;
+            return NYX_ERROR_GENERIC;
+        }
+    }
+
+    if ( reformatted )
+        *ret_status = fsck_problem ? NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED_FSCK_PROBLEM
+                                   : NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED;
+    else if ( fsck_problem )
+        *ret_status = NYX_MASS_STORAGE_MODE_FSCK_PROBLEM;
+
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+local_backend_erase_partition( nyx_system_erase_type_t type )
+{
+    /* only the media partition exists here */
+    if ( type != NYX_SYSTEM_ERASE_MEDIA )
+        return NYX_ERROR_NOT_IMPLEMENTED;
+
+    if ( !unmount_image() )
+        return NYX_ERROR_GENERIC;
+
+    if ( !format_image() || !mount_image() )
+        return NYX_ERROR_GENERIC;
+
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+local_backend_register_change_callback( nyx_device_callback_function_t callback,
+                                        void* context )
+{
+    sChangeCallback = callback;
+    sChangeContext = context;
+    return NYX_ERROR_NONE;
+}
+
+static void
+local_backend_host_connected( bool connected )
+{
+    if ( connected == sHostConnected )
+        return;
+
+    sHostConnected = connected;
+    if ( NULL != sChangeCallback )
+        sChangeCallback( NULL, NYX_CALLBACK_STATUS_DONE, sChangeContext );
+}
+
+const StorageBackend LocalStorageBackend = {
+    .name = "local",
+    .open = local_backend_open,
+    .get_state = local_backend_get_state,
+    .set_mode = local_backend_set_mode,
+    .erase_partition = local_backend_erase_partition,
+    .register_change_callback = local_backend_register_change_callback,
+    .host_connected = local_backend_host_connected,
+};
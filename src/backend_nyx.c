@@ -0,0 +1,85 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glib.h>
+#include <nyx/nyx_client.h>
+
+#include "backend.h"
+
+static nyx_device_handle_t nyxSystem = NULL;
+static nyx_device_handle_t nyxMassStorageMode = NULL;
+
+static bool
+nyx_backend_open( const char* arg )
+{
+    int ret = nyx_device_open(NYX_DEVICE_SYSTEM, "Main", &nyxSystem);
+    if(ret != NYX_ERROR_NONE)
+    {
+        g_critical("Unable to open the nyx device system");
+        return false;
+    }
+    else
+        g_debug("Initialized nyx system device");
+
+    ret = nyx_device_open(NYX_DEVICE_MASS_STORAGE_MODE, "Main", &nyxMassStorageMode);
+    if(ret != NYX_ERROR_NONE)
+    {
+        g_critical("Unable to open the nyx mass storage mode device");
+        return false;
+    }
+    else
+        g_debug("Initialized nyx mass storage mode device");
+
+    return true;
+}
+
+static nyx_error_t
+nyx_backend_get_state( int* state )
+{
+    return nyx_mass_storage_mode_get_state(nyxMassStorageMode, state);
+}
+
+static nyx_error_t
+nyx_backend_set_mode( nyx_mass_storage_mode_t mode,
+                      nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    return nyx_mass_storage_mode_set_mode(nyxMassStorageMode, mode, ret_status);
+}
+
+static nyx_error_t
+nyx_backend_erase_partition( nyx_system_erase_type_t type )
+{
+    return nyx_system_erase_partition(nyxSystem, type, NULL);
+}
+
+static nyx_error_t
+nyx_backend_register_change_callback( nyx_device_callback_function_t callback,
+                                      void* context )
+{
+    return nyx_mass_storage_mode_register_change_callback(nyxMassStorageMode, callback, context);
+}
+
+const StorageBackend NyxStorageBackend = {
+    .name = "nyx",
+    .open = nyx_backend_open,
+    .get_state = nyx_backend_get_state,
+    .set_mode = nyx_backend_set_mode,
+    .erase_partition = nyx_backend_erase_partition,
+    .register_change_callback = nyx_backend_register_change_callback,
+    .host_connected = NULL,
+};
@@ -40,11 +40,49 @@
 
 #include "signals.h"
 #include "util.h"
+#include "dispatch.h"
+#include "evict.h"
+#include "holders.h"
+#include "jobs.h"
+#include "mountopts.h"
+#include "preflush.h"
+#include "qos.h"
+#include "ratelimit.h"
+#include "resume.h"
+#include "restore.h"
+#include "warmup.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "state.h"
+#include "tuning.h"
 #include "main.h"
 
 static guint sUmountTimerId = 0;   /* real ids always > 0 */
 static bool sNeedToRunPostScripts = false;
 static bool inMSM = false, unmount = false;
+static bool sHostConnected = false;     /* cable state we last acted on */
+static gint64 sUmountDeadline = 0;      /* when sUmountTimerId fires, monotonic us */
+static StoragedState sSnapshot;         /* left by the previous instance */
+static bool sHaveSnapshot = false;
+static gchar* sStatusReply = NULL;  /* cached queryMSMStatus reply, NULL if stale */
+static guint sReconcileId = 0;      /* startup reconciliation still to run */
+static LSHandle* sReconcileHandle = NULL;
+static bool sReconciling = false;   /* until it's done, fsck and scripts included */
+static gint64 sReconcileStart = 0;  /* see MetricsNow() */
+static GThread* sReconcileThread = NULL;            /* the fsck or the scripts */
+static void (*sReconcileNext)( LSHandle* lsh ) = NULL;  /* once it's joined */
+static bool sReconcileExported = false;
+static gint64 sReconcileStepStart = 0;
+/* written by sReconcileThread */
+static nyx_error_t sReconcileRet = NYX_ERROR_NONE;
+static nyx_mass_storage_mode_return_code_t sReconcileStatus;
+static int sReconcileExit = 0;
+static gchar* sReconcileStderr = NULL;
+static GError* sReconcileError = NULL;
+static gint64 sTransitionStart = 0;  /* see MetricsNow() */
+static gint64 sUmountWaitStart = 0;
+static bool sAvailAfterRestore = false;     /* PartitionAvail is waiting for the restore */
+static bool sRestoreFsckProblem = false;
 
 
 #define SYSTEM_SERVICE "com.palm.systemservice"
@@ -71,9 +109,129 @@ enum {
 };
 
 static void finish_mass_storage_mode_transition( LSHandle* lsh );
+static void reconcile_reap( void );
 static void abort_mass_storage_mode_transition( LSHandle* lsh );
+static void arm_umount_timer( LSHandle* lsh, guint interval_ms );
 
-static nyx_device_handle_t nyxMassStorageMode = NULL;
+static const StorageBackend* sBackend = NULL;
+
+/**
+ * @brief rewrite the state snapshot for the next instance; see state.h
+ */
+static void
+save_state( void )
+{
+    StoragedState state = {
+        .inMSM = inMSM,
+        .unmount = unmount,
+        .needPostScripts = sNeedToRunPostScripts,
+        .hostConnected = sHostConnected,
+        .umountDeadline = sUmountTimerId ? sUmountDeadline : 0,
+    };
+
+    SignalsGetSequence( &state.signalInstance, &state.signalSeq );
+    LifetimeGetState( &state );
+    StateSave( &state );
+}
+
+void
+DiskModeSaveState( void )
+{
+    save_state();
+}
+
+void
+DiskModeShutdown( void )
+{
+    /* in this order: each may have started the next */
+    while ( sReconcileThread )
+        reconcile_reap();
+    RestoreWait();
+    WarmupCancel();
+    PreflushWait();
+}
+
+/**
+ * @brief update inMSM, drop the cached status reply and tell the world
+ */
+static void
+set_in_msm( LSHandle* lsh, bool value )
+{
+    STORAGED_TRACE1(state__in__msm, value);
+    inMSM = value;
+    g_free( sStatusReply );
+    sStatusReply = NULL;
+    SignalMSMStatus( lsh, value );
+    save_state();
+}
+
+static JobClass
+mode_job( nyx_mass_storage_mode_t mode )
+{
+    return (mode == NYX_MASS_STORAGE_MODE_ENABLE) ? JOB_UNMOUNT :
+           (mode == NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK) ? JOB_FSCK : JOB_REMOUNT;
+}
+
+/**
+ * @brief the bookkeeping before and after the backend's set_mode, for when
+ * it's called off the main loop; see set_mass_storage_mode
+ */
+static gint64
+set_mode_begin( nyx_mass_storage_mode_t mode, bool exported )
+{
+    gint64 start = MetricsNow();
+
+    if (mode != NYX_MASS_STORAGE_MODE_ENABLE && !exported) {
+        STORAGED_TRACE1(nyx__set__mode__begin, mode);
+        return start;
+    }
+
+    /* the host is done with the partition's tuning profile */
+    if (mode != NYX_MASS_STORAGE_MODE_ENABLE)
+        TuningRevert();
+
+    JobBegin(mode_job(mode));
+    STORAGED_TRACE1(nyx__set__mode__begin, mode);
+    return start;
+}
+
+static void
+set_mode_end( nyx_mass_storage_mode_t mode, bool exported, gint64 start,
+              nyx_error_t ret, nyx_mass_storage_mode_return_code_t ret_status )
+{
+    STORAGED_TRACE3(nyx__set__mode__end, mode, ret, ret_status);
+    if (mode != NYX_MASS_STORAGE_MODE_ENABLE && !exported)
+        return;
+    JobEnd(mode_job(mode));
+
+    MetricStage stage;
+    if (mode == NYX_MASS_STORAGE_MODE_ENABLE)
+        stage = METRIC_UNMOUNT;
+    else if (ret == NYX_ERROR_NONE && ret_status >= NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED)
+        stage = METRIC_REFORMAT;
+    else if (mode == NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK)
+        stage = METRIC_FSCK;
+    else
+        stage = METRIC_REMOUNT;
+    MetricsRecord(stage, start);
+}
+
+/**
+ * @brief set the backend's mass storage mode, timed under the stage it
+ * turned out to be.
+ *
+ * @param exported  whether the partition was exported; if not, leaving MSM
+ *                  has nothing to do and isn't timed or run as a job
+ */
+static nyx_error_t
+set_mass_storage_mode( nyx_mass_storage_mode_t mode, bool exported,
+                       nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    gint64 start = set_mode_begin(mode, exported);
+    nyx_error_t ret = sBackend->set_mode(mode, ret_status);
+    set_mode_end(mode, exported, start, ret, *ret_status);
+    return ret;
+}
 
 /**
  * @brief timer proc that, when fired by a GTimer, attempts to make the disk
@@ -86,19 +244,54 @@ umount_timer_proc( gpointer data )
     g_debug( "%s()", __func__ );
     LSHandle* lsh = (LSHandle*)data;
 
+    WatchdogEnter( __func__ );
+    MetricsRecord( METRIC_UNMOUNT_WAIT, sUmountWaitStart );
+    HoldersEndRelease();
+
     nyx_mass_storage_mode_return_code_t ret_status;
 
-    bool ret = nyx_mass_storage_mode_set_mode(nyxMassStorageMode,NYX_MASS_STORAGE_MODE_ENABLE, &ret_status);
+    nyx_error_t ret = set_mass_storage_mode(NYX_MASS_STORAGE_MODE_ENABLE, true, &ret_status);
+    guint grace_ms;
 
+    sUmountTimerId = 0;
     if( ret == NYX_ERROR_NONE) {
         finish_mass_storage_mode_transition( lsh );
+    } else if ( EvictNextStep( MEDIA_INTERNAL, &grace_ms ) ) {
+        g_message("Partition busy (return code %d), retrying in %u ms", ret_status, grace_ms);
+        arm_umount_timer( lsh, grace_ms );
     } else {
         g_message("Aborting Mass Storage Mode due to return code : %d",ret_status);
         abort_mass_storage_mode_transition( lsh );
     }
-    sUmountTimerId = 0;
+    save_state();
+    WatchdogLeave();
+
+    return false;               /* a retry re-arms us; user is waiting.... */
+}
 
-    return false;               /* we never try again; user is waiting.... */
+static void
+arm_umount_timer( LSHandle* lsh, guint interval_ms )
+{
+    sUmountWaitStart = MetricsNow();
+    sUmountDeadline = g_get_monotonic_time() + (gint64)interval_ms * 1000;
+    sUmountTimerId = RecorderTimeoutAdd( RECORDER_TIMER_UMOUNT, G_PRIORITY_DEFAULT,
+                                         interval_ms, umount_timer_proc, lsh );
+    save_state();
+}
+
+/**
+ * @brief every registered holder has released its files: unmount now
+ * rather than when the grace period runs out
+ */
+static void
+cut_umount_wait( LSHandle* lsh )
+{
+    g_debug( "%s()", __func__ );
+    RecorderTimeoutRemove( sUmountTimerId );
+    sUmountDeadline = g_get_monotonic_time();
+    sUmountTimerId = RecorderTimeoutAdd( RECORDER_TIMER_UMOUNT, G_PRIORITY_DEFAULT,
+                                         0, umount_timer_proc, lsh );
+    save_state();
 }
 
 /**
@@ -109,7 +302,7 @@ set_umount_timer( LSHandle* lsh )
 {
     g_debug( "%s()", __func__ );
     if ( 0 == sUmountTimerId ) {
-        sUmountTimerId = g_timeout_add_seconds( MSM_WAIT_SECONDS, umount_timer_proc, lsh );
+        arm_umount_timer( lsh, MSM_WAIT_SECONDS * 1000 );
     } else {
         g_debug( "%s: timer exists; not creating", __func__ );
     }
@@ -132,48 +325,171 @@ launch_customization(LSHandle* lsh)
     LSErrorFree( &lserror );
 }
 
+/**
+ * @brief the partition is mounted again after MSM: tell the world
+ */
+static void
+partition_ready( LSHandle* lsh, bool reformatted, bool fsck_found_problem )
+{
+    /* get the reads going before anyone is told they can start them */
+    MountOptsBegin( MEDIA_INTERNAL );
+    if (!reformatted)
+        WarmupStart( MEDIA_INTERNAL );
+    SignalPartitionAvail( lsh, MEDIA_INTERNAL, true, reformatted, fsck_found_problem );
+    ResumeBegin( MEDIA_INTERNAL );
+}
+
+/**
+ * @brief called on the main loop once the default content is back, or not
+ */
+static void
+restore_done( RestoreResult result, gpointer data )
+{
+    LSHandle* lsh = data;
+
+    if (RESTORE_UNMOUNTED == result) {
+        /* a torn image: nothing there to copy into or to tell anyone about */
+        FlightDump( "partition left unmounted" );
+        if (sAvailAfterRestore)
+            SignalPartitionAvail( lsh, MEDIA_INTERNAL, false, true, sRestoreFsckProblem );
+        sAvailAfterRestore = false;
+        return;
+    }
+    if (RESTORE_FAILED == result)
+        launch_customization(lsh);
+    if (sAvailAfterRestore)
+        partition_ready( lsh, true, sRestoreFsckProblem );
+    sAvailAfterRestore = false;
+}
+
 void handle_mass_storage_mode_exit(nyx_mass_storage_mode_return_code_t ret_status, LSHandle* lsh)
 {
+    bool reformatted = (ret_status >= NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED);
+    bool fsck_found_problem = (ret_status == NYX_MASS_STORAGE_MODE_FSCK_PROBLEM) || (ret_status == NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED_FSCK_PROBLEM);
+    bool restoring = false;
+
     /* Let's just ignore this message if we can't get into Mass Storage Mode at all. */
-    if (ret_status >= NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED)
+    if (reformatted)
     {
         g_critical("Drive reformatted due to unmount failures");
-        if(ret_status != NYX_MASS_STORAGE_MODE_MOUNT_FAILURE_AFTER_REFORMAT)
-            launch_customization(lsh);
+        FlightDump( "partition reformatted" );
+        restoring = (ret_status != NYX_MASS_STORAGE_MODE_MOUNT_FAILURE_AFTER_REFORMAT);
     }
 
+    if (restoring) {
+        /* PartitionAvail once the default content is back */
+        sAvailAfterRestore = unmount;
+        sRestoreFsckProblem = fsck_found_problem;
+    } else if (unmount) {
+        partition_ready( lsh, reformatted, fsck_found_problem );
+    }
     if (unmount) {
-        bool reformatted = (ret_status >= NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED);
-        bool fsck_found_problem = (ret_status == NYX_MASS_STORAGE_MODE_FSCK_PROBLEM) || (ret_status == NYX_MASS_STORAGE_MODE_PARTITION_REFORMATTED_FSCK_PROBLEM);
-        SignalPartitionAvail( lsh, MEDIA_INTERNAL, true, reformatted, fsck_found_problem );
         unmount = false;
+        STORAGED_TRACE1(state__unmount, false);
     }
+
+    if (restoring)
+        RestoreStart( MEDIA_INTERNAL, restore_done, lsh );
+}
+
+/**
+ * @brief run the scripts in path, off the main loop or not; see
+ * execute_scripts
+ */
+static gint64
+scripts_begin(const char* path)
+{
+    gint64 start = MetricsNow();
+    g_debug("%s: executing run-parts %s", __func__, path);
+    JobBegin(JOB_SCRIPTS);
+    STORAGED_TRACE1(script__spawn, path);
+    return start;
 }
 
 static void
-execute_scripts(const char* path, GError **error)
+scripts_run(const char* path, char** std_err, int* exit_status, GError** error)
 {
     char * comm = g_strdup_printf("run-parts %s", path);
-    char * std_err = NULL;
-    g_debug("%s: executing %s", __func__, comm);
-    (void) g_spawn_command_line_sync(comm, NULL, &std_err, NULL, error);
+    (void) g_spawn_command_line_sync(comm, NULL, std_err, exit_status, error);
     g_free(comm);
+}
+
+static void
+scripts_end(const char* path, MetricStage stage, gint64 start, int exit_status, char* std_err)
+{
+    STORAGED_TRACE2(script__exit, path, exit_status);
+    JobEnd(JOB_SCRIPTS);
+    MetricsRecord(stage, start);
     SHOW_STDERR(std_err);
 }
 
+static void
+execute_scripts(const char* path, MetricStage stage, GError **error)
+{
+    char * std_err = NULL;
+    int exit_status = 0;
+    gint64 start = scripts_begin(path);
+    scripts_run(path, &std_err, &exit_status, error);
+    scripts_end(path, stage, start, exit_status, std_err);
+}
+
+/**
+ * @brief tell the backend about the cable, and find out whether the
+ * partition is still exported
+ */
+static bool
+cable_changed( bool plugIn, bool* know_export_state )
+{
+    int mass_storage_mode_state = 0;
+
+    sHostConnected = plugIn;
+
+    if (sBackend->host_connected)
+        sBackend->host_connected(plugIn);
+
+    *know_export_state = sBackend->get_state(&mass_storage_mode_state);
+    return mass_storage_mode_state & NYX_MASS_STORAGE_MODE_MODE_ON;
+}
+
+/**
+ * @brief the cable was pulled: what comes before leaving MSM...
+ */
+static void
+unplugged_begin( LSHandle* lsh, bool still_exported )
+{
+    /* We've just lost a connection we had: cable was unplugged */
+    if (sUmountTimerId != 0) {
+        g_debug("%s: UmountTimer existed after cable pull. removing source", __func__);
+        RecorderTimeoutRemove(sUmountTimerId);
+        sUmountTimerId = 0;
+        HoldersEndRelease();
+        EvictEnd( false );
+    }
+    if(still_exported)
+        SignalMSMFscking(lsh);
+}
+
+/**
+ * @brief ...and what comes after it and the post-MSM scripts
+ */
+static void
+unplugged_end( LSHandle* lsh )
+{
+    sNeedToRunPostScripts = false;
+
+    SignalMSMAvailChange( lsh, false );
+
+    // can now shut down
+    reset_lifetime_timer();
+}
+
 static void
 handle_cable( LSHandle* lsh, bool plugIn) {
 
     g_debug("%s: called with plugin=%d", __func__, plugIn);
     GError *error = NULL;
-    bool still_exported = true; 
     bool know_export_state = true;
-    int mass_storage_mode_state = 0;
-
-    know_export_state = nyx_mass_storage_mode_get_state(nyxMassStorageMode, &mass_storage_mode_state);
-    still_exported = mass_storage_mode_state & NYX_MASS_STORAGE_MODE_MODE_ON;
-
-    SHOW_ERROR(error);
+    bool still_exported = cable_changed(plugIn, &know_export_state);
 
     if ( plugIn ) {
         if (know_export_state && still_exported) {
@@ -181,42 +497,228 @@ handle_cable( LSHandle* lsh, bool plugIn) {
         } else {
             /* Tell the world */
             SignalMSMAvailChange( lsh, true );
+
+            /* the user may well confirm: get the writeback out of the way */
+            PreflushStart( MEDIA_INTERNAL );
         }
 
         // must not shut down
         disable_lifetime_timer();
     } else {
-        /* We've just lost a connection we had: cable was unplugged */
-        if (sUmountTimerId != 0) {
-            g_debug("%s: UmountTimer existed after cable pull. removing source", __func__);
-            g_source_remove(sUmountTimerId);
-            sUmountTimerId = 0;
-        }
-        if(still_exported)
-            SignalMSMFscking(lsh);
+        unplugged_begin(lsh, still_exported);
 
         nyx_mass_storage_mode_return_code_t ret_status;
-        nyx_mass_storage_mode_set_mode(nyxMassStorageMode, NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, &ret_status);
+        set_mass_storage_mode(NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, still_exported, &ret_status);
 
         handle_mass_storage_mode_exit(ret_status,lsh);
 
         if (sNeedToRunPostScripts) {
-            execute_scripts(POSTMSM_SCRIPT_DIR, &error);
+            execute_scripts(POSTMSM_SCRIPT_DIR, METRIC_POST_SCRIPTS, &error);
             SHOW_ERROR(error);
         }
 
-        sNeedToRunPostScripts = false;
-
-        SignalMSMAvailChange( lsh, false );
-
-        // can now shut down
-        reset_lifetime_timer();
+        unplugged_end(lsh);
     }
+    save_state();
 }
 
 
 /** handle_cableLS: called on notification from udev that cable plugged in
 */
+/**
+ * @brief pick up where the previous instance left off, the hardware being
+ * where it left it: no fsck, no scripts, no signals
+ */
+static void
+resume_from_snapshot( LSHandle* lsh )
+{
+    g_message( "%s: resuming (inMSM=%d unmount=%d connected=%d)", __func__,
+               sSnapshot.inMSM, sSnapshot.unmount, sSnapshot.hostConnected );
+
+    inMSM = sSnapshot.inMSM;
+    unmount = sSnapshot.unmount;
+    sNeedToRunPostScripts = sSnapshot.needPostScripts;
+    sHostConnected = sSnapshot.hostConnected;
+
+    if ( sSnapshot.umountDeadline ) {
+        sTransitionStart = MetricsNow();    /* the real start was lost with the old instance */
+        gint64 remaining = sSnapshot.umountDeadline - g_get_monotonic_time();
+        arm_umount_timer( lsh, remaining > 0 ? (guint)(remaining / 1000) : 0 );
+    }
+
+    if ( sHostConnected )
+        disable_lifetime_timer();     // must not shut down
+    else
+        reset_lifetime_timer();       // can shut down
+    save_state();
+}
+
+/**
+ * @brief bring our state in line with the hardware's: resume from the
+ * previous instance's snapshot if the hardware agrees with it, otherwise
+ * act as if the cable had just been plugged in (or pulled)
+ */
+static void
+reconcile_done( void )
+{
+    sReconciling = false;
+    LifetimeRelease();
+    LifetimeStarted();
+
+    g_free( sStatusReply );     /* drop "reconciling" */
+    sStatusReply = NULL;
+    MetricsRecord( METRIC_RECONCILE, sReconcileStart );
+}
+
+static gboolean
+reconcile_step_done( gpointer data )
+{
+    WatchdogEnter( __func__ );
+    reconcile_reap();
+    WatchdogLeave();
+    return FALSE;
+}
+
+/**
+ * @brief run func on a thread, and done on the main loop once it's joined
+ */
+static void
+reconcile_step( const char* name, GThreadFunc func, void (*done)( LSHandle* lsh ) )
+{
+    sReconcileNext = done;
+    sReconcileThread = g_thread_new( name, func, NULL );
+}
+
+static void
+reconcile_reap( void )
+{
+    void (*done)( LSHandle* lsh ) = sReconcileNext;
+
+    if ( NULL == sReconcileThread )
+        return;
+    g_thread_join( sReconcileThread );
+    sReconcileThread = NULL;
+    sReconcileNext = NULL;
+    done( sReconcileHandle );
+}
+
+static gpointer
+reconcile_scripts_thread( gpointer data )
+{
+    scripts_run( POSTMSM_SCRIPT_DIR, &sReconcileStderr, &sReconcileExit, &sReconcileError );
+    g_idle_add( reconcile_step_done, NULL );
+    return NULL;
+}
+
+static void
+reconcile_scripts_done( LSHandle* lsh )
+{
+    scripts_end( POSTMSM_SCRIPT_DIR, METRIC_POST_SCRIPTS, sReconcileStepStart, sReconcileExit, sReconcileStderr );
+    sReconcileStderr = NULL;
+    SHOW_ERROR( sReconcileError );
+
+    unplugged_end( lsh );
+    save_state();
+    reconcile_done();
+}
+
+static gpointer
+reconcile_fsck_thread( gpointer data )
+{
+    sReconcileRet = sBackend->set_mode( NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, &sReconcileStatus );
+    g_idle_add( reconcile_step_done, NULL );
+    return NULL;
+}
+
+static void
+reconcile_fsck_done( LSHandle* lsh )
+{
+    set_mode_end( NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, sReconcileExported, sReconcileStepStart,
+                  sReconcileRet, sReconcileStatus );
+    handle_mass_storage_mode_exit( sReconcileStatus, lsh );
+
+    if ( sNeedToRunPostScripts ) {
+        sReconcileStepStart = scripts_begin( POSTMSM_SCRIPT_DIR );
+        reconcile_step( "reconcile-scripts", reconcile_scripts_thread, reconcile_scripts_done );
+        return;
+    }
+    unplugged_end( lsh );
+    save_state();
+    reconcile_done();
+}
+
+/**
+ * @brief handle_cable( lsh, false ), with the fsck and the post-MSM scripts
+ * on a thread so that requests get answered (flagged "reconciling")
+ * meanwhile
+ */
+static void
+reconcile_unplugged( LSHandle* lsh )
+{
+    bool know_export_state;
+
+    g_debug( "%s: cable out", __func__ );
+    sReconcileExported = cable_changed( false, &know_export_state );
+    unplugged_begin( lsh, sReconcileExported );
+
+    sReconcileStepStart = set_mode_begin( NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, sReconcileExported );
+    reconcile_step( "reconcile-fsck", reconcile_fsck_thread, reconcile_fsck_done );
+}
+
+static void
+reconcile( LSHandle* lsh )
+{
+    int mass_storage_mode_state = 0;
+
+    sReconcileStart = MetricsNow();
+    sBackend->get_state(&mass_storage_mode_state);
+    bool connected = mass_storage_mode_state & NYX_MASS_STORAGE_MODE_HOST_CONNECTED;
+    bool exported = mass_storage_mode_state & NYX_MASS_STORAGE_MODE_MODE_ON;
+    bool resume = sHaveSnapshot && sSnapshot.hostConnected == connected && sSnapshot.unmount == exported;
+
+    sHaveSnapshot = false;
+    if ( resume ) {
+        resume_from_snapshot( lsh );
+    } else if ( !connected ) {
+        reconcile_unplugged( lsh );     /* finished by reconcile_done */
+        return;
+    } else {
+        handle_cable( lsh, connected );
+        //TODO: handle case where media is exported, but cable is not plugged in.. or media is not exported, but in media mode.
+    }
+    reconcile_done();
+}
+
+static gboolean
+reconcile_timer_proc( gpointer data )
+{
+    WatchdogEnter( __func__ );
+    sReconcileId = 0;
+    reconcile( (LSHandle*)data );
+    WatchdogLeave();
+    return false;
+}
+
+/**
+ * @brief run startup reconciliation now if it hasn't run yet, so that a
+ * request that changes state acts on the real state
+ */
+static void
+finish_reconciling( void )
+{
+    if ( sReconcileId ) {
+        g_debug( "%s: request arrived before reconciliation", __func__ );
+        RecorderTimeoutRemove( sReconcileId );
+        sReconcileId = 0;
+        reconcile( sReconcileHandle );
+    }
+    /* the fsck and scripts it may have left running */
+    while ( sReconcileThread ) {
+        g_debug( "%s: request arrived during reconciliation", __func__ );
+        reconcile_reap();
+    }
+}
+
 /**
  * @brief called when cable [un]plugged
  */
@@ -224,13 +726,14 @@ static bool
 handle_cableLS( LSHandle* lsh, LSMessage* message, void* user_data )
 {
     LSTRACE_LSMESSAGE(message);
+    finish_reconciling();
     LSError lserror;
     bool result;
     gchar* answer = "";
     bool plugIn;
 
     int mass_storage_mode_state = 0;
-    nyx_mass_storage_mode_get_state(nyxMassStorageMode, &mass_storage_mode_state);
+    sBackend->get_state(&mass_storage_mode_state);
 
     /* Let's just ignore this message if we can't get into Mass Storage Mode at all. */
     if (!(mass_storage_mode_state & NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE))
@@ -281,24 +784,24 @@ handle_mount_on_host(LSHandle *lsh, bool mount)
     if ( !mount ) {
         nyx_mass_storage_mode_return_code_t ret_status;
 
-    nyx_mass_storage_mode_set_mode(nyxMassStorageMode, NYX_MASS_STORAGE_MODE_DISABLE, &ret_status);
+    set_mass_storage_mode(NYX_MASS_STORAGE_MODE_DISABLE, true, &ret_status);
 
     if(ret_status == NYX_MASS_STORAGE_MODE_MOUNT_FAILURE) {
         SignalMSMFscking(lsh);
-        nyx_mass_storage_mode_set_mode(nyxMassStorageMode, NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, &ret_status);
+        set_mass_storage_mode(NYX_MASS_STORAGE_MODE_DISABLE_AFTER_FSCK, true, &ret_status);
         }
 
         handle_mass_storage_mode_exit(ret_status, lsh);
 
         if (sNeedToRunPostScripts) {
-            execute_scripts(POSTMSM_SCRIPT_DIR, &error);
+            execute_scripts(POSTMSM_SCRIPT_DIR, METRIC_POST_SCRIPTS, &error);
             SHOW_ERROR(error);
         }
 
-        inMSM = false;
-        SignalMSMStatus ( lsh, false);
+        set_in_msm( lsh, false );
 
         sNeedToRunPostScripts = false;
+        save_state();
     }
 }
 
@@ -312,6 +815,7 @@ static bool
 handle_mount_on_hostLS( LSHandle* lsh, LSMessage* message, void* user_data )
 {
     LSTRACE_LSMESSAGE(message);
+    finish_reconciling();
     LSError lserror;
     char* answer;
     bool connected;
@@ -320,7 +824,7 @@ handle_mount_on_hostLS( LSHandle* lsh, LSMessage* message, void* user_data )
        involved.
        We can get into this case if passthru mode is enabled, so ignore this event */
     int mass_storage_mode_state = 0;
-    nyx_mass_storage_mode_get_state(nyxMassStorageMode, &mass_storage_mode_state);
+    sBackend->get_state(&mass_storage_mode_state);
 
     if (!(mass_storage_mode_state & NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE))
     {
@@ -364,12 +868,12 @@ handle_host_connected_query( LSHandle* lsh, LSMessage* message, void* user_data
     LSErrorInit( &lserror );
 
     int mass_storage_mode_state = 0;
-    nyx_mass_storage_mode_get_state(nyxMassStorageMode, &mass_storage_mode_state);
+    sBackend->get_state(&mass_storage_mode_state);
     bool connected = mass_storage_mode_state & NYX_MASS_STORAGE_MODE_HOST_CONNECTED;
 
     char reply[128];
-    snprintf( reply, sizeof(reply), "{\"result\": true, \"hostIsConnected\": %s}",
-            connected? "true" : "false");
+    snprintf( reply, sizeof(reply), "{\"result\": true, \"hostIsConnected\": %s%s}",
+            connected? "true" : "false", sReconciling ? ", \"reconciling\": true" : "");
     if ( !LSMessageReply( lsh, message, reply, &lserror ) )
     {
         LSREPORT( lserror );
@@ -392,14 +896,31 @@ static void
 begin_mass_storage_mode_transition( LSHandle* lsh )
 {
     g_debug( "%s()", __func__ );
-    inMSM = true;
-    SignalMSMStatus ( lsh, true);
-    SignalMSMProgress( lsh, MSM_MODE_CHANGE_ATTEMPTING, false );
+    sTransitionStart = MetricsNow();
+    STORAGED_TRACE0(transition__begin);
+    /* finish putting the default content back (and announcing it) first */
+    RestoreWait();
+    set_in_msm( lsh, true );
+    ResumeEnd();
+    MountOptsEnd();
+    guint holders = HoldersBeginRelease();
+    g_debug( "%s: waiting for %u registered holders", __func__, holders );
+    EvictBegin();
+    SignalMSMProgress( lsh, MSM_MODE_CHANGE_ATTEMPTING, false, NULL );
+
+    /* a warm-up still running would hold the partition busy */
+    WarmupCancel();
+
+    /* while applications still have their files open */
+    WarmupRecord( MEDIA_INTERNAL );
+    TuningNoteDevice( MEDIA_INTERNAL );
 
     GError * error = NULL;
-    execute_scripts(PREMSM_SCRIPT_DIR, &error);
+    execute_scripts(PREMSM_SCRIPT_DIR, METRIC_PRE_SCRIPTS, &error);
     SHOW_ERROR(error);
 
+    PreflushFinal( MEDIA_INTERNAL );
+
     sNeedToRunPostScripts = true;
 
     set_umount_timer( lsh );
@@ -411,8 +932,14 @@ begin_mass_storage_mode_transition( LSHandle* lsh )
 static void
 finish_mass_storage_mode_transition( LSHandle* lsh)
 {
-    SignalMSMProgress( lsh, MSM_MODE_CHANGE_SUCCEEDED, false );
+    SignalMSMProgress( lsh, MSM_MODE_CHANGE_SUCCEEDED, false, NULL );
+    EvictEnd( true );
+    TuningApply();
     unmount = true;
+    STORAGED_TRACE1(state__unmount, true);
+    STORAGED_TRACE0(transition__finish);
+    MetricsRecord( METRIC_MSM_ENTRY, sTransitionStart );
+    save_state();
 }
 
 /**
@@ -422,9 +949,15 @@ static void
 abort_mass_storage_mode_transition( LSHandle* lsh )
 {
     g_warning("%s: called", __func__);
-    inMSM = false;
-    SignalMSMStatus ( lsh, false);
-    SignalMSMProgress( lsh, MSM_MODE_CHANGE_FAILED, false );
+    STORAGED_TRACE0(transition__abort);
+    set_in_msm( lsh, false );
+
+    gchar* holders = EvictReport();
+    SignalMSMProgress( lsh, MSM_MODE_CHANGE_FAILED, false, holders );
+    g_free( holders );
+    EvictEnd( false );
+    MetricsRecord( METRIC_MSM_ENTRY, sTransitionStart );
+    FlightDump( "transition aborted" );
 }
 
 static bool
@@ -474,6 +1007,7 @@ static bool
 handle_enter_mass_storage_mode( LSHandle* lsh, LSMessage* message, void* user_data )
 {
     LSTRACE_LSMESSAGE(message);
+    finish_reconciling();
 
     LSError lserror;
     LSErrorInit( &lserror );
@@ -495,7 +1029,7 @@ handle_enter_mass_storage_mode( LSHandle* lsh, LSMessage* message, void* user_da
     if ( confirmed )
     {
         int mass_storage_mode_state = 0;
-        nyx_mass_storage_mode_get_state(nyxMassStorageMode, &mass_storage_mode_state);
+        sBackend->get_state(&mass_storage_mode_state);
         bool connected = mass_storage_mode_state & NYX_MASS_STORAGE_MODE_HOST_CONNECTED;
 
         if ( !connected ) {
@@ -529,17 +1063,33 @@ err:
     return true;
 } /* handle_enter_mass_storage_mode */
 
+/**
+ * @brief registerHolder, unregisterHolder and released: see holders.h
+ */
 static bool
-handle_mass_storage_mode_status_query( LSHandle* lsh, LSMessage* message, void* user_data )
+handle_holder( LSHandle* lsh, LSMessage* message, void* user_data )
 {
     LSTRACE_LSMESSAGE(message);
 
     LSError lserror;
     LSErrorInit( &lserror );
 
-    char reply[128];
-    snprintf( reply, sizeof(reply), "{\"result\": true, \"inMSM\": %s}",
-            inMSM? "true" : "false");
+    const char* method = LSMessageGetMethod( message );
+    const char* reply = "{\"returnValue\":true}";
+    bool allReleased = false;
+
+    if ( !strcmp( method, "registerHolder" ) ) {
+        if ( !HoldersRegister( message ) )
+            reply = "{\"returnValue\":false, \"errorText\":\"already registered\"}";
+    } else if ( !strcmp( method, "unregisterHolder" ) ) {
+        if ( !HoldersUnregister( message, &allReleased ) )
+            reply = "{\"returnValue\":false, \"errorText\":\"not registered\"}";
+    } else {
+        allReleased = HoldersReleased( message );
+    }
+
+    if ( allReleased && 0 != sUmountTimerId )
+        cut_umount_wait( lsh );
 
     if ( !LSMessageReply( lsh, message, reply, &lserror ) )
     {
@@ -548,8 +1098,196 @@ handle_mass_storage_mode_status_query( LSHandle* lsh, LSMessage* message, void*
 
     LSErrorFree( &lserror );
     return true;
+} /* handle_holder */
+
+/**
+ * @brief registerResume, unregisterResume and resumed: see resume.h
+ */
+static bool
+handle_resume( LSHandle* lsh, LSMessage* message, void* user_data )
+{
+    LSTRACE_LSMESSAGE(message);
+
+    LSError lserror;
+    LSErrorInit( &lserror );
+
+    const char* method = LSMessageGetMethod( message );
+    const char* reply = "{\"returnValue\":true}";
+
+    if ( !strcmp( method, "registerResume" ) ) {
+        const char* tier = NULL;
+        struct json_object *object = json_tokener_parse( LSMessageGetPayload( message ) );
+        if ( !is_error( object ) )
+            tier = json_object_get_string( json_object_object_get( object, "class" ) );
+        if ( !ResumeRegister( message, tier ) )
+            reply = "{\"returnValue\":false, \"errorText\":\"param 'class' missing or invalid\"}";
+        if ( !is_error( object ) )
+            json_object_put( object );
+    } else if ( !strcmp( method, "unregisterResume" ) ) {
+        if ( !ResumeUnregister( message ) )
+            reply = "{\"returnValue\":false, \"errorText\":\"not registered\"}";
+    } else {
+        ResumeResumed( message );
+    }
+
+    if ( !LSMessageReply( lsh, message, reply, &lserror ) )
+    {
+        LSREPORT( lserror );
+    }
+
+    LSErrorFree( &lserror );
+    return true;
+} /* handle_resume */
+
+static void
+reply_mass_storage_mode_status( LSHandle* lsh, LSMessage* message )
+{
+    LSError lserror;
+    LSErrorInit( &lserror );
+
+    if ( NULL == sStatusReply ) {
+        sStatusReply = g_strdup_printf( "{\"result\": true, \"inMSM\": %s%s}",
+                inMSM? "true" : "false", sReconciling ? ", \"reconciling\": true" : "");
+    }
+
+    if ( !LSMessageReply( lsh, message, sStatusReply, &lserror ) )
+    {
+        LSREPORT( lserror );
+    }
+
+    LSErrorFree( &lserror );
+}
+
+static bool
+handle_mass_storage_mode_status_query( LSHandle* lsh, LSMessage* message, void* user_data )
+{
+    LSTRACE_LSMESSAGE(message);
+
+    reply_mass_storage_mode_status( lsh, message );
+    return true;
 } /* handle_mass_storage_mode_status_query */
 
+/**
+ * @brief public flavour of queryMSMStatus, which any app may call: charge
+ * each call to its sender's rate limit before answering.
+ */
+static bool
+handle_mass_storage_mode_status_query_public( LSHandle* lsh, LSMessage* message, void* user_data )
+{
+    LSTRACE_LSMESSAGE_UNCOUNTED(message);
+
+    switch ( RateLimitCheck( message ) ) {
+    case RATE_LIMIT_ALLOW:
+        LifetimeActivity();
+        reply_mass_storage_mode_status( lsh, message );
+        break;
+    case RATE_LIMIT_THROTTLE:
+        {
+            LSError lserror;
+            LSErrorInit( &lserror );
+            if ( !LSMessageReply( lsh, message,
+                    "{\"returnValue\":false,\"errorText\":\"too many requests\"}", &lserror ) )
+            {
+                LSREPORT( lserror );
+            }
+            LSErrorFree( &lserror );
+        }
+        break;
+    case RATE_LIMIT_DROP:
+        break;
+    }
+
+    return true;
+} /* handle_mass_storage_mode_status_query_public */
+
+/**
+ * @brief report storaged's internal metrics as one json object
+ */
+static bool
+handle_stats( LSHandle* lsh, LSMessage* message, void* user_data )
+{
+    LSTRACE_LSMESSAGE(message);
+
+    LSError lserror;
+    LSErrorInit( &lserror );
+
+    GString* reply = g_string_new( "{\"returnValue\":true, " );
+    DispatchAppendStats( reply );
+    g_string_append( reply, ", " );
+    RateLimitAppendStats( reply );
+    g_string_append( reply, ", " );
+    MetricsAppendStats( reply );
+    g_string_append( reply, ", " );
+    WatchdogAppendStats( reply );
+    g_string_append( reply, ", " );
+    LifetimeAppendStats( reply );
+    g_string_append( reply, ", " );
+    HoldersAppendStats( reply );
+    g_string_append( reply, ", " );
+    EvictAppendStats( reply );
+    g_string_append( reply, ", " );
+    ResumeAppendStats( reply );
+    g_string_append( reply, ", " );
+    TuningAppendStats( reply );
+    g_string_append( reply, ", " );
+    JobsAppendStats( reply );
+    g_string_append( reply, ", " );
+    QosAppendStats( reply );
+    g_string_append( reply, ", " );
+    PreflushAppendStats( reply );
+    g_string_append( reply, ", " );
+    WarmupAppendStats( reply );
+    g_string_append( reply, ", " );
+    RestoreAppendStats( reply );
+    g_string_append( reply, ", " );
+    MountOptsAppendStats( reply );
+    g_string_append( reply, ", " );
+    logAppendStats( reply );
+    g_string_append( reply, "}" );
+
+    if ( !LSMessageReply( lsh, message, reply->str, &lserror ) )
+    {
+        LSREPORT( lserror );
+    }
+
+    g_string_free( reply, TRUE );
+    LSErrorFree( &lserror );
+    return true;
+} /* handle_stats */
+
+/**
+ * @brief return the flight recorder's contents; {"dump": true} also writes
+ * them to FLIGHT_FILE_PATH
+ */
+static bool
+handle_flight_recorder( LSHandle* lsh, LSMessage* message, void* user_data )
+{
+    LSTRACE_LSMESSAGE(message);
+
+    LSError lserror;
+    LSErrorInit( &lserror );
+
+    struct json_object* object = json_tokener_parse( LSMessageGetPayload( message ) );
+    if ( !is_error( object ) ) {
+        if ( json_object_get_boolean( json_object_object_get( object, "dump" ) ) )
+            FlightDump( "requested" );
+        json_object_put( object );
+    }
+
+    GString* reply = g_string_new( "{\"returnValue\":true, " );
+    FlightAppendRecords( reply );
+    g_string_append( reply, "}" );
+
+    if ( !LSMessageReply( lsh, message, reply->str, &lserror ) )
+    {
+        LSREPORT( lserror );
+    }
+
+    g_string_free( reply, TRUE );
+    LSErrorFree( &lserror );
+    return true;
+} /* handle_flight_recorder */
+
 
 static LSMethod diskModePrivMethods[] = {
     { "changed", handle_cableLS },   /* notification from udev: cable plugged in */
@@ -558,11 +1296,19 @@ static LSMethod diskModePrivMethods[] = {
     { "enterMSM", handle_enter_mass_storage_mode }, /* command/notice of user confirmation to enter Mass Storage Mode */
     { "hostIsConnected", handle_host_connected_query },       /* support questions about state of USB */
     { "queryMSMStatus", handle_mass_storage_mode_status_query },   /* query if device is in Mass Storage Mode */
+    { "stats", handle_stats },       /* internal metrics */
+    { "flightRecorder", handle_flight_recorder },   /* recent tracepoints */
+    { "registerHolder", handle_holder },    /* caller keeps files open on /media/internal */
+    { "unregisterHolder", handle_holder },
+    { "released", handle_holder },  /* holder has closed its files for MSM */
+    { "registerResume", handle_resume },    /* caller's class for the staggered resume */
+    { "unregisterResume", handle_resume },
+    { "resumed", handle_resume },   /* caller has reopened its files after MSM */
     { },
 };
 
 static LSMethod diskModePubMethods[] = {
-    { "queryMSMStatus", handle_mass_storage_mode_status_query },   /* query if device is in Mass Storage Mode */
+    { "queryMSMStatus", handle_mass_storage_mode_status_query_public },   /* query if device is in Mass Storage Mode */
     {},
 };
 
@@ -597,19 +1343,27 @@ DiskModeInterfaceInit(GMainLoop *loop, LSHandle* priv_handle, LSHandle* pub_hand
 
     g_debug("%s: starting up", __func__);
 
-    nyxMassStorageMode = GetNyxMassStorageModeDevice();
+    sBackend = GetStorageBackend();
 
-    int mass_storage_mode_state = 0;
-    nyx_mass_storage_mode_get_state(nyxMassStorageMode, &mass_storage_mode_state);
-    bool connected = mass_storage_mode_state & NYX_MASS_STORAGE_MODE_HOST_CONNECTED;
+    sHaveSnapshot = RecorderSnapshot( StateLoad( &sSnapshot ), &sSnapshot );
+    if ( sHaveSnapshot ) {
+        SignalsRestoreSequence( sSnapshot.signalInstance, sSnapshot.signalSeq );
+        LifetimeRestore( &sSnapshot );
+    }
 
     //register for Mass Storage Mode state changes
-    nyx_mass_storage_mode_register_change_callback(nyxMassStorageMode, mass_storage_mode_state_changed, NULL);
-
-    // behave like the cable just got plugged in (or unplugged)
-    // This ensures we start at the correct state
-    handle_cable( priv_handle, connected);
-    //TODO: handle case where media is exported, but cable is not plugged in.. or media is not exported, but in media mode.
+    sBackend->register_change_callback(mass_storage_mode_state_changed, NULL);
+
+    // Behave like the cable just got plugged in (or unplugged) to start at
+    // the correct state.  That can mean an fsck and the post-MSM scripts,
+    // so do it from the main loop once we're attached, with those two on a
+    // thread: boot-time callers get answers (flagged "reconciling")
+    // meanwhile, and a request that changes state waits for it first.
+    sReconcileHandle = priv_handle;
+    sReconciling = true;
+    LifetimeHold();
+    sReconcileId = RecorderTimeoutAdd( RECORDER_TIMER_RECONCILE, G_PRIORITY_DEFAULT_IDLE, 0,
+                                       reconcile_timer_proc, priv_handle );
     return 0;
 }
 
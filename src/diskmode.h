@@ -19,3 +19,18 @@
 int DiskModeInterfaceInit(GMainLoop *loop, LSHandle* priv_handle, LSHandle* pub_handle,
                       bool invertCarrier );
 
+/** DiskModeShutdown
+ *
+ * The main loop has quit: wait for the work still running on threads
+ * (reconciliation, a restore, which may start a warm-up, and a preflush),
+ * stopping the warm-up, so that it's all accounted for and nothing of
+ * storaged's is left open on the partition.
+ */
+void DiskModeShutdown( void );
+
+/** DiskModeSaveState
+ *
+ * Write the state snapshot (see state.h) now, e.g. on the way out.
+ */
+void DiskModeSaveState( void );
+
@@ -0,0 +1,163 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "dispatch.h"
+#include "metrics.h"
+#include "recorder.h"
+
+/*
+ * luna-service2 doesn't tell us how many messages are waiting on a
+ * connection, nor when they arrived.  What we can see is when the main loop
+ * wakes up after having been idle: everything dispatched until it next goes
+ * idle was waiting at most since then.  So a "busy period" starts whenever
+ * poll() is entered with a non-zero timeout, the queue depth of a connection
+ * is the number of its messages handled within one busy period, and the wait
+ * time of a message is the time from the start of the busy period until its
+ * handler runs (an upper bound on its real queueing delay).
+ */
+
+#define MAX_CONNECTIONS 2
+
+typedef struct
+{
+    LSHandle* lsh;
+    const char* name;
+    int priority;
+    guint64 messages;
+    guint depth;                /* messages in the current busy period */
+    guint maxDepth;
+    gint64 waitTotal;           /* microseconds */
+    gint64 waitMax;
+}
+DispatchConnection;
+
+static DispatchConnection sConnections[ MAX_CONNECTIONS ];
+static int sNumConnections = 0;
+
+static GPollFunc sDefaultPoll = NULL;
+static gint64 sBusySince = 0;
+static gint64 sStartup = 0;        /* 0 once the first reply has been timed */
+
+static gint
+dispatch_poll( GPollFD* ufds, guint nfds, gint timeout )
+{
+    gint ret = sDefaultPoll( ufds, nfds, timeout );
+
+    /* a zero timeout means sources were already ready: still busy */
+    if ( timeout != 0 ) {
+        int i;
+        sBusySince = g_get_monotonic_time();
+        for ( i = 0; i < sNumConnections; i++ )
+            sConnections[i].depth = 0;
+    }
+
+    return ret;
+}
+
+void
+DispatchInit( GMainLoop* loop )
+{
+    GMainContext* context = g_main_loop_get_context( loop );
+
+    sDefaultPoll = g_main_context_get_poll_func( context );
+    g_main_context_set_poll_func( context, dispatch_poll );
+    sBusySince = g_get_monotonic_time();
+    sStartup = MetricsNow();
+}
+
+bool
+DispatchAttach( LSHandle* lsh, const char* name, int priority,
+                GMainLoop* loop, LSError* lserror )
+{
+    if ( !LSGmainAttach( lsh, loop, lserror ) ) {
+        g_critical( "LSGmainAttach %s returned %s", name, lserror->message );
+        return false;
+    }
+
+    if ( !LSGmainSetPriority( lsh, priority, lserror ) ) {
+        g_critical( "LSGmainSetPriority %s returned %s", name, lserror->message );
+        return false;
+    }
+
+    if ( sNumConnections < MAX_CONNECTIONS ) {
+        DispatchConnection* conn = &sConnections[ sNumConnections++ ];
+        conn->lsh = lsh;
+        conn->name = name;
+        conn->priority = priority;
+    }
+
+    g_debug( "%s: %s connection attached at priority %d", __func__, name, priority );
+    return true;
+}
+
+void
+DispatchAccount( LSMessage* message )
+{
+    LSHandle* lsh = LSMessageGetConnection( message );
+    int i;
+
+    for ( i = 0; i < sNumConnections; i++ ) {
+        DispatchConnection* conn = &sConnections[i];
+        if ( conn->lsh != lsh )
+            continue;
+
+        gint64 wait = g_get_monotonic_time() - sBusySince;
+
+        conn->messages++;
+        conn->depth++;
+        if ( conn->depth > conn->maxDepth )
+            conn->maxDepth = conn->depth;
+        conn->waitTotal += wait;
+        if ( wait > conn->waitMax )
+            conn->waitMax = wait;
+
+        RecorderMessage( message, conn->name );
+        break;
+    }
+}
+
+void
+DispatchFinish( void )
+{
+    if ( sStartup ) {
+        MetricsRecord( METRIC_FIRST_REPLY, sStartup );
+        sStartup = 0;
+    }
+}
+
+void
+DispatchAppendStats( GString* out )
+{
+    int i;
+
+    g_string_append( out, "\"dispatch\":{" );
+    for ( i = 0; i < sNumConnections; i++ ) {
+        DispatchConnection* conn = &sConnections[i];
+        g_string_append_printf( out, "%s\"%s\":{\"priority\":%d, \"messages\":%" G_GUINT64_FORMAT
+                                ", \"depth\":%u, \"maxDepth\":%u, \"waitAvgUs\":%" G_GINT64_FORMAT
+                                ", \"waitMaxUs\":%" G_GINT64_FORMAT "}",
+                                i ? ", " : "", conn->name, conn->priority, conn->messages,
+                                conn->depth, conn->maxDepth,
+                                conn->messages ? conn->waitTotal / (gint64)conn->messages : 0,
+                                conn->waitMax );
+    }
+    g_string_append( out, "}" );
+}
@@ -0,0 +1,65 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_DISPATCH_H__
+#define __STORAGED_DISPATCH_H__
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+/** DispatchInit
+ *
+ * Hook the poll function of the main loop's context so that we know when
+ * the loop wakes up from being idle.  Must be called before DispatchAttach.
+ */
+void DispatchInit( GMainLoop* loop );
+
+/** DispatchAttach
+ *
+ * Attach a luna-service connection to the main loop with the given GSource
+ * priority, and start keeping dispatch metrics for it under "name".
+ *
+ * @return false (with lserror set) if attaching failed; the call that
+ *         failed has been logged.
+ */
+bool DispatchAttach( LSHandle* lsh, const char* name, int priority,
+                     GMainLoop* loop, LSError* lserror );
+
+/** DispatchAccount
+ *
+ * Account for a message that is about to be handled.  Called on entry to
+ * every method handler (see LSTRACE_LSMESSAGE).
+ */
+void DispatchAccount( LSMessage* message );
+
+/** DispatchFinish
+ *
+ * A method handler is returning.  The first time, records how long it took
+ * from DispatchInit (i.e. startup) to answer a call.
+ */
+void DispatchFinish( void );
+
+/** DispatchAppendStats
+ *
+ * Append the "dispatch" member, with per-connection message counts, queue
+ * depths and wait times, to a json object under construction.
+ */
+void DispatchAppendStats( GString* out );
+
+#endif
@@ -25,6 +25,8 @@
 #include <luna-service2/lunaservice.h>
 #include "util.h"
 #include "erase.h"
+#include "jobs.h"
+#include "metrics.h"
 #include "main.h"
 
 typedef enum EraseType
@@ -35,7 +37,7 @@ typedef enum EraseType
     kWipe,
 } EraseType_t;
 
-static nyx_device_handle_t nyxSystem = NULL;
+static const StorageBackend* sBackend = NULL;
 
 /** 
  * @brief Erase
@@ -82,9 +84,15 @@ Erase(LSHandle* pHandle, LSMessage* pMessage, EraseType_t type)
     }
 
     nyx_error_t ret = 0;
-    ret = nyx_system_erase_partition(nyxSystem,nyx_type,error_text);
+    gint64 start = MetricsNow();
+    JobBegin(JOB_ERASE);
+    STORAGED_TRACE1(nyx__erase__begin, nyx_type);
+    ret = sBackend->erase_partition(nyx_type);
+    STORAGED_TRACE2(nyx__erase__end, nyx_type, ret);
+    JobEnd(JOB_ERASE);
+    MetricsRecord(METRIC_ERASE, start);
     if(ret != NYX_ERROR_NONE) {
-    	g_debug("Failed to execute nyx_system_erase_partition, ret : %d",ret);
+    	g_debug("Failed to erase partition, ret : %d",ret);
     	error_text = g_strdup_printf("Failed to execute NYX erase API");
     }
 
@@ -205,7 +213,7 @@ EraseInit(GMainLoop *loop, LSHandle* handle)
         LSREPORT( lserror );
     }
     LSErrorFree( &lserror );
-    nyxSystem = GetNyxSystemDevice();
+    sBackend = GetStorageBackend();
 
     return 0;
 }
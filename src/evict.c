@@ -0,0 +1,394 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+#include <cjson/json.h>
+
+#include "evict.h"
+#include "util.h"
+
+#define EVICT_GROUP             "evict"
+#define EVICT_DEFAULT_GRACE_MS  1000
+#define EVICT_MAX_FILES         8       /* per process, in the report */
+#define FREEZE_CGROUP           "/sys/fs/cgroup/storaged-freeze"
+
+typedef enum
+{
+    EVICT_NOTIFY,
+    EVICT_FREEZE,
+    EVICT_TERMINATE,
+    EVICT_KILL,
+    EVICT_NUM_ACTIONS
+} EvictAction;
+
+static const char* sActionNames[ EVICT_NUM_ACTIONS ] = {
+    "notify", "freeze", "terminate", "kill",
+};
+
+/* what the report says was done */
+static const char* sActionDone[ EVICT_NUM_ACTIONS ] = {
+    "notified", "frozen", "terminated", "killed",
+};
+
+typedef struct
+{
+    pid_t pid;
+    gchar* name;                /* from /proc/<pid>/comm */
+    GPtrArray* files;           /* as of the latest scan */
+    bool holding;               /* found in the latest scan */
+    bool allowed;
+    int action;                 /* latest EvictAction taken, -1 if none */
+    gchar* cgroup;              /* where it came from, while frozen in FREEZE_CGROUP */
+    bool stopped;               /* frozen with SIGSTOP */
+}
+Blocker;
+
+static EvictAction sPolicy[ EVICT_NUM_ACTIONS ] = { EVICT_NOTIFY };
+static guint sPolicyLen = 1;
+static gchar** sAllow = NULL;
+static guint sGraceMs = EVICT_DEFAULT_GRACE_MS;
+
+static guint sStep = 0;
+static GHashTable* sBlockers = NULL;    /* pid -> Blocker */
+
+static guint64 sTaken[ EVICT_NUM_ACTIONS ];
+static guint64 sRescued = 0;            /* transitions that succeeded after a step */
+static guint64 sGaveUp = 0;
+
+static void
+free_blocker( gpointer data )
+{
+    Blocker* blocker = data;
+
+    g_free( blocker->name );
+    g_free( blocker->cgroup );
+    g_ptr_array_free( blocker->files, TRUE );
+    g_free( blocker );
+}
+
+void
+EvictLoadConfig( const char* path )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    GError* error = NULL;
+
+    if ( !g_key_file_load_from_file( keyFile, path, G_KEY_FILE_NONE, &error ) ) {
+        g_debug( "%s: %s; policy is notify only", __func__, error->message );
+        g_error_free( error );
+        g_key_file_free( keyFile );
+        return;
+    }
+
+    gsize len = 0;
+    gchar** steps = g_key_file_get_string_list( keyFile, EVICT_GROUP, "policy", &len, NULL );
+    if ( steps ) {
+        gsize i;
+        sPolicyLen = 0;
+        for ( i = 0; i < len && sPolicyLen < EVICT_NUM_ACTIONS; i++ ) {
+            int action;
+            for ( action = 0; action < EVICT_NUM_ACTIONS; action++ ) {
+                if ( !strcmp( g_strstrip( steps[i] ), sActionNames[action] ) )
+                    break;
+            }
+            if ( action < EVICT_NUM_ACTIONS )
+                sPolicy[ sPolicyLen++ ] = action;
+            else
+                g_warning( "%s: %s: unknown step \"%s\"", __func__, path, steps[i] );
+        }
+        g_strfreev( steps );
+    }
+
+    g_strfreev( sAllow );
+    sAllow = g_key_file_get_string_list( keyFile, EVICT_GROUP, "allow", NULL, NULL );
+
+    gint grace = g_key_file_get_integer( keyFile, EVICT_GROUP, "graceMs", &error );
+    if ( NULL == error && grace >= 0 )
+        sGraceMs = grace;
+    g_clear_error( &error );
+
+    g_key_file_free( keyFile );
+}
+
+void
+EvictBegin( void )
+{
+    sStep = 0;
+    if ( sBlockers )
+        g_hash_table_remove_all( sBlockers );
+}
+
+static bool
+is_allowed( const char* name )
+{
+    gchar** allow;
+
+    for ( allow = sAllow; allow && *allow; allow++ ) {
+        if ( !strcmp( *allow, name ) )
+            return true;
+    }
+    return false;
+}
+
+static void
+note_blocker( const gchar* pidStr, const gchar* fd, const gchar* path, gpointer data )
+{
+    pid_t pid = atoi( pidStr );
+
+    /* never ourselves, nor init */
+    if ( pid <= 1 || pid == getpid() )
+        return;
+
+    Blocker* blocker = g_hash_table_lookup( sBlockers, GINT_TO_POINTER( pid ) );
+    if ( NULL == blocker ) {
+        gchar* commPath = g_strdup_printf( "/proc/%d/comm", pid );
+        blocker = g_new0( Blocker, 1 );
+        blocker->pid = pid;
+        blocker->files = g_ptr_array_new_with_free_func( g_free );
+        blocker->action = -1;
+        if ( g_file_get_contents( commPath, &blocker->name, NULL, NULL ) )
+            g_strchomp( blocker->name );
+        else
+            blocker->name = g_strdup( "" );
+        blocker->allowed = is_allowed( blocker->name );
+        g_hash_table_insert( sBlockers, GINT_TO_POINTER( pid ), blocker );
+        g_free( commPath );
+    }
+
+    if ( !blocker->holding ) {
+        blocker->holding = true;
+        g_ptr_array_set_size( blocker->files, 0 );
+    }
+    if ( blocker->files->len < EVICT_MAX_FILES )
+        g_ptr_array_add( blocker->files, g_strdup( path ) );
+}
+
+static void
+forget_files( gpointer key, gpointer value, gpointer data )
+{
+    ((Blocker*)value)->holding = false;
+}
+
+/**
+ * @brief stop a process, in the freezer cgroup if there is one
+ */
+static void
+freeze( Blocker* blocker )
+{
+    gchar* contents = NULL;
+    gchar* procPath = g_strdup_printf( "/proc/%d/cgroup", blocker->pid );
+
+    /* the unified hierarchy's line is "0::/path" */
+    if ( g_file_get_contents( procPath, &contents, NULL, NULL ) ) {
+        const char* line = strstr( contents, "0::" );
+        if ( line && (line == contents || line[-1] == '\n') )
+            blocker->cgroup = g_strndup( line + 3, strcspn( line + 3, "\n" ) );
+    }
+
+    gchar* pid = g_strdup_printf( "%d", blocker->pid );
+    if ( blocker->cgroup
+         && (0 == mkdir( FREEZE_CGROUP, 0755 ) || EEXIST == errno)
+         && write_sysfs( FREEZE_CGROUP "/cgroup.procs", pid )
+         && write_sysfs( FREEZE_CGROUP "/cgroup.freeze", "1" ) ) {
+        g_debug( "%s: %d frozen in " FREEZE_CGROUP, __func__, blocker->pid );
+    } else {
+        g_free( blocker->cgroup );
+        blocker->cgroup = NULL;
+        blocker->stopped = (0 == kill( blocker->pid, SIGSTOP ));
+    }
+
+    g_free( pid );
+    g_free( contents );
+    g_free( procPath );
+}
+
+/**
+ * @brief undo freeze(): put the process back where it came from
+ */
+static void
+thaw( Blocker* blocker )
+{
+    if ( blocker->cgroup ) {
+        gchar* procs = g_strdup_printf( "/sys/fs/cgroup%s/cgroup.procs", blocker->cgroup );
+        gchar* pid = g_strdup_printf( "%d", blocker->pid );
+        if ( !write_sysfs( procs, pid ) )
+            g_warning( "%s: couldn't move %d back to %s", __func__, blocker->pid, blocker->cgroup );
+        g_free( pid );
+        g_free( procs );
+        g_free( blocker->cgroup );
+        blocker->cgroup = NULL;
+    }
+    if ( blocker->stopped ) {
+        (void) kill( blocker->pid, SIGCONT );
+        blocker->stopped = false;
+    }
+}
+
+static void
+take_step( gpointer key, gpointer value, gpointer data )
+{
+    Blocker* blocker = value;
+    EvictAction action = *(EvictAction*)data;
+
+    if ( !blocker->holding )
+        return;
+    if ( blocker->allowed )
+        action = EVICT_NOTIFY;
+
+    switch ( action ) {
+    case EVICT_NOTIFY:
+        g_warning( "MSM: %s (pid %d) is holding %s%s", blocker->name, blocker->pid,
+                   (const char*)g_ptr_array_index( blocker->files, 0 ),
+                   blocker->files->len > 1 ? " and more" : "" );
+        break;
+    case EVICT_FREEZE:
+        if ( !blocker->cgroup && !blocker->stopped )
+            freeze( blocker );
+        break;
+    case EVICT_TERMINATE:
+        /* a frozen process can't act on SIGTERM */
+        (void) kill( blocker->pid, SIGTERM );
+        thaw( blocker );
+        break;
+    case EVICT_KILL:
+        (void) kill( blocker->pid, SIGKILL );
+        thaw( blocker );
+        break;
+    default:
+        return;
+    }
+
+    g_message( "%s: %s %s (pid %d)", __func__, sActionDone[action], blocker->name, blocker->pid );
+    blocker->action = MAX( blocker->action, (int)action );
+    sTaken[action]++;
+}
+
+bool
+EvictNextStep( const char* mountpoint, guint* grace_ms )
+{
+    if ( sStep >= sPolicyLen )
+        return false;
+
+    if ( NULL == sBlockers )
+        sBlockers = g_hash_table_new_full( g_direct_hash, g_direct_equal, NULL, free_blocker );
+
+    gchar* prefix = g_strconcat( mountpoint, "/", NULL );
+    g_hash_table_foreach( sBlockers, forget_files, NULL );
+    scan_open_files( prefix, note_blocker, NULL );
+    g_free( prefix );
+
+    guint holding = 0;
+    GHashTableIter iter;
+    gpointer value;
+    g_hash_table_iter_init( &iter, sBlockers );
+    while ( g_hash_table_iter_next( &iter, NULL, &value ) ) {
+        if ( ((Blocker*)value)->holding )
+            holding++;
+    }
+    if ( 0 == holding ) {
+        g_warning( "%s: unmount failed, but no process holds files under %s", __func__, mountpoint );
+        return false;
+    }
+
+    EvictAction action = sPolicy[ sStep++ ];
+    g_hash_table_foreach( sBlockers, take_step, &action );
+
+    *grace_ms = sGraceMs;
+    return true;
+}
+
+/**
+ * @brief add a blocker to the report; json-c does the escaping, as process
+ * and file names may be anything
+ */
+static void
+append_blocker( gpointer key, gpointer value, gpointer data )
+{
+    struct json_object* report = data;
+    Blocker* blocker = value;
+    struct json_object* entry = json_object_new_object();
+    struct json_object* files = json_object_new_array();
+    guint i;
+
+    json_object_object_add( entry, "pid", json_object_new_int( blocker->pid ) );
+    json_object_object_add( entry, "name", json_object_new_string( blocker->name ) );
+    json_object_object_add( entry, "holding", json_object_new_boolean( blocker->holding ) );
+    json_object_object_add( entry, "allowed", json_object_new_boolean( blocker->allowed ) );
+    json_object_object_add( entry, "action", json_object_new_string(
+                                blocker->action >= 0 ? sActionDone[ blocker->action ] : "none" ) );
+    for ( i = 0; i < blocker->files->len; i++ )
+        json_object_array_add( files, json_object_new_string( g_ptr_array_index( blocker->files, i ) ) );
+    json_object_object_add( entry, "files", files );
+    json_object_array_add( report, entry );
+}
+
+gchar*
+EvictReport( void )
+{
+    if ( NULL == sBlockers || 0 == g_hash_table_size( sBlockers ) )
+        return NULL;
+
+    struct json_object* report = json_object_new_array();
+    g_hash_table_foreach( sBlockers, append_blocker, report );
+    gchar* out = g_strdup( json_object_to_json_string( report ) );
+    json_object_put( report );
+    return out;
+}
+
+static void
+thaw_blocker( gpointer key, gpointer value, gpointer data )
+{
+    thaw( value );
+}
+
+void
+EvictEnd( bool succeeded )
+{
+    if ( sStep > 0 ) {
+        if ( succeeded )
+            sRescued++;
+        else
+            sGaveUp++;
+    }
+    if ( sBlockers ) {
+        g_hash_table_foreach( sBlockers, thaw_blocker, NULL );
+        g_hash_table_remove_all( sBlockers );
+    }
+    sStep = 0;
+}
+
+void
+EvictAppendStats( GString* out )
+{
+    int i;
+
+    g_string_append( out, "\"evictions\":{\"policy\":[" );
+    for ( i = 0; i < sPolicyLen; i++ )
+        g_string_append_printf( out, "%s\"%s\"", i ? ", " : "", sActionNames[ sPolicy[i] ] );
+    g_string_append( out, "]" );
+    for ( i = 0; i < EVICT_NUM_ACTIONS; i++ )
+        g_string_append_printf( out, ", \"%s\":%" G_GUINT64_FORMAT, sActionDone[i], sTaken[i] );
+    g_string_append_printf( out, ", \"rescued\":%" G_GUINT64_FORMAT ", \"gaveUp\":%" G_GUINT64_FORMAT "}",
+                            sRescued, sGaveUp );
+}
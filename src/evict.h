@@ -0,0 +1,89 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_EVICT_H__
+#define __STORAGED_EVICT_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+/*
+ * What to do about processes that still have files open on the partition
+ * when the grace period for entering MSM is over.  Each time the unmount
+ * fails the next step of the policy is taken against every process holding
+ * files there, and the unmount is retried after a short grace period:
+ *
+ *   notify     log the process and the files it holds
+ *   freeze     stop it (cgroup v2 freezer, SIGSTOP without one) so it can't
+ *              open more files while the next step is decided
+ *   terminate  SIGTERM
+ *   kill       SIGKILL
+ *
+ * Processes on the allow list are only ever notified.  Frozen processes are
+ * thawed when the transition ends.  The policy comes from the [evict] group
+ * of STORAGED_CONF_PATH; without one it is just "notify".
+ */
+
+/** EvictLoadConfig
+ *
+ * Read the policy from the given key file, if it exists.
+ */
+void EvictLoadConfig( const char* path );
+
+/** EvictBegin
+ *
+ * Start a transition with the first step of the policy.
+ */
+void EvictBegin( void );
+
+/** EvictNextStep
+ *
+ * The unmount failed: take the next step of the policy against the
+ * processes holding files under mountpoint.
+ *
+ * @param grace_ms  set to how long to wait before retrying
+ *
+ * @return false if there's no step left, or nobody to take it against, so
+ *         that there is no point retrying
+ */
+bool EvictNextStep( const char* mountpoint, guint* grace_ms );
+
+/** EvictReport
+ *
+ * @return a json array describing every process found holding files during
+ *         the current transition and what was done about it, or NULL if
+ *         there were none.  Free with g_free.
+ */
+gchar* EvictReport( void );
+
+/** EvictEnd
+ *
+ * End the transition: thaw whatever is still frozen and forget the
+ * processes found.
+ *
+ * @param succeeded  whether MSM was entered
+ */
+void EvictEnd( bool succeeded );
+
+/** EvictAppendStats
+ *
+ * Append the "evictions" member to a json object under construction.
+ */
+void EvictAppendStats( GString* out );
+
+#endif
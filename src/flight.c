@@ -0,0 +1,115 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <signal.h>
+#include <glib.h>
+#include <glib-unix.h>
+#include <cjson/json.h>
+
+#include "flight.h"
+
+static FlightRecord sRecords[ FLIGHT_RECORDS ];
+static guint64 sNext = 0;   /* total records ever claimed */
+
+FlightRecord*
+FlightNext( const char* event, int nargs )
+{
+    FlightRecord* record = &sRecords[ sNext++ % FLIGHT_RECORDS ];
+    record->time = g_get_monotonic_time();
+    record->event = event;
+    record->nargs = nargs;
+    record->strings = 0;
+    return record;
+}
+
+static guint64
+oldest( void )
+{
+    return sNext > FLIGHT_RECORDS ? sNext - FLIGHT_RECORDS : 0;
+}
+
+void
+FlightDump( const char* reason )
+{
+    GString* out = g_string_new( "" );
+    GError* error = NULL;
+    gint64 now = g_get_monotonic_time();
+    guint64 n;
+    int i;
+
+    g_string_append_printf( out, "# %s; times are seconds before the dump\n", reason );
+    for ( n = oldest(); n < sNext; n++ ) {
+        const FlightRecord* record = &sRecords[ n % FLIGHT_RECORDS ];
+        g_string_append_printf( out, "-%.6f %s", (now - record->time) / 1e6, record->event );
+        for ( i = 0; i < record->nargs; i++ ) {
+            if ( record->strings & (1 << i) )
+                g_string_append_printf( out, " %s", record->args[i].s );
+            else
+                g_string_append_printf( out, " %" G_GINT64_FORMAT, record->args[i].i );
+        }
+        g_string_append_c( out, '\n' );
+    }
+
+    if ( g_file_set_contents( FLIGHT_FILE_PATH, out->str, out->len, &error ) ) {
+        g_message( "%s: flight recorder written to %s", reason, FLIGHT_FILE_PATH );
+    } else {
+        g_warning( "%s: writing %s: %s", __func__, FLIGHT_FILE_PATH, error->message );
+        g_error_free( error );
+    }
+    g_string_free( out, TRUE );
+}
+
+void
+FlightAppendRecords( GString* out )
+{
+    guint64 n;
+    int i;
+
+    g_string_append( out, "\"records\":[" );
+    for ( n = oldest(); n < sNext; n++ ) {
+        const FlightRecord* record = &sRecords[ n % FLIGHT_RECORDS ];
+        gchar* sep = (n == oldest()) ? "" : ", ";
+        g_string_append_printf( out, "%s{\"time\":%" G_GINT64_FORMAT ", \"event\":\"%s\", \"args\":[",
+                                sep, record->time, record->event );
+        for ( i = 0; i < record->nargs; i++ ) {
+            if ( record->strings & (1 << i) ) {
+                /* json-c's escaping: g_strescape's octal isn't json */
+                struct json_object* string = json_object_new_string( record->args[i].s );
+                g_string_append_printf( out, "%s%s", i ? ", " : "", json_object_to_json_string( string ) );
+                json_object_put( string );
+            } else {
+                g_string_append_printf( out, "%s%" G_GINT64_FORMAT, i ? ", " : "", record->args[i].i );
+            }
+        }
+        g_string_append( out, "]}" );
+    }
+    g_string_append( out, "]" );
+}
+
+static gboolean
+dump_on_signal( gpointer data )
+{
+    FlightDump( "SIGUSR1" );
+    return TRUE;
+}
+
+void
+FlightInit( void )
+{
+    g_unix_signal_add( SIGUSR1, dump_on_signal, NULL );
+}
@@ -0,0 +1,114 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_FLIGHT_H__
+#define __STORAGED_FLIGHT_H__
+
+#include <glib.h>
+
+/*
+ * Flight recorder: the last FLIGHT_RECORDS tracepoints (see trace.h), with
+ * their arguments and a timestamp, kept in memory whatever the log level.
+ * Recording is a clock read and a few stores into a fixed ring; it's only
+ * done from the main loop thread.  The ring is written out to
+ * FLIGHT_FILE_PATH when a transition fails or the partition gets
+ * reformatted, on SIGUSR1, and on request over the bus.
+ */
+
+#define FLIGHT_RECORDS 1024
+#define FLIGHT_MAX_ARGS 3
+#define FLIGHT_STRING_MAX 16    /* string arguments are truncated to this */
+
+#define FLIGHT_FILE_PATH "/tmp/run/storaged.flight"
+
+typedef struct
+{
+    gint64 time;                /* monotonic, microseconds */
+    const char* event;          /* tracepoint name */
+    guint8 nargs;
+    guint8 strings;             /* bit i set: args[i] is a string */
+    union {
+        gint64 i;
+        char s[ FLIGHT_STRING_MAX ];
+    } args[ FLIGHT_MAX_ARGS ];
+}
+FlightRecord;
+
+/** FlightInit
+ *
+ * Dump the flight recorder on SIGUSR1.
+ */
+void FlightInit( void );
+
+/** FlightNext
+ *
+ * Claim the next record (overwriting the oldest) and stamp it; use the
+ * FLIGHT_RECORDn macros rather than this.
+ */
+FlightRecord* FlightNext( const char* event, int nargs );
+
+/** FlightDump
+ *
+ * Write the recorded events, oldest first, to FLIGHT_FILE_PATH.
+ *
+ * @param reason logged along with the dump
+ */
+void FlightDump( const char* reason );
+
+/** FlightAppendRecords
+ *
+ * Append a "records" member with the recorded events, oldest first, to the
+ * json object being built in out.
+ */
+void FlightAppendRecords( GString* out );
+
+static inline void
+flight_set_int( FlightRecord* record, int i, gint64 value )
+{
+    record->args[i].i = value;
+}
+
+static inline void
+flight_set_str( FlightRecord* record, int i, const char* value )
+{
+    const gchar* valid;
+
+    record->strings |= 1 << i;
+    if ( g_strlcpy( record->args[i].s, value ? value : "", FLIGHT_STRING_MAX ) >= FLIGHT_STRING_MAX
+         && !g_utf8_validate( record->args[i].s, -1, &valid ) ) {
+        /* cut before a UTF-8 sequence the copy split */
+        record->args[i].s[ valid - record->args[i].s ] = '\0';
+    }
+}
+
+#define FLIGHT_ARG(record, i, a) \
+    _Generic((a), char*: flight_set_str, const char*: flight_set_str, \
+                  default: flight_set_int)(record, i, a)
+
+#define FLIGHT_RECORD0(name) \
+    (void) FlightNext( #name, 0 )
+#define FLIGHT_RECORD1(name, a) \
+    do { FlightRecord* r_ = FlightNext( #name, 1 ); FLIGHT_ARG(r_, 0, a); } while (0)
+#define FLIGHT_RECORD2(name, a, b) \
+    do { FlightRecord* r_ = FlightNext( #name, 2 ); FLIGHT_ARG(r_, 0, a); \
+         FLIGHT_ARG(r_, 1, b); } while (0)
+#define FLIGHT_RECORD3(name, a, b, c) \
+    do { FlightRecord* r_ = FlightNext( #name, 3 ); FLIGHT_ARG(r_, 0, a); \
+         FLIGHT_ARG(r_, 1, b); FLIGHT_ARG(r_, 2, c); } while (0)
+
+#endif
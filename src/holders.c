@@ -0,0 +1,161 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glib.h>
+
+#include "holders.h"
+
+typedef struct
+{
+    gint64 releaseUs;           /* this round; -1 until released */
+    guint64 released;           /* rounds released in time */
+    guint64 late;               /* rounds that ended first */
+    gint64 totalUs;
+    gint64 maxUs;
+}
+Holder;
+
+static GHashTable* sHolders = NULL;     /* name -> Holder */
+static gint64 sRoundStart = 0;          /* 0: no round in progress */
+static guint sPending = 0;              /* holders the round is waiting for */
+
+static const char*
+holder_name( LSMessage* message )
+{
+    const char* name = LSMessageGetSenderServiceName( message );
+    if ( NULL == name )
+        name = LSMessageGetSender( message );
+    return name ? name : "";
+}
+
+bool
+HoldersRegister( LSMessage* message )
+{
+    const char* name = holder_name( message );
+
+    if ( NULL == sHolders )
+        sHolders = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+    if ( g_hash_table_lookup( sHolders, name ) )
+        return false;
+
+    Holder* holder = g_new0( Holder, 1 );
+    /* a holder that joins mid-round isn't waited for */
+    holder->releaseUs = sRoundStart ? 0 : -1;
+    g_hash_table_insert( sHolders, g_strdup( name ), holder );
+    g_debug( "%s: %s", __func__, name );
+    return true;
+}
+
+bool
+HoldersUnregister( LSMessage* message, bool* allReleased )
+{
+    const char* name = holder_name( message );
+    Holder* holder = sHolders ? g_hash_table_lookup( sHolders, name ) : NULL;
+
+    *allReleased = false;
+    if ( NULL == holder )
+        return false;
+
+    /* the round no longer waits for a holder that's gone */
+    if ( sRoundStart && holder->releaseUs < 0 )
+        *allReleased = 0 == --sPending;
+    g_hash_table_remove( sHolders, name );
+    g_debug( "%s: %s", __func__, name );
+    return true;
+}
+
+static void
+reset_holder( gpointer key, gpointer value, gpointer data )
+{
+    ((Holder*)value)->releaseUs = -1;
+}
+
+guint
+HoldersBeginRelease( void )
+{
+    sRoundStart = g_get_monotonic_time();
+    sPending = sHolders ? g_hash_table_size( sHolders ) : 0;
+    if ( sHolders )
+        g_hash_table_foreach( sHolders, reset_holder, NULL );
+    return sPending;
+}
+
+bool
+HoldersReleased( LSMessage* message )
+{
+    const char* name = holder_name( message );
+    Holder* holder = sHolders ? g_hash_table_lookup( sHolders, name ) : NULL;
+
+    if ( NULL == holder || 0 == sRoundStart || holder->releaseUs >= 0 )
+        return false;
+
+    holder->releaseUs = g_get_monotonic_time() - sRoundStart;
+    holder->released++;
+    holder->totalUs += holder->releaseUs;
+    holder->maxUs = MAX( holder->maxUs, holder->releaseUs );
+    g_debug( "%s: %s after %" G_GINT64_FORMAT " us, %u to go", __func__,
+             name, holder->releaseUs, sPending - 1 );
+
+    return 0 == --sPending;
+}
+
+static void
+count_late( gpointer key, gpointer value, gpointer data )
+{
+    Holder* holder = value;
+
+    if ( holder->releaseUs < 0 ) {
+        holder->late++;
+        g_message( "%s: %s didn't release in time", __func__, (const char*)key );
+    }
+}
+
+void
+HoldersEndRelease( void )
+{
+    if ( 0 == sRoundStart )
+        return;
+    if ( sHolders )
+        g_hash_table_foreach( sHolders, count_late, NULL );
+    sRoundStart = 0;
+    sPending = 0;
+}
+
+static void
+append_holder( gpointer key, gpointer value, gpointer data )
+{
+    GString* out = data;
+    Holder* holder = value;
+    const char* sep = (out->str[ out->len - 1 ] == '[') ? "" : ", ";
+
+    g_string_append_printf( out, "%s{\"name\":\"%s\", \"released\":%" G_GUINT64_FORMAT
+                            ", \"late\":%" G_GUINT64_FORMAT ", \"avgMs\":%" G_GINT64_FORMAT
+                            ", \"maxMs\":%" G_GINT64_FORMAT ", \"lastMs\":%" G_GINT64_FORMAT "}",
+                            sep, (const char*)key, holder->released, holder->late,
+                            holder->released ? holder->totalUs / (gint64)holder->released / 1000 : 0,
+                            holder->maxUs / 1000, holder->releaseUs >= 0 ? holder->releaseUs / 1000 : -1 );
+}
+
+void
+HoldersAppendStats( GString* out )
+{
+    g_string_append( out, "\"holders\":[" );
+    if ( sHolders )
+        g_hash_table_foreach( sHolders, append_holder, out );
+    g_string_append( out, "]" );
+}
@@ -0,0 +1,79 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_HOLDERS_H__
+#define __STORAGED_HOLDERS_H__
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+/*
+ * Services that keep files open on /media/internal can register as holders.
+ * When MSM is entered, each is expected to close its files on the
+ * MSMProgress "attempting" signal and then call diskmode/released; once
+ * every registered holder has done so storaged unmounts without waiting out
+ * the rest of the grace period.  Holders are identified by service name (or
+ * unique bus name when they have none).
+ */
+
+/** HoldersRegister, HoldersUnregister
+ *
+ * Add or remove the message's sender as a holder.
+ *
+ * @param allReleased  set if the current round was waiting for the holder
+ *                     removed, and for no other
+ *
+ * @return false if it already was (or wasn't) one
+ */
+bool HoldersRegister( LSMessage* message );
+bool HoldersUnregister( LSMessage* message, bool* allReleased );
+
+/** HoldersBeginRelease
+ *
+ * Start a release round: every registered holder is now expected to call
+ * released.
+ *
+ * @return the number of registered holders
+ */
+guint HoldersBeginRelease( void );
+
+/** HoldersReleased
+ *
+ * Note that the message's sender has released its files.
+ *
+ * @return true if that was the last registered holder the current round
+ *         was waiting for
+ */
+bool HoldersReleased( LSMessage* message );
+
+/** HoldersEndRelease
+ *
+ * End the current release round; holders that haven't released by now are
+ * counted as late.
+ */
+void HoldersEndRelease( void );
+
+/** HoldersAppendStats
+ *
+ * Append the "holders" member, with each holder's release count and
+ * latency, to a json object under construction.
+ */
+void HoldersAppendStats( GString* out );
+
+#endif
@@ -0,0 +1,500 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#define _GNU_SOURCE         /* RUSAGE_THREAD */
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <glib.h>
+
+#include "jobs.h"
+#include "qos.h"
+#include "util.h"
+
+#define CGROUP_ROOT         "/sys/fs/cgroup"
+#define JOBS_HOME_LEAF      "main"      /* where storaged lives between jobs */
+#define JOBS_PROFILE_PREFIX "job "
+#define PRIORITY_GROUP      "priority"
+
+/* from linux/ioprio.h */
+#define IOPRIO_CLASS_BE     2
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+
+typedef struct
+{
+    gint ioWeight;              /* 1..10000, 100 is the kernel's default */
+    gint cpuWeight;
+}
+JobWeights;
+
+typedef struct
+{
+    guint64 count;
+    gint64 wallUs;
+    gint64 cpuUs;
+    gint64 readBytes;
+    gint64 writeBytes;
+}
+JobUsage;
+
+typedef struct
+{
+    gchar* path;
+    gchar* value;
+}
+SavedWeight;
+
+static const char* sJobNames[ JOB_NUM_CLASSES ] = {
+    "unmount", "remount", "fsck", "erase", "scripts", "restore",
+};
+
+/* what the user waits on gets the disk first; the rest stays out of the UI's way */
+static JobWeights sWeights[ JOB_NUM_CLASSES ] = {
+    { 200, 100 },   /* unmount */
+    { 200, 100 },   /* remount */
+    { 200, 100 },   /* fsck */
+    { 100,  50 },   /* erase */
+    {  50,  50 },   /* scripts */
+    { 200, 100 },   /* restore */
+};
+
+static gchar** sBackground = NULL;      /* cgroups, relative to CGROUP_ROOT */
+static gint sBackgroundWeight = 10;
+
+static bool sUseCgroups = false;        /* v2 with io and cpu delegated to us */
+static gchar* sJobsCgroup = NULL;       /* storaged's own (delegated) cgroup */
+static gchar* sHomeCgroup = NULL;       /* cgroup.procs of its JOBS_HOME_LEAF */
+
+static int sDepth = 0;
+static JobClass sCurrent;
+static gint64 sStartUs;
+static JobUsage sStartUsage;            /* counters at JobBegin */
+static int sSavedNice;
+static int sSavedIoprio;
+static GPtrArray* sSavedWeights = NULL; /* of background cgroups */
+
+static JobUsage sUsage[ JOB_NUM_CLASSES ];
+static bool sQosHeld;                   /* for the current job */
+static guint64 sQosCount[ JOB_NUM_CLASSES ];    /* jobs that ran under QoS... */
+static gint64 sQosWallUs[ JOB_NUM_CLASSES ];    /* ...and how long they took */
+static guint64 sDeprioritized = 0;
+
+static gint
+get_weight( GKeyFile* keyFile, const char* group, const char* key, gint current )
+{
+    GError* error = NULL;
+    gint value = g_key_file_get_integer( keyFile, group, key, &error );
+
+    if ( error ) {
+        g_error_free( error );
+        return current;
+    }
+    return CLAMP( value, 1, 10000 );
+}
+
+static void
+load_config( const char* path )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    int job;
+
+    if ( !g_key_file_load_from_file( keyFile, path, G_KEY_FILE_NONE, NULL ) ) {
+        g_key_file_free( keyFile );
+        return;
+    }
+
+    for ( job = 0; job < JOB_NUM_CLASSES; job++ ) {
+        gchar* group = g_strconcat( JOBS_PROFILE_PREFIX, sJobNames[job], NULL );
+        sWeights[job].ioWeight = get_weight( keyFile, group, "io_weight", sWeights[job].ioWeight );
+        sWeights[job].cpuWeight = get_weight( keyFile, group, "cpu_weight", sWeights[job].cpuWeight );
+        g_free( group );
+    }
+
+    sBackground = g_key_file_get_string_list( keyFile, PRIORITY_GROUP, "background", NULL, NULL );
+    sBackgroundWeight = get_weight( keyFile, PRIORITY_GROUP, "background_weight", sBackgroundWeight );
+
+    g_key_file_free( keyFile );
+}
+
+static gchar*
+job_cgroup( JobClass job, const char* file )
+{
+    return g_strdup_printf( "%s/%s/%s", sJobsCgroup, sJobNames[job], file );
+}
+
+/**
+ * @brief create a cgroup per job class, with io and cpu weights, under the
+ * cgroup storaged was started in; false if that isn't ours to manage or the
+ * v2 controllers aren't there for us to use
+ */
+static bool
+setup_cgroups( void )
+{
+    gchar* self = read_sysfs( "/proc/self/cgroup" );
+    gchar* path;
+    gchar* pid;
+    bool ok;
+    int job;
+
+    /* only the unified hierarchy has a "0::" line; never take over the root */
+    if ( NULL == self || !g_str_has_prefix( self, "0::" ) || strchr( self, '\n' )
+         || !strcmp( self + 3, "/" ) ) {
+        g_free( self );
+        return false;
+    }
+    /* an instance started from our own leaf (e.g. by a hook script) */
+    if ( g_str_has_suffix( self, "/" JOBS_HOME_LEAF ) )
+        self[ strlen( self ) - strlen( "/" JOBS_HOME_LEAF ) ] = '\0';
+    sJobsCgroup = g_strconcat( CGROUP_ROOT, self + 3, NULL );
+    g_free( self );
+
+    /* a cgroup with controllers enabled for its children can't have
+       processes of its own: move into a leaf first */
+    path = g_strconcat( sJobsCgroup, "/" JOBS_HOME_LEAF, NULL );
+    sHomeCgroup = g_strconcat( path, "/cgroup.procs", NULL );
+    pid = g_strdup_printf( "%d", getpid() );
+    ok = (0 == mkdir( path, 0755 ) || EEXIST == errno) && write_sysfs( sHomeCgroup, pid );
+    g_free( pid );
+    g_free( path );
+    if ( !ok )
+        return false;     /* not delegated to us */
+
+    path = g_strconcat( sJobsCgroup, "/cgroup.subtree_control", NULL );
+    ok = write_sysfs( path, "+io +cpu" );
+    g_free( path );
+    if ( !ok )
+        return false;
+
+    for ( job = 0; job < JOB_NUM_CLASSES; job++ ) {
+        gchar* dir = g_strdup_printf( "%s/%s", sJobsCgroup, sJobNames[job] );
+        gchar* io = job_cgroup( job, "io.weight" );
+        gchar* cpu = job_cgroup( job, "cpu.weight" );
+        gchar* ioWeight = g_strdup_printf( "default %d", sWeights[job].ioWeight );
+        gchar* cpuWeight = g_strdup_printf( "%d", sWeights[job].cpuWeight );
+        bool ok = (0 == mkdir( dir, 0755 ) || EEXIST == errno)
+                  && write_sysfs( io, ioWeight ) && write_sysfs( cpu, cpuWeight );
+
+        g_free( cpuWeight );
+        g_free( ioWeight );
+        g_free( cpu );
+        g_free( io );
+        g_free( dir );
+        if ( !ok )
+            return false;
+    }
+    return true;
+}
+
+void
+JobsInit( const char* confPath )
+{
+    load_config( confPath );
+    sUseCgroups = setup_cgroups();
+    g_debug( "%s: jobs run %s %s", __func__, sUseCgroups ? "in" : "with ioprio and nice",
+             sUseCgroups ? sJobsCgroup : "" );
+}
+
+/**
+ * @brief the usage so far of the job's cgroup, or of this process and its
+ * reaped children without one
+ */
+static void
+read_usage( JobClass job, JobUsage* usage )
+{
+    memset( usage, 0, sizeof(*usage) );
+
+    if ( sUseCgroups ) {
+        gchar* path = job_cgroup( job, "cpu.stat" );
+        gchar* stat = read_sysfs( path );
+        const char* field;
+
+        if ( stat && NULL != (field = strstr( stat, "usage_usec " )) )
+            usage->cpuUs = g_ascii_strtoll( field + strlen( "usage_usec " ), NULL, 10 );
+        g_free( stat );
+        g_free( path );
+
+        /* one line per device: "8:0 rbytes=1 wbytes=2 ..." */
+        path = job_cgroup( job, "io.stat" );
+        stat = read_sysfs( path );
+        for ( field = stat; field && NULL != (field = strstr( field, "bytes=" )); field += strlen( "bytes=" ) ) {
+            gint64 bytes = g_ascii_strtoll( field + strlen( "bytes=" ), NULL, 10 );
+            if ( field > stat && field[-1] == 'r' )
+                usage->readBytes += bytes;
+            else if ( field > stat && field[-1] == 'w' )
+                usage->writeBytes += bytes;
+        }
+        g_free( stat );
+        g_free( path );
+    } else {
+        struct rusage self, children;
+        getrusage( RUSAGE_SELF, &self );
+        getrusage( RUSAGE_CHILDREN, &children );
+        usage->cpuUs = (gint64)(self.ru_utime.tv_sec + self.ru_stime.tv_sec
+                                + children.ru_utime.tv_sec + children.ru_stime.tv_sec) * G_USEC_PER_SEC
+                       + self.ru_utime.tv_usec + self.ru_stime.tv_usec
+                       + children.ru_utime.tv_usec + children.ru_stime.tv_usec;
+        /* in 512-byte blocks */
+        usage->readBytes = (gint64)(self.ru_inblock + children.ru_inblock) * 512;
+        usage->writeBytes = (gint64)(self.ru_oublock + children.ru_oublock) * 512;
+    }
+}
+
+/**
+ * @brief give a background cgroup a new weight, v2 or v1, saving the old one
+ */
+static void
+lower_weight( const char* path, const char* value )
+{
+    gchar* current = read_sysfs( path );
+
+    if ( NULL == current )
+        return;
+    if ( !write_sysfs( path, value ) ) {
+        g_free( current );
+        return;
+    }
+
+    SavedWeight* saved = g_new( SavedWeight, 1 );
+    saved->path = g_strdup( path );
+    saved->value = current;
+    g_ptr_array_add( sSavedWeights, saved );
+}
+
+static void
+deprioritize_background( void )
+{
+    gchar** group;
+
+    sSavedWeights = g_ptr_array_new();
+    for ( group = sBackground; group && *group; group++ ) {
+        gchar* io = g_strdup_printf( CGROUP_ROOT "/%s/io.weight", *group );
+        gchar* path;
+        gchar* value;
+
+        if ( g_file_test( io, G_FILE_TEST_EXISTS ) ) {
+            value = g_strdup_printf( "default %d", sBackgroundWeight );
+            lower_weight( io, value );
+            g_free( value );
+
+            path = g_strdup_printf( CGROUP_ROOT "/%s/cpu.weight", *group );
+            value = g_strdup_printf( "%d", sBackgroundWeight );
+            lower_weight( path, value );
+            g_free( value );
+            g_free( path );
+        } else {
+            /* v1: blkio.weight is 10..1000, cpu.shares 1024 by default */
+            path = g_strdup_printf( CGROUP_ROOT "/blkio/%s/blkio.weight", *group );
+            value = g_strdup_printf( "%d", CLAMP( sBackgroundWeight * 5, 10, 1000 ) );
+            lower_weight( path, value );
+            g_free( value );
+            g_free( path );
+
+            path = g_strdup_printf( CGROUP_ROOT "/cpu/%s/cpu.shares", *group );
+            value = g_strdup_printf( "%d", MAX( sBackgroundWeight * 1024 / 100, 2 ) );
+            lower_weight( path, value );
+            g_free( value );
+            g_free( path );
+        }
+        g_free( io );
+    }
+    if ( sSavedWeights->len > 0 )
+        sDeprioritized++;
+}
+
+static void
+restore_background( void )
+{
+    guint i;
+
+    for ( i = 0; sSavedWeights && i < sSavedWeights->len; i++ ) {
+        SavedWeight* saved = g_ptr_array_index( sSavedWeights, i );
+        /* io.weight reads back as "default N" and takes that too */
+        if ( !write_sysfs( saved->path, saved->value ) )
+            g_warning( "%s: couldn't restore %s to %s", __func__, saved->path, saved->value );
+        g_free( saved->path );
+        g_free( saved->value );
+        g_free( saved );
+    }
+    if ( sSavedWeights )
+        g_ptr_array_free( sSavedWeights, TRUE );
+    sSavedWeights = NULL;
+}
+
+/**
+ * @brief a weight's equivalent best-effort I/O priority level and nice value
+ */
+static int
+weight_to_ioprio( gint weight )
+{
+    int level = weight >= 200 ? 2 : weight >= 100 ? 4 : 6;
+    return (IOPRIO_CLASS_BE << IOPRIO_CLASS_SHIFT) | level;
+}
+
+static int
+weight_to_nice( gint weight )
+{
+    return weight >= 200 ? -5 : weight >= 100 ? 0 : 10;
+}
+
+void
+JobBegin( JobClass job )
+{
+    if ( sDepth++ > 0 )
+        return;
+
+    sCurrent = job;
+    sQosHeld = QosHold( job );
+    sStartUs = g_get_monotonic_time();
+
+    if ( JOB_UNMOUNT == job || JOB_REMOUNT == job || JOB_FSCK == job )
+        deprioritize_background();
+
+    if ( sUseCgroups ) {
+        gchar* procs = job_cgroup( job, "cgroup.procs" );
+        gchar* pid = g_strdup_printf( "%d", getpid() );
+        if ( !write_sysfs( procs, pid ) )
+            g_warning( "%s: couldn't move into %s", __func__, procs );
+        g_free( pid );
+        g_free( procs );
+    } else {
+        sSavedIoprio = syscall( SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0 );
+        sSavedNice = getpriority( PRIO_PROCESS, 0 );
+        (void) syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, weight_to_ioprio( sWeights[job].ioWeight ) );
+        (void) setpriority( PRIO_PROCESS, 0, weight_to_nice( sWeights[job].cpuWeight ) );
+    }
+
+    read_usage( job, &sStartUsage );
+}
+
+void
+JobEnd( JobClass job )
+{
+    JobUsage end;
+
+    if ( sDepth <= 0 || --sDepth > 0 )
+        return;
+
+    read_usage( sCurrent, &end );
+
+    if ( sUseCgroups ) {
+        if ( !write_sysfs( sHomeCgroup, "0" ) )
+            g_warning( "%s: couldn't move back to %s", __func__, sHomeCgroup );
+    } else {
+        if ( sSavedIoprio >= 0 )
+            (void) syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, sSavedIoprio );
+        (void) setpriority( PRIO_PROCESS, 0, sSavedNice );
+    }
+    restore_background();
+    QosRelease();
+
+    gint64 wallUs = g_get_monotonic_time() - sStartUs;
+    JobUsage* usage = &sUsage[ sCurrent ];
+    usage->count++;
+    usage->wallUs += wallUs;
+    usage->cpuUs += end.cpuUs - sStartUsage.cpuUs;
+    usage->readBytes += end.readBytes - sStartUsage.readBytes;
+    usage->writeBytes += end.writeBytes - sStartUsage.writeBytes;
+    if ( sQosHeld ) {
+        sQosCount[ sCurrent ]++;
+        sQosWallUs[ sCurrent ] += wallUs;
+    }
+}
+
+static void
+read_thread_usage( JobThread* thread )
+{
+    struct rusage self;
+
+    getrusage( RUSAGE_THREAD, &self );
+    thread->cpuUs = (gint64)(self.ru_utime.tv_sec + self.ru_stime.tv_sec) * G_USEC_PER_SEC
+                    + self.ru_utime.tv_usec + self.ru_stime.tv_usec;
+    thread->readBytes = (gint64)self.ru_inblock * 512;
+    thread->writeBytes = (gint64)self.ru_oublock * 512;
+}
+
+void
+JobThreadBegin( JobThread* thread, JobClass job )
+{
+    thread->job = job;
+    thread->wallUs = g_get_monotonic_time();
+    read_thread_usage( thread );
+
+    /* the calling thread's alone, whichever cgroup the process is in */
+    thread->savedIoprio = syscall( SYS_ioprio_get, IOPRIO_WHO_PROCESS, 0 );
+    thread->savedNice = getpriority( PRIO_PROCESS, 0 );
+    (void) syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, weight_to_ioprio( sWeights[job].ioWeight ) );
+    (void) setpriority( PRIO_PROCESS, 0, weight_to_nice( sWeights[job].cpuWeight ) );
+}
+
+void
+JobThreadEnd( JobThread* thread )
+{
+    JobThread start = *thread;
+
+    read_thread_usage( thread );
+    thread->wallUs = g_get_monotonic_time() - start.wallUs;
+    thread->cpuUs -= start.cpuUs;
+    thread->readBytes -= start.readBytes;
+    thread->writeBytes -= start.writeBytes;
+
+    if ( thread->savedIoprio >= 0 )
+        (void) syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, thread->savedIoprio );
+    (void) setpriority( PRIO_PROCESS, 0, thread->savedNice );
+}
+
+void
+JobThreadAccount( const JobThread* thread )
+{
+    JobUsage* usage = &sUsage[ thread->job ];
+
+    usage->count++;
+    usage->wallUs += thread->wallUs;
+    usage->cpuUs += thread->cpuUs;
+    usage->readBytes += thread->readBytes;
+    usage->writeBytes += thread->writeBytes;
+}
+
+void
+JobsAppendStats( GString* out )
+{
+    int job;
+
+    g_string_append_printf( out, "\"jobs\":{\"mode\":\"%s\", \"deprioritized\":%" G_GUINT64_FORMAT,
+                            sUseCgroups ? "cgroup2" : "ioprio", sDeprioritized );
+    for ( job = 0; job < JOB_NUM_CLASSES; job++ ) {
+        const JobUsage* usage = &sUsage[job];
+        g_string_append_printf( out, ", \"%s\":{\"count\":%" G_GUINT64_FORMAT
+                                ", \"ioWeight\":%d, \"cpuWeight\":%d, \"wallMs\":%" G_GINT64_FORMAT
+                                ", \"cpuMs\":%" G_GINT64_FORMAT ", \"readKb\":%" G_GINT64_FORMAT
+                                ", \"writeKb\":%" G_GINT64_FORMAT
+                                ", \"qosCount\":%" G_GUINT64_FORMAT ", \"qosWallMs\":%" G_GINT64_FORMAT "}",
+                                sJobNames[job], usage->count,
+                                sWeights[job].ioWeight, sWeights[job].cpuWeight,
+                                usage->wallUs / 1000, usage->cpuUs / 1000,
+                                usage->readBytes / 1024, usage->writeBytes / 1024,
+                                sQosCount[job], sQosWallUs[job] / 1000 );
+    }
+    g_string_append( out, "}" );
+}
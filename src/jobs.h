@@ -0,0 +1,109 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_JOBS_H__
+#define __STORAGED_JOBS_H__
+
+#include <glib.h>
+
+/*
+ * Resource arbitration for storaged's heavy work.  Each job runs with
+ * storaged (and so whatever it spawns) moved into its own cgroup under the
+ * one storaged was started in, which the init system has to delegate to it
+ * (systemd's Delegate=io cpu); between jobs storaged lives in a "main" leaf
+ * there.  Each job's cgroup has the io.weight and cpu.weight configured for
+ * it.  While
+ * the partition is being unmounted or remounted (the windows the user is
+ * waiting on), the background cgroups listed in the config are given a low
+ * weight.  Without cgroup v2 io and cpu controllers, jobs fall back to an
+ * I/O priority and nice value derived from the same weights, and background
+ * cgroups fall back to v1's blkio.weight and cpu.shares.
+ *
+ * In storaged.conf:
+ *
+ *   [job fsck]
+ *   io_weight=200
+ *   cpu_weight=100
+ *
+ *   [priority]
+ *   background=system.slice/mediaindexer.service;system.slice/backup.service
+ *   background_weight=10
+ */
+
+typedef enum
+{
+    JOB_UNMOUNT,            /* unmount and export */
+    JOB_REMOUNT,            /* unexport and mount */
+    JOB_FSCK,               /* unexport, check (maybe reformat) and mount */
+    JOB_ERASE,
+    JOB_SCRIPTS,            /* pre and post MSM hook scripts */
+    JOB_RESTORE,            /* default content after a reformat */
+    JOB_NUM_CLASSES
+} JobClass;
+
+/** JobsInit
+ *
+ * Read the weights from the given key file, if it exists, and set up the
+ * job cgroups.
+ */
+void JobsInit( const char* confPath );
+
+/** JobBegin, JobEnd
+ *
+ * Bracket a job of the given class.  Jobs don't nest: an inner pair is
+ * accounted to the outer job.  Every job holds the CPU latency QoS request
+ * (see qos.h) while it runs.  Jobs on threads of their own use
+ * JobThreadBegin instead.
+ */
+void JobBegin( JobClass job );
+void JobEnd( JobClass job );
+
+typedef struct
+{
+    JobClass job;
+    gint64 wallUs;              /* from JobThreadBegin to JobThreadEnd */
+    gint64 cpuUs;               /* the thread's own, likewise */
+    gint64 readBytes;
+    gint64 writeBytes;
+    int savedNice;
+    int savedIoprio;
+}
+JobThread;
+
+/** JobThreadBegin, JobThreadEnd, JobThreadAccount
+ *
+ * For a job that runs on threads of its own while the main loop (and maybe
+ * other jobs) goes on.  Cgroups hold whole processes, so instead
+ * JobThreadBegin gives just the calling thread the I/O priority and nice
+ * value derived from the class's weights, and starts measuring its usage;
+ * JobThreadEnd puts them back and leaves the usage in thread.  Back on the
+ * main thread, JobThreadAccount adds it to the class's stats.  These jobs
+ * don't hold the QoS request.
+ */
+void JobThreadBegin( JobThread* thread, JobClass job );
+void JobThreadEnd( JobThread* thread );
+void JobThreadAccount( const JobThread* thread );
+
+/** JobsAppendStats
+ *
+ * Append the "jobs" member, with per-class resource usage, to a json object
+ * under construction.
+ */
+void JobsAppendStats( GString* out );
+
+#endif
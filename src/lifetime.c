@@ -0,0 +1,211 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <glib.h>
+
+#include "lifetime.h"
+#include "recorder.h"
+
+/*
+ * storaged is started on demand and exits once it has been idle for a
+ * while.  Exiting too soon after a request means paying for another start
+ * (nyx device open, bus registration, reconciliation) when the next one
+ * arrives; staying up costs the memory we sit on.  So the idle timeout
+ * follows the observed time between bursts of requests: if the next burst
+ * is expected within LIFETIME_MAX_MS we wait LIFETIME_GAP_FACTOR times the
+ * usual gap for it, otherwise we leave after LIFETIME_MIN_MS.  The usual
+ * gap is carried over from one instance to the next in the state snapshot.
+ *
+ * Nothing exits while the cable is in (disable_lifetime_timer) or while
+ * anything holds the process (LifetimeHold).
+ */
+#define LIFETIME_MIN_MS     10000
+#define LIFETIME_MAX_MS     120000
+#define LIFETIME_GAP_FACTOR 2
+#define LIFETIME_BURST_MS   1000    /* requests closer than this are one burst */
+
+static GMainLoop * sMainLoop = NULL;
+static guint sTimerEventSource = 0;
+static bool sArmed = false;         /* reset_lifetime_timer since the last disable */
+static guint sHolds = 0;
+static gint64 sLastActivity = 0;    /* monotonic us */
+static gint64 sIdleSince = 0;       /* last reset or release, monotonic us */
+static gint64 sGapMs = 0;           /* moving average of the gap between bursts */
+static guint sStarts = 1;
+static guint sExits = 0;
+static gint64 sColdStartCpuMs = -1;
+
+static void update_timer(void);
+
+static gint64
+idle_timeout_ms(void)
+{
+    if (sGapMs > 0 && sGapMs * LIFETIME_GAP_FACTOR <= LIFETIME_MAX_MS)
+        return MAX(LIFETIME_MIN_MS, sGapMs * LIFETIME_GAP_FACTOR);
+    return LIFETIME_MIN_MS;
+}
+
+static gint64
+deadline(void)
+{
+    return MAX(sLastActivity, sIdleSince) + idle_timeout_ms() * 1000;
+}
+
+static gboolean
+timeout_handler(gpointer data)
+{
+    sTimerEventSource = 0;
+
+    /* requests since the timer was set push the deadline back */
+    if (g_get_monotonic_time() < deadline()) {
+        update_timer();
+        return FALSE;
+    }
+
+    g_debug("%s: idle for %" G_GINT64_FORMAT " ms, exiting", __func__, idle_timeout_ms());
+    sExits++;
+    g_main_loop_quit(sMainLoop);
+    return FALSE;
+}
+
+/**
+ * @brief arm the idle timer for the current deadline, or remove it if we
+ * mustn't exit
+ */
+static void
+update_timer(void)
+{
+    if (!sArmed || sHolds > 0) {
+        if (sTimerEventSource != 0)
+            RecorderTimeoutRemove(sTimerEventSource);
+        sTimerEventSource = 0;
+        return;
+    }
+
+    if (sTimerEventSource == 0) {
+        gint64 remaining = deadline() - g_get_monotonic_time();
+        sTimerEventSource = RecorderTimeoutAdd(RECORDER_TIMER_LIFETIME, G_PRIORITY_DEFAULT,
+                                               remaining > 0 ? remaining / 1000 : 0,
+                                               timeout_handler, NULL);
+    }
+}
+
+void
+LifetimeInit(GMainLoop* loop)
+{
+    sMainLoop = loop;
+    sLastActivity = sIdleSince = g_get_monotonic_time();
+}
+
+void
+disable_lifetime_timer()
+{
+    g_debug("%s called", __func__);
+    sArmed = false;
+    update_timer();
+}
+
+void
+reset_lifetime_timer()
+{
+    g_debug("%s called", __func__);
+    sArmed = true;
+    sIdleSince = g_get_monotonic_time();
+    update_timer();
+}
+
+void
+LifetimeActivity(void)
+{
+    gint64 now = g_get_monotonic_time();
+    gint64 gapMs = (now - sLastActivity) / 1000;
+
+    if (gapMs >= LIFETIME_BURST_MS)
+        sGapMs = sGapMs ? (sGapMs * 3 + gapMs) / 4 : gapMs;
+    sLastActivity = now;
+    /* a pending timer notices the new deadline when it fires */
+}
+
+void
+LifetimeHold(void)
+{
+    sHolds++;
+    update_timer();
+}
+
+void
+LifetimeRelease(void)
+{
+    g_return_if_fail(sHolds > 0);
+    if (--sHolds == 0)
+        sIdleSince = g_get_monotonic_time();
+    update_timer();
+}
+
+void
+LifetimeStarted(void)
+{
+    struct rusage usage;
+
+    if (sColdStartCpuMs >= 0 || getrusage(RUSAGE_SELF, &usage) != 0)
+        return;
+    sColdStartCpuMs = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 +
+                      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+void
+LifetimeGetState(StoragedState* state)
+{
+    state->lifetimeStarts = sStarts;
+    state->lifetimeExits = sExits;
+    state->requestGapMs = sGapMs;
+    state->lastRequest = sLastActivity;
+}
+
+void
+LifetimeRestore(const StoragedState* state)
+{
+    sStarts = state->lifetimeStarts + 1;
+    sExits = state->lifetimeExits;
+    sGapMs = state->requestGapMs;
+    /* so that the request that got us started counts as a gap */
+    if (state->lastRequest > 0 && state->lastRequest < sLastActivity)
+        sLastActivity = state->lastRequest;
+}
+
+void
+LifetimeAppendStats(GString* out)
+{
+    long pages = 0;
+    FILE* statm = fopen("/proc/self/statm", "r");
+
+    if (statm) {
+        if (fscanf(statm, "%*s %ld", &pages) != 1)
+            pages = 0;
+        fclose(statm);
+    }
+
+    g_string_append_printf(out, "\"lifetime\":{\"starts\":%u, \"exits\":%u, \"holds\":%u"
+                           ", \"idleTimeoutMs\":%" G_GINT64_FORMAT ", \"requestGapMs\":%" G_GINT64_FORMAT
+                           ", \"coldStartCpuMs\":%" G_GINT64_FORMAT ", \"rssKb\":%ld}",
+                           sStarts, sExits, sHolds, idle_timeout_ms(), sGapMs,
+                           sColdStartCpuMs, pages * (sysconf(_SC_PAGESIZE) / 1024));
+}
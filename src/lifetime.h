@@ -0,0 +1,75 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_LIFETIME_H__
+#define __STORAGED_LIFETIME_H__
+
+#include <glib.h>
+
+#include "state.h"
+
+/** LifetimeInit
+ *
+ * storaged is started on demand and quits its main loop once it has been
+ * idle for a while (see lifetime.c for how long); this is the loop it quits.
+ */
+void LifetimeInit( GMainLoop* loop );
+
+/* Don't exit, e.g. while the cable is in */
+void disable_lifetime_timer();
+
+/* May exit once idle again */
+void reset_lifetime_timer();
+
+/** LifetimeActivity
+ *
+ * A request arrived: push the idle deadline back and learn how far apart
+ * requests come.  Called on entry to every method handler (see
+ * LSTRACE_LSMESSAGE), and by rate limited ones only for requests they let
+ * through.
+ */
+void LifetimeActivity( void );
+
+/** LifetimeHold, LifetimeRelease
+ *
+ * Keep the process alive while work is in flight; holds nest.
+ */
+void LifetimeHold( void );
+void LifetimeRelease( void );
+
+/** LifetimeStarted
+ *
+ * Startup is done; take note of what it cost.
+ */
+void LifetimeStarted( void );
+
+/** LifetimeGetState, LifetimeRestore
+ *
+ * Carry start and exit counts and the request pattern across instances
+ * in the state snapshot.
+ */
+void LifetimeGetState( StoragedState* state );
+void LifetimeRestore( const StoragedState* state );
+
+/** LifetimeAppendStats
+ *
+ * Append a "lifetime" member to the json object being built in out.
+ */
+void LifetimeAppendStats( GString* out );
+
+#endif
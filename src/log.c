@@ -17,13 +17,55 @@
 * LICENSE@@@ */
 
 #include <stdio.h>
+#include <string.h>
 #include <glib.h>
 #include <syslog.h>
 #include <stdbool.h>
 
+#include "log.h"
+
 static int sLogLevel = G_LOG_LEVEL_MESSAGE;
 static bool sUseSyslog = false;
 
+/*
+ * Asynchronous logging
+ *
+ * Once setAsyncLogging(true) has been called, logFilter only copies the
+ * message into a slot of a fixed ring and a background thread writes it
+ * out, so a g_debug costs a copy instead of a syscall.  Any thread may
+ * log: producers claim slots with a compare-and-swap on sHead, and each
+ * slot's sequence number says whether it is free (seq == position), filled
+ * (seq == position + 1) or still being drained.  When the ring is full the
+ * message is dropped and counted rather than waiting for the writer.
+ *
+ * Errors and criticals (LOG_FATAL crashes right after one) are written
+ * synchronously, after whatever is already queued.
+ */
+#define LOG_RING_SLOTS 256          /* power of two */
+#define LOG_RECORD_MAX 512
+
+/* positions wrap; do the arithmetic unsigned */
+#define POS_ADD(pos, n) ((gint)((guint)(pos) + (guint)(n)))
+
+typedef struct
+{
+    volatile gint seq;
+    GLogLevelFlags level;
+    const gchar* domain;            /* always a literal (G_LOG_DOMAIN) */
+    gchar text[ LOG_RECORD_MAX ];
+}
+LogSlot;
+
+static LogSlot sRing[ LOG_RING_SLOTS ];
+static volatile gint sHead = 0;     /* next position to claim */
+static volatile gint sTail = 0;     /* next position to drain; writer thread only */
+static volatile gint sDropped = 0;
+static volatile gint sWriterAsleep = 0;
+static bool sAsync = false;
+
+static GMutex sWakeLock;
+static GCond sWake;
+
 void setLogLevel(int level)
 {
     sLogLevel = level;
@@ -35,10 +77,9 @@ setUseSyslog( bool useit )
     sUseSyslog = useit;
 }
 
-void logFilter(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer unused_data)
+static void
+write_message(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message)
 {
-    if (log_level > sLogLevel) return;
-
     if (sUseSyslog)
     {
         int priority;
@@ -67,7 +108,131 @@ void logFilter(const gchar *log_domain, GLogLevelFlags log_level, const gchar *m
     }
     else
     {
-        g_log_default_handler(log_domain, log_level, message, unused_data);
+        g_log_default_handler(log_domain, log_level, message, NULL);
     }
 }
 
+static bool
+ring_empty(void)
+{
+    gint pos = g_atomic_int_get(&sTail);
+    return g_atomic_int_get(&sRing[pos & (LOG_RING_SLOTS - 1)].seq) != POS_ADD(pos, 1);
+}
+
+/**
+ * @brief copy a message into the ring
+ *
+ * @return false if the ring was full
+ */
+static bool
+enqueue(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message)
+{
+    gint pos = g_atomic_int_get(&sHead);
+    LogSlot *slot;
+
+    for (;;) {
+        slot = &sRing[pos & (LOG_RING_SLOTS - 1)];
+        gint diff = POS_ADD(g_atomic_int_get(&slot->seq), -(guint)pos);
+        if (diff == 0) {
+            if (g_atomic_int_compare_and_exchange(&sHead, pos, POS_ADD(pos, 1)))
+                break;
+        } else if (diff < 0) {
+            g_atomic_int_inc(&sDropped);
+            return false;
+        }
+        pos = g_atomic_int_get(&sHead);
+    }
+
+    slot->level = log_level;
+    slot->domain = log_domain;
+    g_strlcpy(slot->text, message, sizeof(slot->text));
+    g_atomic_int_set(&slot->seq, POS_ADD(pos, 1));
+
+    if (g_atomic_int_get(&sWriterAsleep)) {
+        g_mutex_lock(&sWakeLock);
+        g_cond_signal(&sWake);
+        g_mutex_unlock(&sWakeLock);
+    }
+    return true;
+}
+
+static gpointer
+log_writer(gpointer data)
+{
+    gint reported = 0;
+
+    for (;;) {
+        /* drain everything that's there as one batch */
+        while (!ring_empty()) {
+            gint pos = sTail;
+            LogSlot *slot = &sRing[pos & (LOG_RING_SLOTS - 1)];
+            write_message(slot->domain, slot->level, slot->text);
+            g_atomic_int_set(&sTail, POS_ADD(pos, 1));
+            g_atomic_int_set(&slot->seq, POS_ADD(pos, LOG_RING_SLOTS));
+        }
+
+        gint dropped = g_atomic_int_get(&sDropped);
+        if (dropped != reported) {
+            gchar *note = g_strdup_printf("log ring full: dropped %d messages", dropped - reported);
+            write_message(NULL, G_LOG_LEVEL_WARNING, note);
+            g_free(note);
+            reported = dropped;
+        }
+
+        g_mutex_lock(&sWakeLock);
+        g_atomic_int_set(&sWriterAsleep, 1);
+        if (ring_empty())
+            g_cond_wait(&sWake, &sWakeLock);
+        g_atomic_int_set(&sWriterAsleep, 0);
+        g_mutex_unlock(&sWakeLock);
+    }
+    return NULL;
+}
+
+void
+setAsyncLogging( bool useit )
+{
+    static GThread *sWriter = NULL;
+
+    if (useit && NULL == sWriter) {
+        int i;
+        for (i = 0; i < LOG_RING_SLOTS; i++)
+            sRing[i].seq = i;
+        sWriter = g_thread_new("log", log_writer, NULL);
+    }
+    else if (!useit)
+        flushLog();
+    sAsync = useit && NULL != sWriter;
+}
+
+void
+flushLog(void)
+{
+    int i;
+
+    /* the writer only sleeps once the ring is empty; give it a second */
+    for (i = 0; i < 1000 && sAsync && !ring_empty(); i++)
+        g_usleep(1000);
+}
+
+void
+logAppendStats( GString* out )
+{
+    g_string_append_printf(out, "\"log\":{\"async\":%s, \"dropped\":%d}",
+                           sAsync ? "true" : "false", g_atomic_int_get(&sDropped));
+}
+
+void logFilter(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer unused_data)
+{
+    if (log_level > sLogLevel) return;
+
+    if (sAsync && !(log_level & (G_LOG_FLAG_FATAL | G_LOG_LEVEL_ERROR | G_LOG_LEVEL_CRITICAL)))
+    {
+        enqueue(log_domain, log_level, message);
+        return;
+    }
+
+    flushLog();
+    write_message(log_domain, log_level, message);
+}
+
@@ -18,6 +18,17 @@
 
 void setLogLevel(int level);
 void setUseSyslog( bool useit );
+
+/* Hand messages below critical to a background thread instead of writing
+   them on the caller's thread; see log.c */
+void setAsyncLogging( bool useit );
+
+/* Wait (briefly) for queued messages to be written */
+void flushLog(void);
+
+/* Append a "log" member with the number of dropped messages to a json object */
+void logAppendStats( GString* out );
+
 void logFilter(const gchar *log_domain, GLogLevelFlags log_level, const gchar *message, gpointer unused_data);
 
 #define BUG() { \
@@ -30,9 +30,25 @@
 
 #include <luna-service2/lunaservice.h>
 
+#include "backend.h"
 #include "diskmode.h"
+#include "dispatch.h"
 #include "erase.h"
+#include "evict.h"
+#include "flight.h"
+#include "jobs.h"
+#include "lifetime.h"
+#include "metrics.h"
+#include "mountopts.h"
+#include "qos.h"
+#include "recorder.h"
+#include "restore.h"
+#include "resume.h"
 #include "signals.h"
+#include "state.h"
+#include "tuning.h"
+#include "warmup.h"
+#include "watchdog.h"
 #include "log.h"
 #include "main.h"
 
@@ -67,7 +83,6 @@
  */
 
 static GMainLoop * g_mainloop = NULL;
-static int sTimerEventSource = 0;
 
 
 /***********************************************************************
@@ -172,58 +187,65 @@ term_handler(int signal)
     g_main_loop_quit(g_mainloop);
 }
 
-gboolean
-timeout_handler(gpointer data)
-{
-    g_main_loop_quit(g_mainloop);
-    return TRUE;
-}
+#define METRICS_FILE_PATH LOCKS_DIR_PATH "/storaged.metrics"
+#define STATE_FILE_PATH LOCKS_DIR_PATH "/storaged.state"
+#define HOT_FILE_PATH LOCKS_DIR_PATH "/storaged.hot"
 
 void
 PrintUsage(const char* progname)
 {
     printf("%s\n", progname);
     printf(" -h this help screen\n"
+           " -b backend[:args] storage backend: nyx (default) or local:IMAGE[:MOUNTPOINT]\n"
            " -c invert is-carrier test\n"
            " -d turn debug logging on\n"
+           " -m keep stage timings in " METRICS_FILE_PATH "\n"
+           " -r file record inbound events, backend results and timers to file\n"
            " -s logging via syslog\n");
 }
 
-#define DYNAMIC_LIFETIME_MS 10000
-
-void
-disable_lifetime_timer()
-{
-    g_debug("%s called", __func__);
-    if (sTimerEventSource != 0)
-        g_source_remove(sTimerEventSource);
-
-    sTimerEventSource = 0;
-}
+/*
+ * The private connection carries udev notifications and user confirmation
+ * (changed, avail, enterMSM); the public one only carries status queries.
+ * Give the private connection the higher priority so a flood of public
+ * queries can never delay a cable event.
+ */
+#define PRIVATE_BUS_PRIORITY G_PRIORITY_DEFAULT
+#define PUBLIC_BUS_PRIORITY  G_PRIORITY_DEFAULT_IDLE
 
-//TODO: need to call this from erase API's aswell
-void
-reset_lifetime_timer()
-{
-    g_debug("%s called", __func__);
-    disable_lifetime_timer();
-    sTimerEventSource = g_timeout_add_full(G_PRIORITY_DEFAULT, DYNAMIC_LIFETIME_MS, timeout_handler, NULL, NULL);
-    g_debug("%s: timeout set", __func__);
-}
+static const StorageBackend* sBackend = &NyxStorageBackend;
 
-static nyx_device_handle_t nyxSystem = NULL;
-static nyx_device_handle_t nyxMassStorageMode = NULL;
+static const StorageBackend* sBackends[] = {
+    &NyxStorageBackend,
+    &LocalStorageBackend,
+};
 
-nyx_device_handle_t
-GetNyxSystemDevice(void)
+const StorageBackend*
+GetStorageBackend(void)
 {
-    return nyxSystem;
+    return sBackend;
 }
 
-nyx_device_handle_t
-GetNyxMassStorageModeDevice(void)
+/**
+ * @brief pick the backend named in a "-b name[:arg]" option.
+ *
+ * @return false if there's no such backend
+ */
+static bool
+select_backend(const char* spec, const char** arg)
 {
-    return nyxMassStorageMode;
+    const char* colon = strchr(spec, ':');
+    size_t len = colon ? (size_t)(colon - spec) : strlen(spec);
+    int i;
+
+    for (i = 0; i < G_N_ELEMENTS(sBackends); i++) {
+        if (strlen(sBackends[i]->name) == len && !strncmp(sBackends[i]->name, spec, len)) {
+            sBackend = sBackends[i];
+            *arg = colon ? colon + 1 : NULL;
+            return true;
+        }
+    }
+    return false;
 }
 
 
@@ -233,18 +255,33 @@ main(int argc, char **argv)
     bool retVal;
     int opt;
     bool invertCarrier = false;
+    bool keepMetricsFile = false;
+    const char* backendArg = NULL;
+    const char* recordPath = NULL;
 
     LSPalmService * lsps = NULL;
 
-    while ((opt = getopt(argc, argv, "chdst")) != -1)
+    while ((opt = getopt(argc, argv, "b:chdmr:st")) != -1)
     {
         switch (opt) {
+        case 'b':
+            if (!select_backend(optarg, &backendArg)) {
+                PrintUsage(argv[0]);
+                return EXIT_FAILURE;
+            }
+            break;
         case 'c':
             invertCarrier = true;
             break;
         case 'd':
             setLogLevel(G_LOG_LEVEL_DEBUG);
             break;
+        case 'm':
+            keepMetricsFile = true;
+            break;
+        case 'r':
+            recordPath = optarg;
+            break;
         case 's':
             setUseSyslog(true);
             break;
@@ -262,30 +299,42 @@ main(int argc, char **argv)
     }
 
     g_log_set_default_handler(logFilter, NULL);
+    setAsyncLogging(true);
     g_debug( "entering %s in %s", __func__, __FILE__ );
 
     signal(SIGTERM, term_handler);
 
+    if (keepMetricsFile)
+        MetricsSetFile(METRICS_FILE_PATH);
+
     g_mainloop = g_main_loop_new(NULL, FALSE);
+    DispatchInit(g_mainloop);
+    LifetimeInit(g_mainloop);
+    WatchdogInit(g_mainloop);
+    FlightInit();
 
 
-    int ret = nyx_device_open(NYX_DEVICE_SYSTEM, "Main", &nyxSystem);
-    if(ret != NYX_ERROR_NONE)
+    if (!sBackend->open(backendArg))
     {
-        g_critical("Unable to open the nyx device system");
+        g_critical("Unable to open the %s storage backend", sBackend->name);
         abort();
     }
     else
-        g_debug("Initialized nyx system device");
+        g_debug("Initialized %s storage backend", sBackend->name);
 
-    ret = nyx_device_open(NYX_DEVICE_MASS_STORAGE_MODE, "Main", &nyxMassStorageMode);
-    if(ret != NYX_ERROR_NONE)
-    {
-        g_critical("Unable to open the nyx mass storage mode device");
-        abort();
-    }
-    else
-        g_debug("Initialized nyx mass storage mode device");
+    if (recordPath && RecorderOpen(recordPath))
+        sBackend = RecorderWrapBackend(sBackend);
+
+    // a recording has to start from scratch to replay the same way
+    StateSetFile(STATE_FILE_PATH, NULL == recordPath);
+    WarmupSetFile(HOT_FILE_PATH);
+    EvictLoadConfig(STORAGED_CONF_PATH);
+    ResumeLoadConfig(STORAGED_CONF_PATH);
+    RestoreLoadConfig(STORAGED_CONF_PATH);
+    TuningLoadConfig(STORAGED_CONF_PATH);
+    MountOptsLoadConfig(STORAGED_CONF_PATH);
+    QosInit(STORAGED_CONF_PATH);
+    JobsInit(STORAGED_CONF_PATH);
 
 
     /**
@@ -311,21 +360,18 @@ main(int argc, char **argv)
     DiskModeInterfaceInit( g_mainloop, lsh_priv, lsh_pub, invertCarrier );
     EraseInit(g_mainloop, lsh_priv);
 
-    retVal = LSGmainAttach( lsh_priv, g_mainloop, &lserror );
+    retVal = DispatchAttach( lsh_priv, "private", PRIVATE_BUS_PRIORITY, g_mainloop, &lserror );
     if ( !retVal )
-    {
-        g_critical( "LSGmainAttach private returned %s", lserror.message );
         LSErrorFree(&lserror);
-    }
-    retVal = LSGmainAttach( lsh_pub, g_mainloop, &lserror );
+    retVal = DispatchAttach( lsh_pub, "public", PUBLIC_BUS_PRIORITY, g_mainloop, &lserror );
     if ( !retVal )
-    {
-        g_critical( "LSGmainAttach public returned %s", lserror.message );
         LSErrorFree(&lserror);
-    }
     g_main_loop_run(g_mainloop);
     g_main_loop_unref(g_mainloop);
 
+    DiskModeShutdown();
+    DiskModeSaveState();
+
     if (!LSUnregister( lsh_priv, &lserror)) {
         g_critical( "LSUnregister private returned %s", lserror.message );
     }
@@ -336,6 +382,7 @@ main(int argc, char **argv)
     UnlockProcess();
 
     g_debug( "exiting %s in %s", __func__, __FILE__ );
+    setAsyncLogging(false);
 
     if (!retVal)
         return EXIT_FAILURE;
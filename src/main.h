@@ -17,7 +17,7 @@
 * LICENSE@@@ */
 
 #include <luna-service2/lunaservice.h>
-#include <nyx/nyx_client.h>
 
-nyx_device_handle_t GetNyxSystemDevice(void);
-nyx_device_handle_t GetNyxMassStorageModeDevice(void);
+#include "backend.h"
+
+const StorageBackend* GetStorageBackend(void);
@@ -0,0 +1,173 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glib.h>
+
+#include "metrics.h"
+
+/*
+ * Durations are kept in log2 buckets of microseconds: bucket i counts
+ * durations in [2^i, 2^(i+1)) us, so 32 buckets reach over an hour with
+ * a worst-case error of a factor of two on any reported percentile.
+ */
+#define NUM_BUCKETS 32
+
+typedef struct
+{
+    guint64 count;
+    gint64 sum;
+    gint64 max;
+    guint64 buckets[ NUM_BUCKETS ];
+}
+Histogram;
+
+static const char* sStageNames[ METRIC_NUM_STAGES ] = {
+    "msm_entry",
+    "unmount_wait",
+    "unmount",
+    "remount",
+    "fsck",
+    "reformat",
+    "pre_scripts",
+    "post_scripts",
+    "erase",
+    "preflush",
+    "final_sync",
+    "warmup",
+    "restore",
+    "interactive",
+    "resume",
+    "reconcile",
+    "first_reply",
+};
+
+static Histogram sHistograms[ METRIC_NUM_STAGES ];
+static gchar* sMetricsFile = NULL;
+
+static int
+bucket_of( gint64 us )
+{
+    int i = 0;
+    while ( us > 1 && i < NUM_BUCKETS - 1 ) {
+        us >>= 1;
+        i++;
+    }
+    return i;
+}
+
+/**
+ * @brief estimate a percentile as the upper edge of the bucket in which it
+ * falls (never more than the largest duration seen).
+ */
+static gint64
+percentile( const Histogram* h, int pct )
+{
+    guint64 rank = (h->count * pct + 99) / 100;
+    guint64 seen = 0;
+    int i;
+
+    if ( 0 == h->count )
+        return 0;
+
+    for ( i = 0; i < NUM_BUCKETS; i++ ) {
+        seen += h->buckets[i];
+        if ( seen >= rank )
+            return MIN( ((gint64)2 << i) - 1, h->max );
+    }
+    return h->max;
+}
+
+static void
+write_metrics_file( void )
+{
+    GString* text = g_string_new( NULL );
+    GError* error = NULL;
+    int i;
+
+    for ( i = 0; i < METRIC_NUM_STAGES; i++ ) {
+        const Histogram* h = &sHistograms[i];
+        g_string_append_printf( text,
+                "storaged_stage_count{stage=\"%s\"} %" G_GUINT64_FORMAT "\n"
+                "storaged_stage_sum_us{stage=\"%s\"} %" G_GINT64_FORMAT "\n"
+                "storaged_stage_p50_us{stage=\"%s\"} %" G_GINT64_FORMAT "\n"
+                "storaged_stage_p99_us{stage=\"%s\"} %" G_GINT64_FORMAT "\n"
+                "storaged_stage_max_us{stage=\"%s\"} %" G_GINT64_FORMAT "\n",
+                sStageNames[i], h->count,
+                sStageNames[i], h->sum,
+                sStageNames[i], percentile( h, 50 ),
+                sStageNames[i], percentile( h, 99 ),
+                sStageNames[i], h->max );
+    }
+
+    if ( !g_file_set_contents( sMetricsFile, text->str, text->len, &error ) ) {
+        g_warning( "%s: %s", __func__, error->message );
+        g_error_free( error );
+    }
+    g_string_free( text, TRUE );
+}
+
+gint64
+MetricsNow( void )
+{
+    return g_get_monotonic_time();
+}
+
+void
+MetricsRecord( MetricStage stage, gint64 start )
+{
+    gint64 us = g_get_monotonic_time() - start;
+    Histogram* h = &sHistograms[ stage ];
+
+    if ( us < 0 )
+        us = 0;
+
+    h->count++;
+    h->sum += us;
+    if ( us > h->max )
+        h->max = us;
+    h->buckets[ bucket_of( us ) ]++;
+
+    g_debug( "%s: %s took %" G_GINT64_FORMAT " us", __func__, sStageNames[ stage ], us );
+
+    if ( NULL != sMetricsFile )
+        write_metrics_file();
+}
+
+void
+MetricsSetFile( const char* path )
+{
+    g_free( sMetricsFile );
+    sMetricsFile = g_strdup( path );
+    write_metrics_file();
+}
+
+void
+MetricsAppendStats( GString* out )
+{
+    int i;
+
+    g_string_append( out, "\"stages\":{" );
+    for ( i = 0; i < METRIC_NUM_STAGES; i++ ) {
+        const Histogram* h = &sHistograms[i];
+        g_string_append_printf( out, "%s\"%s\":{\"count\":%" G_GUINT64_FORMAT ", \"p50Us\":%" G_GINT64_FORMAT
+                                ", \"p99Us\":%" G_GINT64_FORMAT ", \"maxUs\":%" G_GINT64_FORMAT "}",
+                                i ? ", " : "", sStageNames[i], h->count,
+                                percentile( h, 50 ), percentile( h, 99 ), h->max );
+    }
+    g_string_append( out, "}" );
+}
@@ -0,0 +1,75 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_METRICS_H__
+#define __STORAGED_METRICS_H__
+
+#include <glib.h>
+
+/*
+ * Stages of the diskmode and erase flows whose durations we keep.
+ */
+typedef enum
+{
+    METRIC_MSM_ENTRY,       /* user confirmation until exported (or failed) */
+    METRIC_UNMOUNT_WAIT,    /* grace period given to open file owners */
+    METRIC_UNMOUNT,         /* nyx unmount + export */
+    METRIC_REMOUNT,         /* nyx unexport + mount */
+    METRIC_FSCK,            /* nyx unexport + fsck + mount */
+    METRIC_REFORMAT,        /* any of the above that ended in a reformat */
+    METRIC_PRE_SCRIPTS,
+    METRIC_POST_SCRIPTS,
+    METRIC_ERASE,
+    METRIC_PREFLUSH,        /* background writeback once MSM is available */
+    METRIC_FINAL_SYNC,      /* syncfs when the user confirms MSM */
+    METRIC_WARMUP,          /* reading the hot list back in after remount */
+    METRIC_RESTORE,         /* putting the default content back after a reformat */
+    METRIC_INTERACTIVE,     /* PartitionAvail until the ui tier has resumed */
+    METRIC_RESUME,          /* PartitionAvail until the last tier is released */
+    METRIC_RECONCILE,       /* startup: bringing storaged in line with the hardware */
+    METRIC_FIRST_REPLY,     /* startup: until the first method call was answered */
+    METRIC_NUM_STAGES
+} MetricStage;
+
+/** MetricsNow
+ *
+ * @return the monotonic clock, in microseconds, to pass to MetricsRecord.
+ */
+gint64 MetricsNow( void );
+
+/** MetricsRecord
+ *
+ * Record that a stage which started at "start" (see MetricsNow) just
+ * finished, and rewrite the metrics file if one was set.
+ */
+void MetricsRecord( MetricStage stage, gint64 start );
+
+/** MetricsSetFile
+ *
+ * Also keep the metrics, as text, in the given file.
+ */
+void MetricsSetFile( const char* path );
+
+/** MetricsAppendStats
+ *
+ * Append the "stages" member, with count, p50, p99 and max of each stage,
+ * to a json object under construction.
+ */
+void MetricsAppendStats( GString* out );
+
+#endif
@@ -0,0 +1,412 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <errno.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <glib.h>
+
+#include "mountopts.h"
+#include "lifetime.h"
+#include "recorder.h"
+
+#define MOUNT_GROUP             "mount"
+#define MOUNT_PROFILE_PREFIX    "mount "
+
+/* not in every libc's sys/mount.h */
+#ifndef MS_LAZYTIME
+#define MS_LAZYTIME     (1 << 25)
+#endif
+
+typedef struct
+{
+    gchar* name;
+    gchar** options;
+}
+MountProfile;
+
+typedef struct
+{
+    const char* name;
+    unsigned long flag;
+}
+MountFlag;
+
+/* the options mount(2) takes as flags rather than in its data string */
+static const MountFlag sFlags[] = {
+    { "ro",          MS_RDONLY },
+    { "rw",          0 },
+    { "nosuid",      MS_NOSUID },
+    { "nodev",       MS_NODEV },
+    { "noexec",      MS_NOEXEC },
+    { "sync",        MS_SYNCHRONOUS },
+    { "dirsync",     MS_DIRSYNC },
+    { "noatime",     MS_NOATIME },
+    { "nodiratime",  MS_NODIRATIME },
+    { "relatime",    MS_RELATIME },
+    { "strictatime", MS_STRICTATIME },
+    { "lazytime",    MS_LAZYTIME },
+};
+
+#define ATIME_FLAGS     (MS_NOATIME | MS_RELATIME | MS_STRICTATIME)
+
+static GPtrArray* sProfiles = NULL;     /* of MountProfile* */
+static gchar* sScanProfile = NULL;
+static gchar* sSteadyProfile = NULL;
+static guint sSteadyAfterMs = 60000;
+
+static gchar* sMountPoint = NULL;       /* waiting to switch to steady */
+static guint sTimerId = 0;
+
+static const char* sApplied = "none";
+static guint sApplyCount = 0;
+static guint sRemounts = 0;             /* applied by unmounting and mounting */
+static guint sFailed = 0;
+static gint64 sLastUs = 0;
+
+static MountProfile*
+add_profile( const char* name, const char* options )
+{
+    MountProfile* profile = g_new0( MountProfile, 1 );
+
+    profile->name = g_strdup( name );
+    profile->options = g_strsplit( options, ",", -1 );
+    g_ptr_array_add( sProfiles, profile );
+    return profile;
+}
+
+static MountProfile*
+find_profile( const char* name )
+{
+    guint i;
+
+    for ( i = 0; name && sProfiles && i < sProfiles->len; i++ ) {
+        MountProfile* profile = g_ptr_array_index( sProfiles, i );
+        if ( !strcmp( profile->name, name ) )
+            return profile;
+    }
+    return NULL;
+}
+
+static void
+init_profiles( void )
+{
+    if ( sProfiles )
+        return;
+    sProfiles = g_ptr_array_new();
+
+    add_profile( "default", "" );
+    /* rescans: reading everything shouldn't dirty every inode */
+    add_profile( "scan", "noatime,nodiratime" );
+    /* small writes: keep timestamps in memory, but write files out on close */
+    add_profile( "steady", "noatime,nodiratime,lazytime,flush" );
+}
+
+void
+MountOptsLoadConfig( const char* path )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    GError* error = NULL;
+    gchar** groups;
+    gchar** group;
+
+    init_profiles();
+    if ( !g_key_file_load_from_file( keyFile, path, G_KEY_FILE_NONE, NULL ) ) {
+        g_key_file_free( keyFile );
+        return;
+    }
+
+    groups = g_key_file_get_groups( keyFile, NULL );
+    for ( group = groups; *group; group++ ) {
+        if ( !g_str_has_prefix( *group, MOUNT_PROFILE_PREFIX ) )
+            continue;
+
+        const char* name = *group + strlen( MOUNT_PROFILE_PREFIX );
+        gchar* options = g_key_file_get_string( keyFile, *group, "options", NULL );
+        MountProfile* profile = find_profile( name );
+
+        if ( NULL == options )
+            continue;
+        if ( profile ) {
+            g_strfreev( profile->options );
+            profile->options = g_strsplit( options, ",", -1 );
+        } else {
+            add_profile( name, options );
+        }
+        g_free( options );
+    }
+    g_strfreev( groups );
+
+    gchar* scan = g_key_file_get_string( keyFile, MOUNT_GROUP, "scan", NULL );
+    gchar* steady = g_key_file_get_string( keyFile, MOUNT_GROUP, "steady", NULL );
+    if ( scan && *scan && NULL == find_profile( scan ) )
+        g_warning( "%s: %s: no mount profile \"%s\"", __func__, path, scan );
+    if ( steady && *steady && NULL == find_profile( steady ) )
+        g_warning( "%s: %s: no mount profile \"%s\"", __func__, path, steady );
+    g_free( sScanProfile );
+    sScanProfile = scan;
+    g_free( sSteadyProfile );
+    sSteadyProfile = steady;
+
+    gint delay = g_key_file_get_integer( keyFile, MOUNT_GROUP, "steadyAfterMs", &error );
+    if ( NULL == error && delay >= 0 )
+        sSteadyAfterMs = delay;
+    g_clear_error( &error );
+
+    g_key_file_free( keyFile );
+}
+
+const gchar**
+MountOptsProfileNames( void )
+{
+    const gchar** names;
+    guint i;
+
+    init_profiles();
+    names = g_new0( const gchar*, sProfiles->len + 1 );
+    for ( i = 0; i < sProfiles->len; i++ )
+        names[i] = ((MountProfile*)g_ptr_array_index( sProfiles, i ))->name;
+    return names;
+}
+
+static const MountFlag*
+find_flag( const char* option )
+{
+    int i;
+
+    for ( i = 0; i < G_N_ELEMENTS( sFlags ); i++ ) {
+        if ( !strcmp( sFlags[i].name, option ) )
+            return &sFlags[i];
+    }
+    return NULL;
+}
+
+/**
+ * @brief fold an option into flags and data, replacing any option of the
+ * same name (or, for the atime options, any other atime option)
+ */
+static void
+merge_option( const char* option, unsigned long* flags, GPtrArray* data )
+{
+    const MountFlag* flag = find_flag( option );
+    size_t keyLen = strcspn( option, "=" );
+    guint i;
+
+    if ( '\0' == *option )
+        return;
+    if ( flag ) {
+        if ( flag->flag & ATIME_FLAGS )
+            *flags &= ~ATIME_FLAGS;
+        if ( !strcmp( option, "rw" ) )
+            *flags &= ~MS_RDONLY;
+        *flags |= flag->flag;
+        return;
+    }
+
+    for ( i = 0; i < data->len; i++ ) {
+        const char* existing = g_ptr_array_index( data, i );
+        if ( !strncmp( existing, option, keyLen )
+             && ('=' == existing[keyLen] || '\0' == existing[keyLen]) ) {
+            g_ptr_array_remove_index( data, i );
+            break;
+        }
+    }
+    g_ptr_array_add( data, g_strdup( option ) );
+}
+
+/**
+ * @brief the device, type and options mountpoint is mounted with, or false
+ */
+static bool
+find_mount( const char* mountpoint, gchar** device, gchar** type, gchar** options )
+{
+    struct mntent* ent;
+    FILE* mounts = setmntent( "/proc/self/mounts", "r" );
+    bool found = false;
+
+    if ( NULL == mounts )
+        return false;
+    while ( !found && NULL != (ent = getmntent( mounts )) ) {
+        if ( !strcmp( ent->mnt_dir, mountpoint ) ) {
+            *device = g_strdup( ent->mnt_fsname );
+            *type = g_strdup( ent->mnt_type );
+            *options = g_strdup( ent->mnt_opts );
+            found = true;
+        }
+    }
+    endmntent( mounts );
+    return found;
+}
+
+/**
+ * @brief whether every data option asked for is among those in effect
+ */
+static bool
+data_in_effect( GPtrArray* data, const char* mountpoint )
+{
+    gchar *device = NULL, *type = NULL, *current = NULL;
+    gchar** inEffect;
+    guint i;
+    bool all = true;
+
+    if ( !find_mount( mountpoint, &device, &type, &current ) )
+        return false;
+    inEffect = g_strsplit( current, ",", -1 );
+    for ( i = 0; all && i < data->len; i++ ) {
+        gchar** option;
+        all = false;
+        for ( option = inEffect; !all && *option; option++ )
+            all = !strcmp( *option, g_ptr_array_index( data, i ) );
+    }
+    g_strfreev( inEffect );
+    g_free( current );
+    g_free( type );
+    g_free( device );
+    return all;
+}
+
+bool
+MountOptsApplyProfile( const char* name, const char* mountpoint, bool idle )
+{
+    MountProfile* profile;
+    gchar *device = NULL, *type = NULL, *current = NULL;
+    gchar** options;
+    gchar** option;
+    GPtrArray* data;
+    unsigned long flags = 0;
+    unsigned long currentFlags;
+    gint64 start = g_get_monotonic_time();
+    const char* why = NULL;
+    bool ok;
+
+    init_profiles();
+    profile = find_profile( name );
+    if ( NULL == profile || !find_mount( mountpoint, &device, &type, &current ) )
+        return false;
+
+    data = g_ptr_array_new_with_free_func( g_free );
+    options = g_strsplit( current, ",", -1 );
+    for ( option = options; *option; option++ )
+        merge_option( *option, &flags, data );
+    g_strfreev( options );
+    g_ptr_array_add( data, NULL );
+    gchar* currentData = g_strjoinv( ",", (gchar**)data->pdata );
+    g_ptr_array_set_size( data, data->len - 1 );
+    currentFlags = flags;
+    for ( option = profile->options; *option; option++ )
+        merge_option( *option, &flags, data );
+    g_ptr_array_add( data, NULL );
+    gchar* dataString = g_strjoinv( ",", (gchar**)data->pdata );
+    g_ptr_array_set_size( data, data->len - 1 );
+
+    ok = 0 == mount( device, mountpoint, type, MS_REMOUNT | flags, dataString );
+    if ( data_in_effect( data, mountpoint ) ) {
+        /* as asked */
+    } else if ( !idle ) {
+        /* the filesystem kept (or ignored) its data options, and it's in
+           use: the profile isn't in effect */
+        if ( ok )
+            why = "data options ignored";
+        ok = false;
+    } else {
+        /* likewise, but it isn't in use yet: start it over */
+        if ( 0 != umount2( mountpoint, 0 ) ) {
+            g_warning( "%s: %s in use, not mounting it again: %s", __func__, mountpoint, strerror( errno ) );
+            ok = false;
+        } else if ( 0 == mount( device, mountpoint, type, flags, dataString ) ) {
+            sRemounts++;
+            ok = data_in_effect( data, mountpoint );
+            if ( !ok )
+                why = "data options ignored";
+        } else {
+            ok = false;
+            if ( 0 != mount( device, mountpoint, type, currentFlags, currentData ) )
+                g_critical( "%s: can't mount %s on %s again", __func__, device, mountpoint );
+        }
+    }
+    if ( !ok ) {
+        g_warning( "%s: %s on %s: %s", __func__, name, mountpoint, why ? why : strerror( errno ) );
+        sFailed++;
+    } else {
+        sApplied = profile->name;
+        sApplyCount++;
+    }
+    sLastUs = g_get_monotonic_time() - start;
+    g_debug( "%s: %s -o %s: %s", __func__, mountpoint, dataString, ok ? "ok" : "refused" );
+
+    g_free( dataString );
+    g_free( currentData );
+    g_ptr_array_free( data, TRUE );
+    g_free( current );
+    g_free( type );
+    g_free( device );
+    return ok;
+}
+
+static gboolean
+steady_timer_proc( gpointer data )
+{
+    sTimerId = 0;
+    if ( sMountPoint )
+        (void) MountOptsApplyProfile( sSteadyProfile, sMountPoint, false );
+    MountOptsEnd();
+    LifetimeRelease();
+    return FALSE;
+}
+
+void
+MountOptsBegin( const char* mountpoint )
+{
+    MountOptsEnd();
+    init_profiles();
+
+    if ( find_profile( sScanProfile ) )
+        (void) MountOptsApplyProfile( sScanProfile, mountpoint, true );
+    if ( find_profile( sSteadyProfile ) ) {
+        sMountPoint = g_strdup( mountpoint );
+        /* the switch is long after storaged would otherwise have exited */
+        LifetimeHold();
+        sTimerId = RecorderTimeoutAdd( RECORDER_TIMER_MOUNT, G_PRIORITY_DEFAULT_IDLE,
+                                       sSteadyAfterMs, steady_timer_proc, NULL );
+    }
+}
+
+void
+MountOptsEnd( void )
+{
+    if ( sTimerId ) {
+        RecorderTimeoutRemove( sTimerId );
+        sTimerId = 0;
+        LifetimeRelease();
+    }
+    g_free( sMountPoint );
+    sMountPoint = NULL;
+}
+
+void
+MountOptsAppendStats( GString* out )
+{
+    g_string_append_printf( out, "\"mount\":{\"scan\":\"%s\", \"steady\":\"%s\", \"applied\":\"%s\""
+                            ", \"switchPending\":%s, \"applies\":%u, \"remounts\":%u, \"refused\":%u"
+                            ", \"lastMs\":%" G_GINT64_FORMAT "}",
+                            sScanProfile ? sScanProfile : "", sSteadyProfile ? sSteadyProfile : "",
+                            sApplied, sTimerId ? "true" : "false",
+                            sApplyCount, sRemounts, sFailed, sLastUs / 1000 );
+}
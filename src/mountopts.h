@@ -0,0 +1,92 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_MOUNTOPTS_H__
+#define __STORAGED_MOUNTOPTS_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+/*
+ * Mount option profiles for the partition after MSM.  nyx mounts it again
+ * with its own options; storaged then applies a "scan" profile suited to
+ * the rescans that follow (no atime updates from all those reads) and,
+ * after a while, switches online to a "steady" profile suited to the small
+ * writes that come later (lazytime, FAT's flush).  A profile's options are
+ * merged over the ones the partition was mounted with.
+ *
+ * Built in are "default" (change nothing), "scan" and "steady".  More can
+ * be defined, and the choice made, in storaged.conf:
+ *
+ *   [mount]
+ *   scan=scan
+ *   steady=steady
+ *   steadyAfterMs=60000
+ *
+ *   [mount quiet]
+ *   options=noatime,nodiratime,lazytime
+ *
+ * Only the generic flags (atime handling, lazytime, sync, ...) are sure to
+ * change online; options the filesystem can't change on remount only take
+ * effect in the profile applied before the partition is in use.
+ */
+
+/** MountOptsLoadConfig
+ *
+ * Read profiles, and the choice of profiles, from the given key file, if it
+ * exists.
+ */
+void MountOptsLoadConfig( const char* path );
+
+/** MountOptsProfileNames
+ *
+ * @return the names of all known profiles, NULL-terminated; free the array
+ *         (not the names) with g_free
+ */
+const gchar** MountOptsProfileNames( void );
+
+/** MountOptsApplyProfile
+ *
+ * Merge the named profile's options over those mountpoint is mounted with.
+ *
+ * @param idle  nothing should use the filesystem yet, so it may be unmounted
+ *              and mounted again if a remount leaves the options out; if
+ *              it turns out to be busy, it's left as it is
+ *
+ * @return false if there's no such profile, or the kernel refused it or
+ *         left some of its data options out of effect
+ */
+bool MountOptsApplyProfile( const char* name, const char* mountpoint, bool idle );
+
+/** MountOptsBegin, MountOptsEnd
+ *
+ * MountOptsBegin applies the scan profile to the partition just mounted
+ * again on mountpoint, before anyone is told it's available, and arms the
+ * switch to the steady profile, keeping storaged running until it's made.
+ * MountOptsEnd disarms it, when MSM is entered again.
+ */
+void MountOptsBegin( const char* mountpoint );
+void MountOptsEnd( void );
+
+/** MountOptsAppendStats
+ *
+ * Append the "mount" member to a json object under construction.
+ */
+void MountOptsAppendStats( GString* out );
+
+#endif
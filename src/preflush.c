@@ -0,0 +1,226 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <glib.h>
+
+#include "preflush.h"
+#include "metrics.h"
+#include "util.h"
+
+#define PREFLUSH_LARGE_FILE (1024 * 1024)   /* smaller files are left to syncfs */
+
+/* from linux/ioprio.h, which isn't exported to userspace everywhere */
+#define IOPRIO_CLASS_IDLE   3
+#define IOPRIO_CLASS_SHIFT  13
+#define IOPRIO_WHO_PROCESS  1
+
+typedef struct
+{
+    gchar* mountpoint;
+    GHashTable* files;          /* large files open for writing */
+    gint64 flushUs;             /* time spent in sync_file_range + syncfs */
+}
+Preflush;
+
+static volatile gint sRunning = 0;
+static GThread* sThread = NULL;     /* to be joined, main thread only */
+
+/* main thread only */
+static guint sRuns = 0;
+static guint sFiles = 0;
+static gint64 sLastRunUs = 0;
+static gint64 sLastFlushUs = -1;    /* -1: no preflush since the last final sync */
+static gint64 sLastFinalUs = 0;
+static gint64 sEarlyUs = 0;         /* writeback done before final syncs */
+
+/**
+ * @brief is descriptor fd of process pid open for writing?
+ */
+static bool
+open_for_writing( const gchar* pid, const gchar* fd )
+{
+    gchar* path = g_build_path( "/", "/proc", pid, "fdinfo", fd, NULL );
+    gchar* info = NULL;
+    bool writing = false;
+
+    if ( g_file_get_contents( path, &info, NULL, NULL ) ) {
+        const char* flags = strstr( info, "flags:" );
+        if ( flags ) {
+            unsigned long value = strtoul( flags + strlen( "flags:" ), NULL, 8 );
+            writing = (value & O_ACCMODE) != O_RDONLY;
+        }
+    }
+
+    g_free( info );
+    g_free( path );
+    return writing;
+}
+
+static void
+note_dirty_candidate( const gchar* pid, const gchar* fd, const gchar* path, gpointer data )
+{
+    Preflush* preflush = data;
+    struct stat st;
+
+    if ( g_hash_table_lookup( preflush->files, path ) )
+        return;
+    if ( stat( path, &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_size < PREFLUSH_LARGE_FILE )
+        return;
+    if ( open_for_writing( pid, fd ) )
+        g_hash_table_insert( preflush->files, g_strdup( path ), GINT_TO_POINTER( 1 ) );
+}
+
+static void
+start_writeback( gpointer key, gpointer value, gpointer data )
+{
+    int fd = open( (const char*)key, O_RDONLY | O_CLOEXEC );
+    if ( fd < 0 )
+        return;
+    /* just queue the writeback; syncfs waits for it */
+    (void) sync_file_range( fd, 0, 0, SYNC_FILE_RANGE_WRITE );
+    close( fd );
+}
+
+/**
+ * @brief join the preflush thread, if there is one, and account for its run
+ */
+static void
+preflush_reap( void )
+{
+    Preflush* preflush;
+
+    if ( NULL == sThread )
+        return;
+    preflush = g_thread_join( sThread );
+    sThread = NULL;
+
+    sRuns++;
+    sFiles = g_hash_table_size( preflush->files );
+    sLastRunUs = sLastFlushUs = preflush->flushUs;
+    MetricsRecord( METRIC_PREFLUSH, MetricsNow() - preflush->flushUs );
+    g_debug( "%s: %s written back in %" G_GINT64_FORMAT " us (%u large files)", __func__,
+             preflush->mountpoint, preflush->flushUs, sFiles );
+
+    g_hash_table_destroy( preflush->files );
+    g_free( preflush->mountpoint );
+    g_free( preflush );
+    g_atomic_int_set( &sRunning, 0 );
+}
+
+static gboolean
+preflush_done( gpointer data )
+{
+    /* unless PreflushFinal got there first */
+    preflush_reap();
+    return FALSE;
+}
+
+static gpointer
+preflush_thread( gpointer data )
+{
+    Preflush* preflush = data;
+
+    /* this thread only: get out of the way of the foreground's I/O */
+    if ( syscall( SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT ) != 0 )
+        g_debug( "%s: ioprio_set failed", __func__ );
+
+    scan_open_files( preflush->mountpoint, note_dirty_candidate, preflush );
+
+    gint64 start = g_get_monotonic_time();
+    g_hash_table_foreach( preflush->files, start_writeback, NULL );
+
+    int fd = open( preflush->mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( fd >= 0 ) {
+        if ( syncfs( fd ) != 0 )
+            g_warning( "%s: syncfs %s failed", __func__, preflush->mountpoint );
+        close( fd );
+    }
+    preflush->flushUs = g_get_monotonic_time() - start;
+
+    g_idle_add( preflush_done, NULL );
+    return preflush;
+}
+
+void
+PreflushStart( const char* mountpoint )
+{
+    if ( !g_atomic_int_compare_and_exchange( &sRunning, 0, 1 ) ) {
+        g_debug( "%s: already running", __func__ );
+        return;
+    }
+
+    Preflush* preflush = g_new0( Preflush, 1 );
+    preflush->mountpoint = g_strdup( mountpoint );
+    preflush->files = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+
+    sThread = g_thread_new( "preflush", preflush_thread, preflush );
+}
+
+void
+PreflushFinal( const char* mountpoint )
+{
+    gint64 start = MetricsNow();
+    int fd;
+
+    /* a preflush still running holds descriptors on the partition, which
+       would make the unmount fail; its syncfs is ours anyway */
+    preflush_reap();
+
+    fd = open( mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+    if ( fd >= 0 ) {
+        if ( syncfs( fd ) != 0 )
+            g_warning( "%s: syncfs %s failed", __func__, mountpoint );
+        close( fd );
+    }
+
+    sLastFinalUs = MetricsNow() - start;
+    MetricsRecord( METRIC_FINAL_SYNC, start );
+
+    /* the writeback the preflush did at most takes that much off the final sync */
+    if ( sLastFlushUs >= 0 ) {
+        sEarlyUs += sLastFlushUs;
+        g_message( "%s: final sync took %" G_GINT64_FORMAT " ms, after %" G_GINT64_FORMAT " ms of preflush",
+                   __func__, sLastFinalUs / 1000, sLastFlushUs / 1000 );
+    } else {
+        g_message( "%s: final sync took %" G_GINT64_FORMAT " ms, no preflush had finished",
+                   __func__, sLastFinalUs / 1000 );
+    }
+    sLastFlushUs = -1;
+}
+
+void
+PreflushWait( void )
+{
+    preflush_reap();
+}
+
+void
+PreflushAppendStats( GString* out )
+{
+    g_string_append_printf( out, "\"preflush\":{\"runs\":%u, \"files\":%u, \"lastFlushMs\":%" G_GINT64_FORMAT
+                            ", \"lastFinalSyncMs\":%" G_GINT64_FORMAT ", \"earlyFlushMs\":%" G_GINT64_FORMAT "}",
+                            sRuns, sFiles, sLastRunUs / 1000, sLastFinalUs / 1000, sEarlyUs / 1000 );
+}
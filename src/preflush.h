@@ -0,0 +1,60 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_PREFLUSH_H__
+#define __STORAGED_PREFLUSH_H__
+
+#include <glib.h>
+
+/*
+ * Speculative writeback.  Most of the time it takes to unmount the media
+ * partition for MSM goes to writing back dirty pages.  As soon as MSM
+ * becomes available (the cable is in, the user hasn't confirmed yet) a
+ * background thread at idle I/O priority starts writeback of the large
+ * files open for writing there, then syncfs()es the filesystem, so that the
+ * syncfs at confirm time has little left to do.
+ */
+
+/** PreflushStart
+ *
+ * Start writing back the filesystem mounted at mountpoint in the
+ * background, unless that is already under way.
+ */
+void PreflushStart( const char* mountpoint );
+
+/** PreflushFinal
+ *
+ * syncfs() the filesystem at mountpoint now (the user confirmed MSM), and
+ * report how long that took.  Waits for a preflush still running, so that
+ * it holds nothing open there once this returns.
+ */
+void PreflushFinal( const char* mountpoint );
+
+/** PreflushWait
+ *
+ * Wait for a preflush still running, e.g. on the way out.
+ */
+void PreflushWait( void );
+
+/** PreflushAppendStats
+ *
+ * Append a "preflush" member to the json object being built in out.
+ */
+void PreflushAppendStats( GString* out );
+
+#endif
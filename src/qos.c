@@ -0,0 +1,182 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <fcntl.h>
+#include <glob.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+
+#include "qos.h"
+#include "util.h"
+
+#define QOS_GROUP           "qos"
+#define CPU_DMA_LATENCY     "/dev/cpu_dma_latency"
+#define CPUFREQ_MIN_FREQS   "/sys/devices/system/cpu/cpufreq/policy*/scaling_min_freq"
+
+typedef enum
+{
+    QOS_OFF,
+    QOS_ON,
+    QOS_ALTERNATE,
+} QosMode;
+
+static QosMode sMode = QOS_ON;
+static gint32 sLatencyUs = 0;
+static gint sMinFreqKhz = 0;
+
+static int sDepth = 0;
+static bool sInForce = false;
+static bool sSkipNext[ JOB_NUM_CLASSES ];  /* alternate mode: leave the class's next hold off */
+static int sLatencyFd = -1;
+static GPtrArray* sSavedFreqs = NULL;   /* path, value, path, value, ... */
+
+static guint64 sHolds = 0;
+static gint64 sHeldSince = 0;
+static gint64 sHeldUs = 0;
+
+void
+QosInit( const char* confPath )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    GError* error = NULL;
+
+    if ( g_key_file_load_from_file( keyFile, confPath, G_KEY_FILE_NONE, NULL ) ) {
+        gchar* mode = g_key_file_get_string( keyFile, QOS_GROUP, "mode", NULL );
+        if ( mode ) {
+            if ( !strcmp( mode, "off" ) )
+                sMode = QOS_OFF;
+            else if ( !strcmp( mode, "alternate" ) )
+                sMode = QOS_ALTERNATE;
+            else if ( strcmp( mode, "on" ) )
+                g_warning( "%s: %s: unknown qos mode \"%s\"", __func__, confPath, mode );
+            g_free( mode );
+        }
+
+        gint value = g_key_file_get_integer( keyFile, QOS_GROUP, "latency_us", &error );
+        if ( NULL == error && value >= 0 )
+            sLatencyUs = value;
+        g_clear_error( &error );
+
+        value = g_key_file_get_integer( keyFile, QOS_GROUP, "min_freq_khz", &error );
+        if ( NULL == error && value >= 0 )
+            sMinFreqKhz = value;
+        g_clear_error( &error );
+    }
+    g_key_file_free( keyFile );
+}
+
+static void
+raise_min_freqs( void )
+{
+    glob_t policies;
+    gchar* floor;
+    size_t i;
+
+    if ( 0 == sMinFreqKhz || 0 != glob( CPUFREQ_MIN_FREQS, 0, NULL, &policies ) )
+        return;
+
+    floor = g_strdup_printf( "%d", sMinFreqKhz );
+    sSavedFreqs = g_ptr_array_new_with_free_func( g_free );
+    for ( i = 0; i < policies.gl_pathc; i++ ) {
+        gchar* current = read_sysfs( policies.gl_pathv[i] );
+
+        /* never lower a floor someone else set */
+        if ( current && atoi( current ) < sMinFreqKhz && write_sysfs( policies.gl_pathv[i], floor ) ) {
+            g_ptr_array_add( sSavedFreqs, g_strdup( policies.gl_pathv[i] ) );
+            g_ptr_array_add( sSavedFreqs, current );
+        } else {
+            g_free( current );
+        }
+    }
+    g_free( floor );
+    globfree( &policies );
+}
+
+static void
+restore_min_freqs( void )
+{
+    guint i;
+
+    if ( NULL == sSavedFreqs )
+        return;
+    for ( i = 0; i + 1 < sSavedFreqs->len; i += 2 ) {
+        const char* path = g_ptr_array_index( sSavedFreqs, i );
+        const char* value = g_ptr_array_index( sSavedFreqs, i + 1 );
+        if ( !write_sysfs( path, value ) )
+            g_warning( "%s: couldn't restore %s to %s", __func__, path, value );
+    }
+    g_ptr_array_free( sSavedFreqs, TRUE );
+    sSavedFreqs = NULL;
+}
+
+bool
+QosHold( JobClass job )
+{
+    if ( sDepth++ > 0 )
+        return sInForce;
+
+    /* per class: MSM runs its jobs in a fixed order, so a single toggle
+       would always give the same classes the QoS */
+    sInForce = (QOS_ON == sMode) || (QOS_ALTERNATE == sMode && !sSkipNext[job]);
+    if ( QOS_ALTERNATE == sMode )
+        sSkipNext[job] = !sSkipNext[job];
+    if ( !sInForce )
+        return false;
+
+    /* the request stands for as long as the descriptor is open */
+    sLatencyFd = open( CPU_DMA_LATENCY, O_WRONLY | O_CLOEXEC );
+    if ( sLatencyFd >= 0 && write( sLatencyFd, &sLatencyUs, sizeof(sLatencyUs) ) != sizeof(sLatencyUs) ) {
+        g_debug( "%s: " CPU_DMA_LATENCY " refused %d", __func__, sLatencyUs );
+        close( sLatencyFd );
+        sLatencyFd = -1;
+    }
+    raise_min_freqs();
+
+    sHolds++;
+    sHeldSince = g_get_monotonic_time();
+    return true;
+}
+
+void
+QosRelease( void )
+{
+    if ( sDepth <= 0 || --sDepth > 0 || !sInForce )
+        return;
+
+    if ( sLatencyFd >= 0 ) {
+        close( sLatencyFd );
+        sLatencyFd = -1;
+    }
+    restore_min_freqs();
+
+    sHeldUs += g_get_monotonic_time() - sHeldSince;
+    sInForce = false;
+}
+
+void
+QosAppendStats( GString* out )
+{
+    static const char* modes[] = { "off", "on", "alternate" };
+
+    g_string_append_printf( out, "\"qos\":{\"mode\":\"%s\", \"latencyUs\":%d, \"minFreqKhz\":%d"
+                            ", \"held\":%s, \"holds\":%" G_GUINT64_FORMAT ", \"heldMs\":%" G_GINT64_FORMAT "}",
+                            modes[ sMode ], sLatencyUs, sMinFreqKhz,
+                            sInForce ? "true" : "false", sHolds, sHeldUs / 1000 );
+}
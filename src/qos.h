@@ -0,0 +1,66 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_QOS_H__
+#define __STORAGED_QOS_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+#include "jobs.h"
+
+/*
+ * CPU latency QoS for storaged's jobs (see jobs.h).  On power-managed SoCs
+ * fsck, remount and erase otherwise run with the CPUs dropping into deep
+ * idle states between I/Os, at low frequency.  While a job runs storaged
+ * holds a /dev/cpu_dma_latency request and, optionally, raises every
+ * cpufreq policy's scaling_min_freq.
+ *
+ * In storaged.conf:
+ *
+ *   [qos]
+ *   mode=on            (on, off, or alternate: every other job of each
+ *                       class, so that the jobs stats compare the two)
+ *   latency_us=0
+ *   min_freq_khz=0     (0 leaves the frequency alone)
+ */
+
+/** QosInit
+ *
+ * Read the settings from the given key file, if it exists.
+ */
+void QosInit( const char* confPath );
+
+/** QosHold, QosRelease
+ *
+ * Take and drop the QoS request for a job of the given class.  Holds nest.
+ *
+ * @return QosHold returns whether the request is in force for this hold
+ *         (it isn't when mode is off, or, when it is alternate, for every
+ *         other outermost hold of each job class)
+ */
+bool QosHold( JobClass job );
+void QosRelease( void );
+
+/** QosAppendStats
+ *
+ * Append the "qos" member to a json object under construction.
+ */
+void QosAppendStats( GString* out );
+
+#endif
@@ -0,0 +1,155 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "ratelimit.h"
+
+#define RATE_PER_SECOND 10      /* sustained requests per second per sender */
+#define RATE_BURST 20           /* requests a quiet sender may send at once */
+#define MAX_SENDERS 64          /* beyond this, unknown senders share a bucket */
+#define SENDER_IDLE_US (60 * G_USEC_PER_SEC)    /* forget senders idle this long */
+
+#define OVERFLOW_SENDER "*"
+
+typedef struct
+{
+    gchar* service;
+    gdouble tokens;
+    gint64 lastRefill;
+    guint64 allowed;
+    guint64 throttled;
+    guint64 dropped;
+}
+RateBucket;
+
+static GHashTable* sBuckets = NULL;
+
+static void
+bucket_free( gpointer data )
+{
+    RateBucket* bucket = data;
+    g_free( bucket->service );
+    g_free( bucket );
+}
+
+static gboolean
+bucket_is_idle( gpointer key, gpointer value, gpointer data )
+{
+    RateBucket* bucket = value;
+    gint64 now = *(gint64*)data;
+    return (now - bucket->lastRefill) > SENDER_IDLE_US;
+}
+
+static RateBucket*
+lookup_bucket( const char* sender, const char* service, gint64 now )
+{
+    if ( NULL == sBuckets )
+        sBuckets = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, bucket_free );
+
+    RateBucket* bucket = g_hash_table_lookup( sBuckets, sender );
+    if ( NULL != bucket )
+        return bucket;
+
+    if ( g_hash_table_size( sBuckets ) >= MAX_SENDERS ) {
+        g_hash_table_foreach_remove( sBuckets, bucket_is_idle, &now );
+        if ( g_hash_table_size( sBuckets ) >= MAX_SENDERS ) {
+            g_warning( "%s: too many senders, %s shares the overflow bucket", __func__, sender );
+            sender = OVERFLOW_SENDER;
+            service = OVERFLOW_SENDER;
+            bucket = g_hash_table_lookup( sBuckets, sender );
+            if ( NULL != bucket )
+                return bucket;
+        }
+    }
+
+    bucket = g_new0( RateBucket, 1 );
+    bucket->service = g_strdup( service ? service : "" );
+    bucket->tokens = RATE_BURST;
+    bucket->lastRefill = now;
+    g_hash_table_insert( sBuckets, g_strdup( sender ), bucket );
+    return bucket;
+}
+
+RateLimitVerdict
+RateLimitCheck( LSMessage* message )
+{
+    const char* sender = LSMessageGetSender( message );
+    gint64 now = g_get_monotonic_time();
+
+    RateBucket* bucket = lookup_bucket( sender ? sender : "", LSMessageGetSenderServiceName( message ), now );
+
+    bucket->tokens += (gdouble)(now - bucket->lastRefill) * RATE_PER_SECOND / G_USEC_PER_SEC;
+    if ( bucket->tokens > RATE_BURST )
+        bucket->tokens = RATE_BURST;
+    bucket->lastRefill = now;
+
+    if ( bucket->tokens >= 1 ) {
+        bucket->tokens -= 1;
+        bucket->allowed++;
+        return RATE_LIMIT_ALLOW;
+    }
+
+    /* rejected requests still cost a token, so a flood never gets through */
+    if ( bucket->tokens > -RATE_BURST ) {
+        bucket->tokens -= 1;
+        bucket->throttled++;
+        return RATE_LIMIT_THROTTLE;
+    }
+
+    bucket->dropped++;
+    return RATE_LIMIT_DROP;
+}
+
+#ifdef STORAGED_BENCH
+static void
+refill_bucket( gpointer key, gpointer value, gpointer data )
+{
+    ((RateBucket*)value)->tokens = RATE_BURST;
+}
+
+void
+RateLimitRefill( void )
+{
+    if ( NULL != sBuckets )
+        g_hash_table_foreach( sBuckets, refill_bucket, NULL );
+}
+#endif
+
+static void
+append_bucket( gpointer key, gpointer value, gpointer data )
+{
+    GString* out = data;
+    RateBucket* bucket = value;
+    const char* sep = (out->str[ out->len - 1 ] == '[') ? "" : ", ";
+
+    g_string_append_printf( out, "%s{\"sender\":\"%s\", \"service\":\"%s\", \"allowed\":%" G_GUINT64_FORMAT
+                            ", \"throttled\":%" G_GUINT64_FORMAT ", \"dropped\":%" G_GUINT64_FORMAT "}",
+                            sep, (const char*)key, bucket->service,
+                            bucket->allowed, bucket->throttled, bucket->dropped );
+}
+
+void
+RateLimitAppendStats( GString* out )
+{
+    g_string_append( out, "\"clients\":[" );
+    if ( NULL != sBuckets )
+        g_hash_table_foreach( sBuckets, append_bucket, out );
+    g_string_append( out, "]" );
+}
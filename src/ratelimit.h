@@ -0,0 +1,56 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_RATELIMIT_H__
+#define __STORAGED_RATELIMIT_H__
+
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+typedef enum
+{
+    RATE_LIMIT_ALLOW,       /* handle the request normally */
+    RATE_LIMIT_THROTTLE,    /* answer with a short error reply */
+    RATE_LIMIT_DROP,        /* don't answer at all */
+} RateLimitVerdict;
+
+/** RateLimitCheck
+ *
+ * Charge one request to the token bucket of the message's sender.  A sender
+ * that keeps calling after running out of tokens is first throttled, then,
+ * once it is a full burst in debt, dropped until its bucket refills.
+ */
+RateLimitVerdict RateLimitCheck( LSMessage* message );
+
+#ifdef STORAGED_BENCH
+/** RateLimitRefill
+ *
+ * Give every known sender a full burst again.  Only in storaged-bench, which
+ * means to measure the allowed path.
+ */
+void RateLimitRefill( void );
+#endif
+
+/** RateLimitAppendStats
+ *
+ * Append the "clients" member, with per-sender allowed, throttled and
+ * dropped counts, to a json object under construction.
+ */
+void RateLimitAppendStats( GString* out );
+
+#endif
@@ -0,0 +1,280 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "recorder.h"
+
+/* while replaying, timer ids are this plus the RecorderTimer */
+#define REPLAY_TIMER_ID_BASE 0x7fff0000
+
+static FILE* sTrace = NULL;
+static gint64 sTraceStart = 0;
+
+static bool sReplaying = false;
+static bool sReplayFound = false;
+static StoragedState sReplayState;
+
+typedef struct
+{
+    GSourceFunc function;
+    gpointer data;
+    bool armed;
+}
+ReplayTimer;
+
+static ReplayTimer sReplayTimers[ RECORDER_NUM_TIMERS ];
+
+static void
+record( RecorderType type, const void* data, gsize length )
+{
+    RecorderHeader header;
+
+    if ( NULL == sTrace )
+        return;
+
+    header.type = type;
+    header.reserved = 0;
+    header.length = (guint16)MIN( length, G_MAXUINT16 );
+    header.timestamp = g_get_monotonic_time() - sTraceStart;
+
+    if ( fwrite( &header, sizeof(header), 1, sTrace ) != 1 ||
+         fwrite( data, header.length, 1, sTrace ) != 1 ||
+         fflush( sTrace ) != 0 ) {
+        g_warning( "%s: write failed (%s), recording stopped", __func__, strerror( errno ) );
+        fclose( sTrace );
+        sTrace = NULL;
+    }
+}
+
+bool
+RecorderOpen( const char* path )
+{
+    /* storaged exits when idle; every instance appends its own session */
+    sTrace = fopen( path, "ab" );
+    if ( NULL == sTrace ) {
+        g_critical( "%s: unable to open %s: %s", __func__, path, strerror( errno ) );
+        return false;
+    }
+
+    if ( fwrite( RECORDER_MAGIC, strlen( RECORDER_MAGIC ), 1, sTrace ) != 1 ) {
+        g_critical( "%s: unable to write %s: %s", __func__, path, strerror( errno ) );
+        fclose( sTrace );
+        sTrace = NULL;
+        return false;
+    }
+
+    sTraceStart = g_get_monotonic_time();
+    g_debug( "%s: recording events to %s", __func__, path );
+    return true;
+}
+
+void
+RecorderMessage( LSMessage* message, const char* connection )
+{
+    if ( NULL == sTrace )
+        return;
+
+    const char* category = LSMessageGetCategory( message );
+    const char* method = LSMessageGetMethod( message );
+    const char* payload = LSMessageGetPayload( message );
+    GString* data = g_string_new( connection );
+
+    g_string_append_len( data, "", 1 );
+    g_string_append( data, category ? category : "" );
+    g_string_append_len( data, "", 1 );
+    g_string_append( data, method ? method : "" );
+    g_string_append_len( data, "", 1 );
+    g_string_append( data, payload ? payload : "" );
+
+    record( RECORDER_MESSAGE, data->str, data->len );
+    g_string_free( data, TRUE );
+}
+
+bool
+RecorderSnapshot( bool found, StoragedState* state )
+{
+    if ( sReplaying ) {
+        *state = sReplayState;
+        return sReplayFound;
+    }
+
+    if ( NULL != sTrace ) {
+        struct __attribute__((packed)) { gint32 found; StoragedState state; } data;
+        memset( &data, 0, sizeof(data) );
+        data.found = found;
+        if ( found )
+            data.state = *state;
+        record( RECORDER_SNAPSHOT, &data, sizeof(data) );
+    }
+    return found;
+}
+
+/*
+ * Recording backend
+ */
+static const StorageBackend* sInner = NULL;
+static StorageBackend sRecordingBackend;
+
+static bool
+recording_open( const char* arg )
+{
+    return sInner->open( arg );
+}
+
+static nyx_error_t
+recording_get_state( int* state )
+{
+    nyx_error_t ret = sInner->get_state( state );
+    gint32 data[] = { ret, *state };
+    record( RECORDER_GET_STATE, data, sizeof(data) );
+    return ret;
+}
+
+static nyx_error_t
+recording_set_mode( nyx_mass_storage_mode_t mode,
+                    nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    nyx_error_t ret = sInner->set_mode( mode, ret_status );
+    gint32 data[] = { mode, ret, *ret_status };
+    record( RECORDER_SET_MODE, data, sizeof(data) );
+    return ret;
+}
+
+static nyx_error_t
+recording_erase_partition( nyx_system_erase_type_t type )
+{
+    nyx_error_t ret = sInner->erase_partition( type );
+    gint32 data[] = { type, ret };
+    record( RECORDER_ERASE, data, sizeof(data) );
+    return ret;
+}
+
+static nyx_error_t
+recording_register_change_callback( nyx_device_callback_function_t callback,
+                                    void* context )
+{
+    return sInner->register_change_callback( callback, context );
+}
+
+const StorageBackend*
+RecorderWrapBackend( const StorageBackend* inner )
+{
+    sInner = inner;
+
+    sRecordingBackend = *inner;
+    sRecordingBackend.open = recording_open;
+    sRecordingBackend.get_state = recording_get_state;
+    sRecordingBackend.set_mode = recording_set_mode;
+    sRecordingBackend.erase_partition = recording_erase_partition;
+    sRecordingBackend.register_change_callback = recording_register_change_callback;
+
+    return &sRecordingBackend;
+}
+
+/*
+ * Timers
+ */
+typedef struct
+{
+    RecorderTimer which;
+    GSourceFunc function;
+    gpointer data;
+}
+RecordedTimeout;
+
+static gboolean
+recorded_timeout_proc( gpointer data )
+{
+    RecordedTimeout* timeout = data;
+    gint32 which = timeout->which;
+
+    record( RECORDER_TIMER, &which, sizeof(which) );
+    return timeout->function( timeout->data );
+}
+
+guint
+RecorderTimeoutAdd( RecorderTimer which, gint priority, guint interval_ms,
+                    GSourceFunc function, gpointer data )
+{
+    if ( sReplaying ) {
+        sReplayTimers[ which ].function = function;
+        sReplayTimers[ which ].data = data;
+        sReplayTimers[ which ].armed = true;
+        return REPLAY_TIMER_ID_BASE + which;
+    }
+
+    if ( NULL == sTrace )
+        return g_timeout_add_full( priority, interval_ms, function, data, NULL );
+
+    RecordedTimeout* timeout = g_new( RecordedTimeout, 1 );
+    timeout->which = which;
+    timeout->function = function;
+    timeout->data = data;
+    return g_timeout_add_full( priority, interval_ms, recorded_timeout_proc, timeout, g_free );
+}
+
+void
+RecorderTimeoutRemove( guint id )
+{
+    if ( sReplaying && id >= REPLAY_TIMER_ID_BASE && id < REPLAY_TIMER_ID_BASE + RECORDER_NUM_TIMERS ) {
+        sReplayTimers[ id - REPLAY_TIMER_ID_BASE ].armed = false;
+        return;
+    }
+
+    g_source_remove( id );
+}
+
+void
+RecorderSetReplay( void )
+{
+    sReplaying = true;
+}
+
+void
+RecorderReplaySnapshot( const void* data, gsize length )
+{
+    gint32 found;
+
+    if ( length != sizeof(found) + sizeof(sReplayState) ) {
+        g_warning( "%s: snapshot record of %" G_GSIZE_FORMAT " bytes, ignored", __func__, length );
+        return;
+    }
+    memcpy( &found, data, sizeof(found) );
+    memcpy( &sReplayState, (const char*)data + sizeof(found), sizeof(sReplayState) );
+    sReplayFound = found;
+}
+
+bool
+RecorderFireTimer( RecorderTimer which )
+{
+    ReplayTimer* timer = &sReplayTimers[ which ];
+
+    if ( !timer->armed )
+        return false;
+
+    /* like a GSource, a timer proc returning false disarms itself */
+    timer->armed = false;
+    if ( timer->function( timer->data ) )
+        timer->armed = true;
+    return true;
+}
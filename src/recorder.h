@@ -0,0 +1,130 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_RECORDER_H__
+#define __STORAGED_RECORDER_H__
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "backend.h"
+#include "state.h"
+
+/*
+ * Event recorder.  When a trace file is open, every inbound luna message,
+ * every storage backend result and every storaged timer firing is appended
+ * to it, so that storaged-replay can feed the same sequence back later.
+ *
+ * A trace is one or more sessions, one per storaged instance, each the 8
+ * bytes RECORDER_MAGIC followed by records, each a RecorderHeader (native
+ * byte order) and "length" bytes of data:
+ *
+ *   RECORDER_MESSAGE    "connection\0category\0method\0payload"
+ *   RECORDER_GET_STATE  gint32 error, gint32 state
+ *   RECORDER_SET_MODE   gint32 mode, gint32 error, gint32 return code
+ *   RECORDER_ERASE      gint32 type, gint32 error
+ *   RECORDER_TIMER      gint32 timer (a RecorderTimer)
+ *   RECORDER_SNAPSHOT   gint32 found, StoragedState (the snapshot the
+ *                       instance started from)
+ */
+
+#define RECORDER_MAGIC "STGDTRC1"
+
+typedef enum
+{
+    RECORDER_MESSAGE = 1,
+    RECORDER_GET_STATE,
+    RECORDER_SET_MODE,
+    RECORDER_ERASE,
+    RECORDER_TIMER,
+    RECORDER_SNAPSHOT,
+} RecorderType;
+
+typedef struct __attribute__((packed))
+{
+    guint8 type;            /* RecorderType */
+    guint8 reserved;
+    guint16 length;         /* of the data that follows */
+    gint64 timestamp;       /* microseconds since the trace was opened */
+}
+RecorderHeader;
+
+typedef enum
+{
+    RECORDER_TIMER_UMOUNT,      /* end of the MSM unmount grace period */
+    RECORDER_TIMER_LIFETIME,    /* idle exit */
+    RECORDER_TIMER_RECONCILE,   /* deferred startup reconciliation */
+    RECORDER_TIMER_RESUME,      /* next tier of the staggered resume */
+    RECORDER_TIMER_MOUNT,       /* switch to the steady mount profile */
+    RECORDER_NUM_TIMERS
+} RecorderTimer;
+
+/** RecorderOpen
+ *
+ * Start a new session at the end of path.  Returns false on failure.
+ */
+bool RecorderOpen( const char* path );
+
+/** RecorderWrapBackend
+ *
+ * Return a backend that forwards to "inner" and records its results.
+ */
+const StorageBackend* RecorderWrapBackend( const StorageBackend* inner );
+
+/** RecorderMessage
+ *
+ * Record a message about to be handled on the named connection.
+ */
+void RecorderMessage( LSMessage* message, const char* connection );
+
+/** RecorderSnapshot
+ *
+ * Record the state snapshot storaged starts from, found or not.  While
+ * replaying, the recorded one (see RecorderReplaySnapshot) replaces it.
+ *
+ * @return whether there is a snapshot in state
+ */
+bool RecorderSnapshot( bool found, StoragedState* state );
+
+/** RecorderTimeoutAdd, RecorderTimeoutRemove
+ *
+ * Arm and disarm a storaged timer.  Behave like g_timeout_add_full and
+ * g_source_remove, except that a firing is recorded and that, while
+ * replaying, timers don't run off the clock but only via RecorderFireTimer.
+ */
+guint RecorderTimeoutAdd( RecorderTimer which, gint priority, guint interval_ms,
+                          GSourceFunc function, gpointer data );
+void RecorderTimeoutRemove( guint id );
+
+/** RecorderSetReplay, RecorderFireTimer
+ *
+ * For storaged-replay: take timers off the clock, and fire one (if it is
+ * armed) when the trace says it fired.  Returns false if it wasn't armed.
+ */
+void RecorderSetReplay( void );
+bool RecorderFireTimer( RecorderTimer which );
+
+/** RecorderReplaySnapshot
+ *
+ * For storaged-replay: the data of the session's RECORDER_SNAPSHOT record,
+ * for RecorderSnapshot to hand back.
+ */
+void RecorderReplaySnapshot( const void* data, gsize length );
+
+#endif
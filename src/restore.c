@@ -0,0 +1,580 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <linux/falloc.h>
+#include <linux/fs.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <glib.h>
+
+#include "restore.h"
+#include "jobs.h"
+#include "lifetime.h"
+#include "metrics.h"
+#include "util.h"
+
+#define RESTORE_GROUP       "restore"
+#define RESTORE_CHUNK       (1024 * 1024)
+
+typedef struct
+{
+    gchar* source;
+    gchar* dest;
+    gint64 size;
+}
+CopyItem;
+
+typedef struct
+{
+    gint files;
+    gint failures;
+    gint64 bytes;
+    gint64 cpuUs;               /* the pool threads' usage */
+    gint64 readBytes;
+    gint64 writeBytes;
+    GMutex lock;                /* for bytes and usage */
+}
+CopyRun;
+
+typedef struct
+{
+    gchar* mountpoint;
+    RestoreDoneFunc done;
+    gpointer data;
+    gint64 start;               /* see MetricsNow() */
+    gint64 wallStart;
+
+    /* written by the thread */
+    RestoreResult result;
+    const char* method;
+    gchar* image;
+    guint64 files;
+    gint64 bytes;
+    gint64 holeBytes;
+    JobThread usage;
+    gint64 copyCpuUs;           /* the copy threads', added to usage */
+    gint64 copyReadBytes;
+    gint64 copyWriteBytes;
+}
+RestoreJob;
+
+static gchar** sImages = NULL;
+static gchar* sContentDir = NULL;
+static gint sThreads = 4;
+
+static GThread* sThread = NULL;         /* to be joined, main thread only */
+
+/* main thread only */
+static guint64 sRuns = 0;
+static guint64 sFallbacks = 0;          /* times customization had to do it */
+static guint64 sUnmounted = 0;          /* times an image was left half written */
+static const char* sLastMethod = "none";
+static gchar* sLastImage = NULL;
+static guint64 sLastFiles = 0;
+static gint64 sLastBytes = 0;
+static gint64 sLastHoleBytes = 0;
+static gint64 sLastUs = 0;
+
+void
+RestoreLoadConfig( const char* path )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    GError* error = NULL;
+
+    if ( g_key_file_load_from_file( keyFile, path, G_KEY_FILE_NONE, NULL ) ) {
+        sImages = g_key_file_get_string_list( keyFile, RESTORE_GROUP, "images", NULL, NULL );
+        sContentDir = g_key_file_get_string( keyFile, RESTORE_GROUP, "content", NULL );
+        if ( sContentDir && !*sContentDir ) {
+            g_free( sContentDir );
+            sContentDir = NULL;
+        }
+
+        gint threads = g_key_file_get_integer( keyFile, RESTORE_GROUP, "threads", &error );
+        if ( NULL == error && threads > 0 )
+            sThreads = threads;
+        g_clear_error( &error );
+    }
+    g_key_file_free( keyFile );
+}
+
+/**
+ * @brief the mount table entry for mountpoint: device, type and options,
+ * each to be freed, or false if it isn't mounted from a device
+ */
+static bool
+find_mount( const char* mountpoint, gchar** device, gchar** type, gchar** options )
+{
+    struct mntent* ent;
+    FILE* mounts = setmntent( "/proc/self/mounts", "r" );
+    bool found = false;
+
+    if ( NULL == mounts )
+        return false;
+    while ( !found && NULL != (ent = getmntent( mounts )) ) {
+        if ( !strcmp( ent->mnt_dir, mountpoint ) && g_str_has_prefix( ent->mnt_fsname, "/dev/" ) ) {
+            *device = g_strdup( ent->mnt_fsname );
+            *type = g_strdup( ent->mnt_type );
+            *options = g_strdup( ent->mnt_opts );
+            found = true;
+        }
+    }
+    endmntent( mounts );
+    return found;
+}
+
+/**
+ * @brief the first configured image the size of device, or NULL
+ */
+static const char*
+match_image( const char* device )
+{
+    guint64 deviceSize = 0;
+    gchar** image;
+    int fd = open( device, O_RDONLY | O_CLOEXEC );
+
+    if ( fd < 0 )
+        return NULL;
+    if ( 0 != ioctl( fd, BLKGETSIZE64, &deviceSize ) )
+        deviceSize = 0;
+    close( fd );
+
+    for ( image = sImages; deviceSize && image && *image; image++ ) {
+        struct stat st;
+        if ( 0 == stat( *image, &st ) && S_ISREG( st.st_mode ) && (guint64)st.st_size == deviceSize )
+            return *image;
+    }
+    return NULL;
+}
+
+/**
+ * @brief make a range of the device read back as zeroes, by discarding it if
+ * the device can and by writing zeroes otherwise
+ */
+static bool
+zero_range( int fd, off_t offset, off_t length, char* buffer )
+{
+    guint64 range[2] = { offset, length };
+
+    /* on a block device punching a hole is a discard that guarantees zeroes */
+    if ( 0 == fallocate( fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, offset, length ) )
+        return true;
+    if ( 0 == ioctl( fd, BLKZEROOUT, range ) )
+        return true;
+
+    memset( buffer, 0, RESTORE_CHUNK );
+    while ( length > 0 ) {
+        ssize_t n = pwrite( fd, buffer, MIN( length, RESTORE_CHUNK ), offset );
+        if ( n <= 0 )
+            return false;
+        offset += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool
+copy_range( int in, int out, off_t offset, off_t end, char* buffer )
+{
+    while ( offset < end ) {
+        ssize_t n = pread( in, buffer, MIN( end - offset, RESTORE_CHUNK ), offset );
+        if ( n <= 0 || pwrite( out, buffer, n, offset ) != n )
+            return false;
+        offset += n;
+    }
+    return true;
+}
+
+/**
+ * @brief write image to device, extent by extent
+ */
+static bool
+write_image( RestoreJob* job, const char* device )
+{
+    const char* image = job->image;
+    int in = open( image, O_RDONLY | O_CLOEXEC );
+    /* exclusive: fails if anything still has the partition mounted */
+    int out = open( device, O_WRONLY | O_EXCL | O_CLOEXEC );
+    char* buffer = g_malloc( RESTORE_CHUNK );
+    off_t size = in >= 0 ? lseek( in, 0, SEEK_END ) : -1;
+    off_t pos = 0;
+    bool ok = in >= 0 && out >= 0 && size > 0;
+
+    while ( ok && pos < size ) {
+        off_t data = lseek( in, pos, SEEK_DATA );
+        off_t hole;
+
+        if ( data < 0 )
+            data = (ENXIO == errno) ? size : pos;   /* no more data, or no SEEK_DATA */
+        if ( data > pos ) {
+            ok = zero_range( out, pos, data - pos, buffer );
+            job->holeBytes += data - pos;
+        }
+        if ( !ok || data >= size )
+            break;
+
+        hole = lseek( in, data, SEEK_HOLE );
+        if ( hole < 0 )
+            hole = size;
+        ok = copy_range( in, out, data, hole, buffer );
+        job->bytes += hole - data;
+        pos = hole;
+    }
+    if ( ok )
+        ok = 0 == fsync( out );
+
+    if ( !ok )
+        g_critical( "%s: writing %s to %s failed: %s", __func__, image, device, strerror( errno ) );
+    g_free( buffer );
+    if ( out >= 0 )
+        close( out );
+    if ( in >= 0 )
+        close( in );
+    return ok;
+}
+
+static bool
+mount_device( const char* device, const char* type, const char* options, const char* mountpoint )
+{
+    const char* argv[] = { "mount", "-t", type, "-o", options, device, mountpoint, NULL };
+    GError* error = NULL;
+    int status = 0;
+
+    if ( !g_spawn_sync( NULL, (gchar**)argv, NULL,
+                        G_SPAWN_SEARCH_PATH | G_SPAWN_STDOUT_TO_DEV_NULL | G_SPAWN_STDERR_TO_DEV_NULL,
+                        NULL, NULL, NULL, NULL, &status, &error ) ) {
+        g_critical( "%s: %s", __func__, error->message );
+        g_error_free( error );
+        return false;
+    }
+    return WIFEXITED( status ) && 0 == WEXITSTATUS( status );
+}
+
+/**
+ * @brief unmount the empty partition, write the image over it and mount it
+ * again.  An image that failed part way is no filesystem to mount, let
+ * alone copy into, so the partition is then left unmounted.
+ */
+static RestoreResult
+restore_image( RestoreJob* job, const char* device, const char* type, const char* options )
+{
+    if ( 0 != umount2( job->mountpoint, 0 ) ) {
+        g_warning( "%s: can't unmount %s: %s", __func__, job->mountpoint, strerror( errno ) );
+        return RESTORE_FAILED;
+    }
+    if ( !write_image( job, device ) ) {
+        g_critical( "%s: %s is torn, leaving %s unmounted", __func__, device, job->mountpoint );
+        return RESTORE_UNMOUNTED;
+    }
+    if ( !mount_device( device, type, options, job->mountpoint ) ) {
+        g_critical( "%s: can't mount %s on %s again", __func__, device, job->mountpoint );
+        return RESTORE_UNMOUNTED;
+    }
+    return RESTORE_DONE;
+}
+
+static void
+copy_file( gpointer data, gpointer user_data )
+{
+    CopyItem* item = data;
+    CopyRun* run = user_data;
+    JobThread usage;
+
+    JobThreadBegin( &usage, JOB_RESTORE );
+
+    int in = open( item->source, O_RDONLY | O_CLOEXEC );
+    int out = open( item->dest, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    gint64 copied = 0;
+    bool ok = in >= 0 && out >= 0;
+
+    /* copy_file_range lets the kernel move the data; across filesystems it
+     * may refuse, so finish with read and write */
+    while ( ok && copied < item->size ) {
+        ssize_t n = copy_file_range( in, NULL, out, NULL, item->size - copied, 0 );
+        if ( n <= 0 )
+            break;
+        copied += n;
+    }
+    if ( ok && copied < item->size ) {
+        char* buffer = g_malloc( RESTORE_CHUNK );
+        ssize_t n;
+        while ( ok && (n = read( in, buffer, RESTORE_CHUNK )) > 0 ) {
+            ok = write( out, buffer, n ) == n;
+            copied += n;
+        }
+        g_free( buffer );
+    }
+
+    if ( in >= 0 )
+        close( in );
+    if ( out >= 0 && 0 != close( out ) )
+        ok = false;
+
+    JobThreadEnd( &usage );
+    g_mutex_lock( &run->lock );
+    run->cpuUs += usage.cpuUs;
+    run->readBytes += usage.readBytes;
+    run->writeBytes += usage.writeBytes;
+    if ( ok ) {
+        run->files++;
+        run->bytes += copied;
+    } else {
+        run->failures++;
+    }
+    g_mutex_unlock( &run->lock );
+    if ( !ok )
+        g_warning( "%s: couldn't copy %s to %s", __func__, item->source, item->dest );
+    g_free( item->source );
+    g_free( item->dest );
+    g_free( item );
+}
+
+/**
+ * @brief create source's directories under dest, and list its files
+ */
+static bool
+collect_files( const char* source, const char* dest, GPtrArray* items )
+{
+    GDir* dir = g_dir_open( source, 0, NULL );
+    const gchar* name;
+    bool ok = true;
+
+    if ( NULL == dir || (0 != mkdir( dest, 0755 ) && EEXIST != errno) ) {
+        if ( dir )
+            g_dir_close( dir );
+        return false;
+    }
+
+    while ( ok && NULL != (name = g_dir_read_name( dir )) ) {
+        gchar* from = g_build_filename( source, name, NULL );
+        gchar* to = g_build_filename( dest, name, NULL );
+        struct stat st;
+
+        if ( 0 != lstat( from, &st ) ) {
+            ok = false;
+        } else if ( S_ISDIR( st.st_mode ) ) {
+            ok = collect_files( from, to, items );
+        } else if ( S_ISREG( st.st_mode ) ) {
+            CopyItem* item = g_new( CopyItem, 1 );
+            item->source = from;
+            item->dest = to;
+            item->size = st.st_size;
+            g_ptr_array_add( items, item );
+            continue;
+        }
+        g_free( from );
+        g_free( to );
+    }
+    g_dir_close( dir );
+    return ok;
+}
+
+static gint
+larger_first( gconstpointer a, gconstpointer b )
+{
+    const CopyItem* left = *(const CopyItem**)a;
+    const CopyItem* right = *(const CopyItem**)b;
+    return (left->size < right->size) - (left->size > right->size);
+}
+
+static bool
+restore_content( RestoreJob* job )
+{
+    const char* mountpoint = job->mountpoint;
+    GPtrArray* items = g_ptr_array_new();
+    CopyRun run;
+    bool ok = collect_files( sContentDir, mountpoint, items );
+    guint i;
+
+    memset( &run, 0, sizeof(run) );
+    g_mutex_init( &run.lock );
+
+    if ( ok ) {
+        /* the big files take longest; start them first so the threads finish together */
+        g_ptr_array_sort( items, larger_first );
+        GThreadPool* pool = g_thread_pool_new( copy_file, &run, sThreads, FALSE, NULL );
+        for ( i = 0; i < items->len; i++ )
+            g_thread_pool_push( pool, g_ptr_array_index( items, i ), NULL );
+        g_thread_pool_free( pool, FALSE, TRUE );
+
+        int fd = open( mountpoint, O_RDONLY | O_DIRECTORY | O_CLOEXEC );
+        if ( fd < 0 || 0 != syncfs( fd ) )
+            g_warning( "%s: syncfs %s failed", __func__, mountpoint );
+        if ( fd >= 0 )
+            close( fd );
+    } else {
+        g_warning( "%s: couldn't walk %s", __func__, sContentDir );
+        for ( i = 0; i < items->len; i++ ) {
+            CopyItem* item = g_ptr_array_index( items, i );
+            g_free( item->source );
+            g_free( item->dest );
+            g_free( item );
+        }
+    }
+    g_ptr_array_free( items, TRUE );
+    g_mutex_clear( &run.lock );
+
+    job->files = run.files;
+    job->bytes = run.bytes;
+    job->copyCpuUs = run.cpuUs;
+    job->copyReadBytes = run.readBytes;
+    job->copyWriteBytes = run.writeBytes;
+    job->holeBytes = 0;
+    return ok && 0 == run.failures;
+}
+
+static gboolean restore_done( gpointer data );
+
+static gpointer
+restore_thread( gpointer data )
+{
+    RestoreJob* job = data;
+    gchar* device = NULL;
+    gchar* type = NULL;
+    gchar* options = NULL;
+    const char* image = NULL;
+
+    /* the main loop goes on with other jobs meanwhile; only this thread
+     * (and the copy threads it starts) run as the restore */
+    JobThreadBegin( &job->usage, JOB_RESTORE );
+
+    job->result = RESTORE_FAILED;
+    if ( sImages && find_mount( job->mountpoint, &device, &type, &options ) )
+        image = match_image( device );
+    if ( image ) {
+        job->method = "image";
+        job->image = g_strdup( image );
+        job->result = restore_image( job, device, type, options );
+    }
+    if ( RESTORE_FAILED == job->result && sContentDir ) {
+        job->method = "copy";
+        if ( restore_content( job ) )
+            job->result = RESTORE_DONE;
+    }
+
+    g_free( options );
+    g_free( type );
+    g_free( device );
+
+    JobThreadEnd( &job->usage );
+    job->usage.cpuUs += job->copyCpuUs;
+    job->usage.readBytes += job->copyReadBytes;
+    job->usage.writeBytes += job->copyWriteBytes;
+    g_idle_add( restore_done, NULL );
+    return job;
+}
+
+/**
+ * @brief join the thread, if there is one, account for its run and tell
+ * the caller
+ */
+static void
+restore_reap( void )
+{
+    RestoreJob* job;
+
+    if ( NULL == sThread )
+        return;
+    job = g_thread_join( sThread );
+    sThread = NULL;
+
+    JobThreadAccount( &job->usage );
+    sLastUs = g_get_monotonic_time() - job->wallStart;
+    MetricsRecord( METRIC_RESTORE, job->start );
+
+    g_free( sLastImage );
+    sLastImage = job->image;
+    sLastMethod = job->method;
+    sLastFiles = job->files;
+    sLastBytes = job->bytes;
+    sLastHoleBytes = job->holeBytes;
+    if ( RESTORE_UNMOUNTED == job->result ) {
+        sUnmounted++;
+    } else if ( RESTORE_FAILED == job->result ) {
+        sLastMethod = "none";
+        sFallbacks++;
+    }
+    g_debug( "%s: %s %s in %" G_GINT64_FORMAT "ms", __func__, sLastMethod,
+             RESTORE_DONE == job->result ? "restored" : "failed", sLastUs / 1000 );
+
+    job->done( job->result, job->data );
+    LifetimeRelease();
+
+    g_free( job->mountpoint );
+    g_free( job );
+}
+
+static gboolean
+restore_done( gpointer data )
+{
+    restore_reap();
+    return FALSE;
+}
+
+void
+RestoreStart( const char* mountpoint, RestoreDoneFunc done, gpointer data )
+{
+    RestoreJob* job;
+
+    restore_reap();
+    if ( NULL == sImages && NULL == sContentDir ) {
+        sFallbacks++;
+        done( RESTORE_FAILED, data );
+        return;
+    }
+
+    job = g_new0( RestoreJob, 1 );
+    job->mountpoint = g_strdup( mountpoint );
+    job->done = done;
+    job->data = data;
+    job->method = "none";
+    job->start = MetricsNow();
+    job->wallStart = g_get_monotonic_time();
+
+    LifetimeHold();
+    sRuns++;
+    sThread = g_thread_new( "restore", restore_thread, job );
+}
+
+void
+RestoreWait( void )
+{
+    restore_reap();
+}
+
+void
+RestoreAppendStats( GString* out )
+{
+    g_string_append_printf( out, "\"restore\":{\"runs\":%" G_GUINT64_FORMAT ", \"fallbacks\":%" G_GUINT64_FORMAT
+                            ", \"unmounted\":%" G_GUINT64_FORMAT ", \"lastMethod\":\"%s\"",
+                            sRuns, sFallbacks, sUnmounted, sLastMethod );
+    if ( sLastImage )
+        g_string_append_printf( out, ", \"lastImage\":\"%s\"", sLastImage );
+    g_string_append_printf( out, ", \"files\":%" G_GUINT64_FORMAT ", \"bytes\":%" G_GINT64_FORMAT
+                            ", \"holeBytes\":%" G_GINT64_FORMAT ", \"lastMs\":%" G_GINT64_FORMAT "}",
+                            sLastFiles, sLastBytes, sLastHoleBytes, sLastUs / 1000 );
+}
@@ -0,0 +1,81 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_RESTORE_H__
+#define __STORAGED_RESTORE_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+/*
+ * Repopulating the partition after a reformat.  Rather than having
+ * customization copy the default content back file by file, storaged
+ * writes a prebuilt filesystem image of the partition straight to the
+ * device: the image's data extents are copied and its holes are discarded.
+ * When no image matches the device, the default content directory is
+ * copied in by a pool of threads with copy_file_range, largest files first.
+ *
+ * In storaged.conf:
+ *
+ *   [restore]
+ *   images=/usr/share/storaged/media-8g.img;/usr/share/storaged/media-16g.img
+ *   content=/usr/share/storaged/media
+ *   threads=4
+ */
+
+/** RestoreLoadConfig
+ *
+ * Read the images and content directory from the given key file, if it
+ * exists.  Without either, nothing is restored.
+ */
+void RestoreLoadConfig( const char* path );
+
+typedef enum
+{
+    RESTORE_DONE,           /* the default content is back */
+    RESTORE_FAILED,         /* nothing to restore from, or it failed: fall
+                               back to customization's copyBinaries */
+    RESTORE_UNMOUNTED       /* writing an image failed part way; the
+                               partition is left unmounted */
+} RestoreResult;
+
+typedef void (*RestoreDoneFunc)( RestoreResult result, gpointer data );
+
+/** RestoreStart
+ *
+ * Start putting the default content back on the freshly formatted partition
+ * mounted on mountpoint, on a thread, keeping storaged running meanwhile.
+ * done is called on the main loop once it's finished, or straight away if
+ * there's nothing to restore from.
+ */
+void RestoreStart( const char* mountpoint, RestoreDoneFunc done, gpointer data );
+
+/** RestoreWait
+ *
+ * Wait for a restore still running, and call its done function.  Call
+ * before the partition is unmounted again.
+ */
+void RestoreWait( void );
+
+/** RestoreAppendStats
+ *
+ * Append the "restore" member to a json object under construction.
+ */
+void RestoreAppendStats( GString* out );
+
+#endif
@@ -0,0 +1,290 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <string.h>
+#include <glib.h>
+
+#include "resume.h"
+#include "metrics.h"
+#include "recorder.h"
+#include "signals.h"
+
+#define RESUME_GROUP "resume"
+
+static const char* sTierNames[ RESUME_NUM_TIERS ] = { "ui", "media", "background" };
+
+/* how long a tier waits, at most, for the one before it to settle */
+static guint sDelayMs[ RESUME_NUM_TIERS ] = { 0, 1500, 5000 };
+
+typedef struct
+{
+    ResumeTier tier;
+    bool resumed;               /* in the current round */
+    gint64 lastUs;              /* since its tier was released; -1 if late */
+    gint64 maxUs;
+    guint64 resumes;
+    guint64 late;
+}
+ResumeClient;
+
+static GHashTable* sClients = NULL;     /* name -> ResumeClient */
+
+static gchar* sMountPoint = NULL;       /* non-NULL while a round is in progress */
+static int sReleased = -1;              /* latest tier released */
+static gint64 sRoundStart = 0;          /* MetricsNow() when PartitionAvail went out */
+static gint64 sTierStart = 0;           /* ... and when the latest tier was released */
+static guint sPending = 0;              /* clients of that tier that haven't resumed */
+static bool sWaited = false;            /* that tier had clients to wait for */
+static guint sTimerId = 0;
+
+static gint64 sLastInteractiveUs = 0;
+static gint64 sLastTotalUs = 0;
+
+static void release_next_tier( void );
+
+static const char*
+client_name( LSMessage* message )
+{
+    const char* name = LSMessageGetSenderServiceName( message );
+    if ( NULL == name )
+        name = LSMessageGetSender( message );
+    return name ? name : "";
+}
+
+void
+ResumeLoadConfig( const char* path )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    int tier;
+
+    if ( g_key_file_load_from_file( keyFile, path, G_KEY_FILE_NONE, NULL ) ) {
+        for ( tier = RESUME_TIER_MEDIA; tier < RESUME_NUM_TIERS; tier++ ) {
+            gchar* key = g_strconcat( sTierNames[tier], "DelayMs", NULL );
+            GError* error = NULL;
+            gint delay = g_key_file_get_integer( keyFile, RESUME_GROUP, key, &error );
+            if ( NULL == error && delay >= 0 )
+                sDelayMs[tier] = delay;
+            g_clear_error( &error );
+            g_free( key );
+        }
+    }
+    g_key_file_free( keyFile );
+}
+
+bool
+ResumeRegister( LSMessage* message, const char* tierName )
+{
+    int tier;
+
+    for ( tier = 0; tier < RESUME_NUM_TIERS; tier++ ) {
+        if ( tierName && !strcmp( tierName, sTierNames[tier] ) )
+            break;
+    }
+    if ( tier == RESUME_NUM_TIERS )
+        return false;
+
+    if ( NULL == sClients )
+        sClients = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+
+    const char* name = client_name( message );
+    ResumeClient* client = g_hash_table_lookup( sClients, name );
+    if ( NULL == client ) {
+        client = g_new0( ResumeClient, 1 );
+        client->resumed = true;         /* not waited for until the next round */
+        client->lastUs = -1;
+        g_hash_table_insert( sClients, g_strdup( name ), client );
+    }
+    client->tier = tier;
+    g_debug( "%s: %s in tier %s", __func__, name, sTierNames[tier] );
+    return true;
+}
+
+bool
+ResumeUnregister( LSMessage* message )
+{
+    const char* name = client_name( message );
+    ResumeClient* client = sClients ? g_hash_table_lookup( sClients, name ) : NULL;
+
+    if ( NULL == client )
+        return false;
+
+    bool wasPending = sMountPoint && (int)client->tier == sReleased && !client->resumed;
+    g_hash_table_remove( sClients, name );
+    if ( wasPending && 0 == --sPending )
+        release_next_tier();
+    return true;
+}
+
+static void
+start_tier( gpointer key, gpointer value, gpointer data )
+{
+    ResumeClient* client = value;
+
+    if ( (int)client->tier == sReleased ) {
+        client->resumed = false;
+        sPending++;
+    }
+}
+
+static void
+count_late( gpointer key, gpointer value, gpointer data )
+{
+    ResumeClient* client = value;
+
+    if ( (int)client->tier == sReleased && !client->resumed ) {
+        client->resumed = true;
+        client->lastUs = -1;
+        client->late++;
+        g_message( "%s: %s hadn't resumed when the %s tier's time was up", __func__,
+                   (const char*)key, sTierNames[ sReleased ] );
+    }
+}
+
+static gboolean
+tier_timer_proc( gpointer data )
+{
+    sTimerId = 0;
+    if ( sClients )
+        g_hash_table_foreach( sClients, count_late, NULL );
+    release_next_tier();
+    return FALSE;
+}
+
+/**
+ * @brief the tier last released has settled (or run out of time): note the
+ * time to interactive if it was the ui tier, and release the next one
+ */
+static void
+release_next_tier( void )
+{
+    if ( sTimerId ) {
+        RecorderTimeoutRemove( sTimerId );
+        sTimerId = 0;
+    }
+
+    /* with no ui clients there was nothing to wait for: not a sample */
+    if ( RESUME_TIER_UI == sReleased && sWaited ) {
+        sLastInteractiveUs = MetricsNow() - sRoundStart;
+        MetricsRecord( METRIC_INTERACTIVE, sRoundStart );
+    }
+
+    /* the last tier has nothing after it to hold up; its clients are only
+       waited for (as long as its own delay) for the sake of the stats */
+    if ( ++sReleased >= RESUME_NUM_TIERS ) {
+        g_free( sMountPoint );
+        sMountPoint = NULL;
+        return;
+    }
+
+    if ( sReleased > RESUME_TIER_UI )
+        SignalPartitionResume( sMountPoint, sTierNames[ sReleased ] );
+    if ( RESUME_TIER_BACKGROUND == sReleased ) {
+        sLastTotalUs = MetricsNow() - sRoundStart;
+        MetricsRecord( METRIC_RESUME, sRoundStart );
+    }
+
+    sTierStart = MetricsNow();
+    sPending = 0;
+    if ( sClients )
+        g_hash_table_foreach( sClients, start_tier, NULL );
+
+    sWaited = sPending > 0;
+    if ( 0 == sPending ) {
+        release_next_tier();
+    } else {
+        guint delay = sDelayMs[ MIN( sReleased + 1, RESUME_TIER_BACKGROUND ) ];
+        sTimerId = RecorderTimeoutAdd( RECORDER_TIMER_RESUME, G_PRIORITY_DEFAULT,
+                                       delay, tier_timer_proc, NULL );
+    }
+}
+
+void
+ResumeBegin( const char* mountPoint )
+{
+    if ( sMountPoint )
+        ResumeEnd();
+
+    sMountPoint = g_strdup( mountPoint );
+    sRoundStart = MetricsNow();
+    sReleased = RESUME_TIER_UI - 1;
+    release_next_tier();
+}
+
+void
+ResumeResumed( LSMessage* message )
+{
+    const char* name = client_name( message );
+    ResumeClient* client = sClients ? g_hash_table_lookup( sClients, name ) : NULL;
+
+    if ( NULL == client || client->resumed || NULL == sMountPoint || (int)client->tier != sReleased )
+        return;
+
+    client->resumed = true;
+    client->resumes++;
+    client->lastUs = MetricsNow() - sTierStart;
+    client->maxUs = MAX( client->maxUs, client->lastUs );
+    g_debug( "%s: %s after %" G_GINT64_FORMAT " us", __func__, name, client->lastUs );
+
+    if ( 0 == --sPending )
+        release_next_tier();
+}
+
+void
+ResumeEnd( void )
+{
+    if ( NULL == sMountPoint )
+        return;
+
+    /* abandon the round: the tiers still held back mustn't be told to
+       reopen files on a partition that is about to go away */
+    if ( sTimerId ) {
+        RecorderTimeoutRemove( sTimerId );
+        sTimerId = 0;
+    }
+    if ( sClients )
+        g_hash_table_foreach( sClients, count_late, NULL );
+    g_free( sMountPoint );
+    sMountPoint = NULL;
+}
+
+static void
+append_client( gpointer key, gpointer value, gpointer data )
+{
+    GString* out = data;
+    ResumeClient* client = value;
+    const char* sep = (out->str[ out->len - 1 ] == '[') ? "" : ", ";
+
+    g_string_append_printf( out, "%s{\"name\":\"%s\", \"class\":\"%s\", \"resumed\":%" G_GUINT64_FORMAT
+                            ", \"late\":%" G_GUINT64_FORMAT ", \"maxMs\":%" G_GINT64_FORMAT
+                            ", \"lastMs\":%" G_GINT64_FORMAT "}",
+                            sep, (const char*)key, sTierNames[ client->tier ], client->resumes, client->late,
+                            client->maxUs / 1000, client->lastUs >= 0 ? client->lastUs / 1000 : -1 );
+}
+
+void
+ResumeAppendStats( GString* out )
+{
+    g_string_append_printf( out, "\"resume\":{\"mediaDelayMs\":%u, \"backgroundDelayMs\":%u"
+                            ", \"interactiveMs\":%" G_GINT64_FORMAT ", \"totalMs\":%" G_GINT64_FORMAT
+                            ", \"clients\":[",
+                            sDelayMs[ RESUME_TIER_MEDIA ], sDelayMs[ RESUME_TIER_BACKGROUND ],
+                            sLastInteractiveUs / 1000, sLastTotalUs / 1000 );
+    if ( sClients )
+        g_hash_table_foreach( sClients, append_client, out );
+    g_string_append( out, "]}" );
+}
@@ -0,0 +1,86 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_RESUME_H__
+#define __STORAGED_RESUME_H__
+
+#include <stdbool.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+/*
+ * Staggered resume after MSM.  Services register a class: "ui", "media" or
+ * "background".  When the partition is back, PartitionAvail releases the ui
+ * tier; each later tier is released with a PartitionResume signal once every
+ * client of the tier before it has called resumed, or once that tier's delay
+ * is up, whichever comes first.  Registered media and background clients
+ * wait for their PartitionResume rather than acting on PartitionAvail.
+ */
+
+typedef enum
+{
+    RESUME_TIER_UI,
+    RESUME_TIER_MEDIA,
+    RESUME_TIER_BACKGROUND,
+    RESUME_NUM_TIERS
+} ResumeTier;
+
+/** ResumeLoadConfig
+ *
+ * Read the tier delays from the [resume] group of the given key file, if it
+ * exists.
+ */
+void ResumeLoadConfig( const char* path );
+
+/** ResumeRegister, ResumeUnregister
+ *
+ * Add the message's sender to a tier ("ui", "media" or "background"), or
+ * remove it.
+ *
+ * @return false if the class is unknown, or the sender isn't registered
+ */
+bool ResumeRegister( LSMessage* message, const char* tier );
+bool ResumeUnregister( LSMessage* message );
+
+/** ResumeBegin
+ *
+ * PartitionAvail has just been sent for mountPoint: the ui tier is released.
+ * Release the others in turn.
+ */
+void ResumeBegin( const char* mountPoint );
+
+/** ResumeResumed
+ *
+ * Note that the message's sender has finished reopening its files.
+ */
+void ResumeResumed( LSMessage* message );
+
+/** ResumeEnd
+ *
+ * Abandon the round in progress (the partition is going away again): the
+ * tiers not yet released stay held back, and no stages are recorded.
+ */
+void ResumeEnd( void );
+
+/** ResumeAppendStats
+ *
+ * Append the "resume" member to a json object under construction.
+ */
+void ResumeAppendStats( GString* out );
+
+#endif
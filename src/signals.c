@@ -18,6 +18,7 @@
 
 #include <glib.h>
 #include <string.h>
+#include <cjson/json.h>
 
 #include "signals.h"
 #include "util.h"
@@ -28,181 +29,297 @@
 
 #define LUNA_STORAGED "luna://com.palm.storage"
 
+/* how many signals we remember for late subscribers (see handle_history) */
+#define SIGNAL_HISTORY_SIZE 64
+
+typedef struct
+{
+    guint seq;                  /* 0 means the slot is unused */
+    gint64 timestamp;           /* monotonic clock, milliseconds */
+    const char* method;
+    gchar* payload;             /* as sent on the private bus */
+    gchar* public_payload;      /* NULL if not sent on the public bus */
+}
+SignalHistoryEntry;
+
 static LSPalmService* lsps = NULL;
 
-void
-SignalMSMAvailChange( LSHandle* lsh, bool avail )
+static guint sSignalSeq = 0;
+static guint sRestoredSeq = 0;      /* signals up to this one were sent by a previous process */
+static gint64 sInstanceId = 0;
+static SignalHistoryEntry sHistory[ SIGNAL_HISTORY_SIZE ];
+
+static void
+history_add( guint seq, gint64 timestamp, const char* method,
+             gchar* payload, gchar* public_payload )
+{
+    SignalHistoryEntry* entry = &sHistory[ seq % SIGNAL_HISTORY_SIZE ];
+
+    g_free( entry->payload );
+    g_free( entry->public_payload );
+
+    entry->seq = seq;
+    entry->timestamp = timestamp;
+    entry->method = method;
+    entry->payload = payload;
+    entry->public_payload = public_payload;
+}
+
+/**
+ * @brief stamp a signal with the next sequence number and the current time,
+ * send it on the given handle (and the public bus if public_fields is not
+ * NULL) and remember it in the history ring.
+ *
+ * @param lsh            handle on which to send the private signal
+ * @param method         signal name, one of the MSM_METHOD_* strings
+ * @param fields         json members without the enclosing braces, may be ""
+ * @param public_fields  as fields, but for the public bus; NULL if the
+ *                       signal is private only
+ */
+static void
+send_signal( LSHandle* lsh, const char* method, const char* fields,
+             const char* public_fields )
 {
     LSError lserror;
     LSErrorInit( &lserror );
 
-    char* payload = g_strdup_printf( "{\"mode-avail\":%s}",
-                                     avail?"true":"false" );
+    guint seq = ++sSignalSeq;
+    gint64 timestamp = g_get_monotonic_time() / 1000;
+
+    char* payload = g_strdup_printf( "{%s%s\"seq\":%u, \"timestamp\":%" G_GINT64_FORMAT "}",
+                                     fields, *fields ? ", " : "", seq, timestamp );
+    char* public_payload = NULL;
 
-    const char* uri = LUNA_STORAGED MSM_CATEGORY "/" MSM_METHOD_AVAIL;
+    char* uri = g_strconcat( LUNA_STORAGED MSM_CATEGORY "/", method, NULL );
     g_debug( "%s: sending %s to %s", __func__, payload, uri );
+    STORAGED_TRACE2(signal__send, method, seq);
 
     if ( !LSSignalSend( lsh, uri, payload, &lserror ) ) {
         LSREPORT(lserror);
     }
 
-    g_free( payload );
+    if ( NULL != public_fields ) {
+        public_payload = g_strdup_printf( "{%s%s\"seq\":%u, \"timestamp\":%" G_GINT64_FORMAT "}",
+                                          public_fields, *public_fields ? ", " : "",
+                                          seq, timestamp );
+
+        g_debug( "%s: sending %s to public %s", __func__, public_payload, uri );
+        if ( !LSSignalSend( LSPalmServiceGetPublicConnection(lsps), uri, public_payload, &lserror ) ) {
+            LSREPORT(lserror);
+        }
+    }
+
+    g_free( uri );
+
+    /* the ring takes ownership of both payloads */
+    history_add( seq, timestamp, method, payload, public_payload );
 
     LSErrorFree( &lserror );
 }
 
 void
-SignalMSMModeChange( LSHandle* lsh, bool entering )
+SignalMSMAvailChange( LSHandle* lsh, bool avail )
 {
-    LSError lserror;
-    LSErrorInit( &lserror );
+    char* fields = g_strdup_printf( "\"mode-avail\":%s",
+                                    avail?"true":"false" );
+
+    send_signal( lsh, MSM_METHOD_AVAIL, fields, NULL );
 
+    g_free( fields );
+}
+
+void
+SignalMSMModeChange( LSHandle* lsh, bool entering )
+{
     char* modeParam = NULL;
     if ( entering ) {
         modeParam = g_strdup_printf( ", \"enterIMasq\": false");
     }
 
-    char* payload = g_strdup_printf( "{\"new-mode\":\"%s\"%s}", 
+    char* fields = g_strdup_printf( "\"new-mode\":\"%s\"%s",
 		    entering?"brick":"phone",
 		    modeParam ? modeParam : "");
 
-    const char* uri = LUNA_STORAGED MSM_CATEGORY "/" MSM_METHOD_MODE;
-    g_debug( "%s: sending %s to %s", __func__, payload, uri );
-
-    if ( !LSSignalSend( lsh, uri, payload, &lserror ) ) {
-        LSREPORT(lserror);
-    }
+    send_signal( lsh, MSM_METHOD_MODE, fields, NULL );
 
-    g_free( payload );
+    g_free( fields );
     g_free( modeParam );
-
-    LSErrorFree( &lserror );
 }
 
 void
 SignalMSMFscking( LSHandle* lsh )
 {
-    LSError lserror;
-    LSErrorInit( &lserror );
-
-
-    char* payload = "{}";
-
-    const char* uri = LUNA_STORAGED MSM_CATEGORY "/" MSM_METHOD_FSCKING;
-    g_debug( "%s: sending %s to %s", __func__, payload, uri );
-
-    if ( !LSSignalSend( lsh, uri, payload, &lserror ) ) {
-        LSREPORT(lserror);
-    }
-
-    LSErrorFree( &lserror );
+    send_signal( lsh, MSM_METHOD_FSCKING, "", NULL );
 }
 
 void
-SignalMSMProgress( LSHandle* lsh, const char* stage, bool forceRequired )
+SignalMSMProgress( LSHandle* lsh, const char* stage, bool forceRequired,
+                   const char* holders )
 {
-    LSError lserror;
-    LSErrorInit( &lserror );
-
     char* forceParam = NULL;
     char* modeParam = NULL;
+    char* holdersParam = NULL;
     if ( !strcmp(MSM_MODE_CHANGE_SUCCEEDED, stage) ) {
         forceParam = g_strdup_printf( ", \"forceRequired\": %s", 
                                       forceRequired?"true":"false" );
     }
+    if ( NULL != holders ) {
+        holdersParam = g_strdup_printf( ", \"holders\": %s", holders );
+    }
 
     modeParam = g_strdup_printf( ", \"enterIMasq\": false" );
 
-    char* payload = g_strdup_printf( "{\"stage\":\"%s\"%s%s}", stage, 
-                                     forceParam?forceParam:"",
-                                     modeParam);
-
-    const char* uri = LUNA_STORAGED MSM_CATEGORY "/" MSM_METHOD_PROGRESS;
-    g_debug( "%s: sending %s to %s", __func__, payload, uri );
+    char* fields = g_strdup_printf( "\"stage\":\"%s\"%s%s%s", stage, 
+                                    forceParam?forceParam:"",
+                                    modeParam,
+                                    holdersParam?holdersParam:"");
 
-    if ( !LSSignalSend( lsh, uri, payload, &lserror ) ) {
-        LSREPORT(lserror);
-    }
+    send_signal( lsh, MSM_METHOD_PROGRESS, fields, NULL );
 
-    g_free( payload );
+    g_free( fields );
     g_free( forceParam );
     g_free( modeParam );
-
-    LSErrorFree( &lserror );
+    g_free( holdersParam );
 }
 
 void
 SignalPartitionAvail( LSHandle* lsh, const char* mountPoint, bool avail,
                       bool reformatted, bool fsck_found_problem )
 {
-    LSError lserror;
-    LSErrorInit( &lserror );
-
-    char* payload_private = g_strdup_printf( "{\"mount_point\":\"%s\", "
-            "\"available\":%s%s%s}",
+    char* fields_private = g_strdup_printf( "\"mount_point\":\"%s\", "
+            "\"available\":%s%s%s",
             mountPoint, 
             avail?"true":"false",
             reformatted?", \"reformatted\": true":"",
             fsck_found_problem?", \"fscked\": true":"");
-    char* payload_public = g_strdup_printf( "{\"mount_point\":\"%s\", "
-            "\"available\":%s}",
+    char* fields_public = g_strdup_printf( "\"mount_point\":\"%s\", "
+            "\"available\":%s",
             mountPoint, 
             avail?"true":"false");
 
-    const char* uri = LUNA_STORAGED MSM_CATEGORY "/" MSM_METHOD_PARTAVAIL;
-    g_debug( "%s: sending %s to private %s", __func__, payload_private, uri );
+    send_signal( LSPalmServiceGetPrivateConnection(lsps), MSM_METHOD_PARTAVAIL,
+                 fields_private, fields_public );
 
-    if ( !LSSignalSend( LSPalmServiceGetPrivateConnection(lsps), uri, payload_private, &lserror ) ) {
-        LSREPORT(lserror);
-    }
+    g_free( fields_private );
+    g_free( fields_public );
+}
 
-    g_debug( "%s: sending %s to public %s", __func__, payload_public, uri );
-    if ( !LSSignalSend( LSPalmServiceGetPublicConnection(lsps), uri, payload_public, &lserror ) ) {
-        LSREPORT(lserror);
-    }
+void
+SignalPartitionResume( const char* mountPoint, const char* tier )
+{
+    char* fields = g_strdup_printf( "\"mount_point\":\"%s\", \"tier\":\"%s\"",
+                                    mountPoint, tier );
 
-    g_free( payload_private );
-    g_free( payload_public );
+    send_signal( LSPalmServiceGetPrivateConnection(lsps), MSM_METHOD_RESUME,
+                 fields, fields );
 
-    LSErrorFree( &lserror );
+    g_free( fields );
 }
 
 void
 SignalMSMStatus( LSHandle* lsh, bool inMSM)
 {
-	LSError lserror;
-	LSErrorInit( &lserror );
+	char* fields = g_strdup_printf("\"inMSM\": %s",inMSM?"true":"false");
+
+	send_signal( LSPalmServiceGetPrivateConnection(lsps), MSM_METHOD_STATUS,
+	             fields, fields );
+
+	g_free( fields);
+}
+
+/**
+ * @brief return, in one reply, every remembered signal with a sequence number
+ * greater than "since".  Callers on the public bus only see the public
+ * variants of signals that were sent there.  "complete" is false when some
+ * of the requested signals have already fallen out of the ring, in which case
+ * the caller has to fall back to querying the current state.
+ */
+static bool
+handle_history( LSHandle* lsh, LSMessage* message, void* user_data )
+{
+    LSTRACE_LSMESSAGE(message);
 
-	char* payload = g_strdup_printf("{\"inMSM\": %s}",inMSM?"true":"false");
+    LSError lserror;
+    LSErrorInit( &lserror );
 
-	const char* uri = LUNA_STORAGED MSM_CATEGORY "/" MSM_METHOD_STATUS;
-	g_debug( "%s: sending %s to private %s", __func__, payload, uri );
+    guint since = 0;
+    bool public_bus = (lsh == LSPalmServiceGetPublicConnection(lsps));
 
-	if ( !LSSignalSend( LSPalmServiceGetPrivateConnection(lsps), uri, payload, &lserror ) ) {
-			LSREPORT(lserror);
-	}
+    const char *payload = LSMessageGetPayload(message);
+    struct json_object *object = json_tokener_parse(payload);
+    if (!is_error(object)) {
+        struct json_object *sinceObj = json_object_object_get(object, "since");
+        if (sinceObj && json_object_get_int(sinceObj) > 0)
+            since = json_object_get_int(sinceObj);
+        json_object_put(object);
+    }
 
-	g_debug( "%s: sending %s to public %s", __func__, payload, uri );
-	if ( !LSSignalSend( LSPalmServiceGetPublicConnection(lsps), uri, payload, &lserror ) ) {
-			LSREPORT(lserror);
-	}
+    guint oldest = (sSignalSeq >= SIGNAL_HISTORY_SIZE) ? sSignalSeq - SIGNAL_HISTORY_SIZE + 1 : 1;
+    oldest = MAX(oldest, sRestoredSeq + 1);
+    bool complete = (since + 1 >= oldest) || (since >= sSignalSeq);
+
+    GString* reply = g_string_new( NULL );
+    g_string_append_printf( reply, "{\"returnValue\":true, \"instance\":%" G_GINT64_FORMAT
+                            ", \"lastSeq\":%u, \"complete\":%s, \"signals\":[",
+                            sInstanceId, sSignalSeq, complete ? "true" : "false" );
+
+    bool first = true;
+    guint seq;
+    for ( seq = MAX(since + 1, oldest); seq <= sSignalSeq; seq++ ) {
+        SignalHistoryEntry* entry = &sHistory[ seq % SIGNAL_HISTORY_SIZE ];
+        const char* entryPayload = public_bus ? entry->public_payload : entry->payload;
+
+        if ( entry->seq != seq || NULL == entryPayload )
+            continue;
+
+        g_string_append_printf( reply, "%s{\"seq\":%u, \"timestamp\":%" G_GINT64_FORMAT
+                                ", \"signal\":\"%s\", \"payload\":%s}",
+                                first ? "" : ", ", entry->seq, entry->timestamp,
+                                entry->method, entryPayload );
+        first = false;
+    }
+    g_string_append( reply, "]}" );
 
-	g_free( payload);
+    if ( !LSMessageReply( lsh, message, reply->str, &lserror ) ) {
+        LSREPORT( lserror );
+    }
 
-	LSErrorFree( &lserror );
-}
+    g_string_free( reply, TRUE );
+    LSErrorFree( &lserror );
+    return true;
+} /* handle_history */
 
 
+static LSMethod methods[] = {
+    { MSM_METHOD_HISTORY, handle_history },   /* signals sent since a given sequence number */
+    { }
+};
+
 static LSSignal signals[] = {
     { MSM_METHOD_AVAIL, 0 },
     { MSM_METHOD_PROGRESS, 0 },
     { MSM_METHOD_PARTAVAIL, 0 },
+    { MSM_METHOD_RESUME, 0 },
     { MSM_METHOD_MODE, 0 },
     { MSM_METHOD_FSCKING, 0 },
     { MSM_METHOD_STATUS, 0},
     { }
 };
 
+void
+SignalsGetSequence( gint64* instance, guint* seq )
+{
+    *instance = sInstanceId;
+    *seq = sSignalSeq;
+}
+
+void
+SignalsRestoreSequence( gint64 instance, guint seq )
+{
+    sInstanceId = instance;
+    sSignalSeq = sRestoredSeq = seq;
+}
+
 void
 SignalsInit( LSPalmService* lsps_ )
     
@@ -212,8 +329,10 @@ SignalsInit( LSPalmService* lsps_ )
 
     lsps = lsps_;
 
+    sInstanceId = g_get_real_time() / 1000;
+
     if ( !LSPalmServiceRegisterCategory( lsps, MSM_CATEGORY, 
-                              NULL, NULL, signals, NULL, &lserror) ) 
+                              methods, methods, signals, NULL, &lserror) ) 
     {
         LSREPORT(lserror);
     }
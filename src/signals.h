@@ -20,6 +20,7 @@
 #define _SIGNALS_H_
 
 #include <stdbool.h>
+#include <glib.h>
 #include <luna-service2/lunaservice.h>
 
 /** SignalsInit
@@ -28,16 +29,52 @@
  *
  * All signals use the category /com/palm/storage
  *
+ * Every signal payload carries two extra members: "seq", a sequence number
+ * that increases by one with each signal sent by this instance, and
+ * "timestamp", the monotonic clock in milliseconds at the time of sending.
+ * The most recent signals are kept in a bounded ring so that a subscriber
+ * that missed some can catch up with a single call to MSM_METHOD_HISTORY.
+ *
  * @param lsps_                   Handle, set earlier via a call to
  *                                LSRegister, with which to register signals
  */
 void SignalsInit( LSPalmService* lsps_ );
 
+/** SignalsGetSequence
+ *
+ * The instance id and the sequence number of the last signal sent.
+ */
+void SignalsGetSequence( gint64* instance, guint* seq );
+
+/** SignalsRestoreSequence
+ *
+ * Carry on with the instance id and sequence numbers of a previous process
+ * (see state.h), so that subscribers see one uninterrupted sequence.  The
+ * previous process's signals are not in the history.  Call after
+ * SignalsInit.
+ */
+void SignalsRestoreSequence( gint64 instance, guint seq );
+
 /*
  * These are defined in a .h file so test app can use 'em.... 
  */
 #define MSM_CATEGORY "/storaged"
 
+#define MSM_METHOD_HISTORY "history"
+
+/*
+ * Method (not a signal) in MSM_CATEGORY, on both buses:
+ *
+ *   luna://com.palm.storage/storaged/history {"since": N}
+ *
+ * replies with every remembered signal whose "seq" is greater than N, oldest
+ * first, along with "lastSeq", an "instance" id that changes whenever
+ * storaged is restarted without its state snapshot (sequence numbers start
+ * over at 1; after a restart that resumed from the snapshot they carry on),
+ * and "complete",
+ * which is false if signals after N have already been dropped from the ring.
+ */
+
 #define MSM_METHOD_AVAIL "MSMAvail"
 
 /** SignalMSMAvailChange
@@ -85,10 +122,16 @@ void SignalMSMAvailChange( LSHandle* lsh, bool avail );
  *                                 of the signal when stage == "succeeded",
  *                                 ignored otherwise.
  *
+ * @param holders                  json array describing the processes that
+ *                                 held files on the partition and what was
+ *                                 done about them (see EvictReport), sent as
+ *                                 "holders"; NULL to leave it out
+ *
  * @param enterIMasq              Used to indicate which mode we are making
  *                                 progress on, be it "disk mode" or "media sync"
  */
-void SignalMSMProgress( LSHandle* lsh, const char* stage, bool forceRequired );
+void SignalMSMProgress( LSHandle* lsh, const char* stage, bool forceRequired,
+                        const char* holders );
 
 #define MSM_METHOD_MODE "MSMEntry"
 
@@ -151,6 +194,19 @@ void SignalPartitionAvail( LSHandle* lsh, const char* mountPoint, bool avail,
                            bool reformatted, bool fscked);
 
 
+#define MSM_METHOD_RESUME "PartitionResume"
+/** SignalPartitionResume
+ *
+ * Send a signal called "PartitionResume", on both buses, with the keys
+ * "mount_point" and "tier".  It tells services registered in that tier (see
+ * resume.h) that they may now reopen their files there.
+ *
+ * @param mountPoint              Full path of the mount point
+ * @param tier                    "media" or "background"
+ */
+void SignalPartitionResume( const char* mountPoint, const char* tier );
+
+
 #define MSM_METHOD_STATUS	"MSMStatus"
 
 /** SignalMSMStatus
@@ -0,0 +1,115 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glib.h>
+
+#include "state.h"
+
+#define STATE_GROUP "storaged"
+#define STATE_VERSION 2
+
+static gchar* sStateFile = NULL;
+static bool sResume = false;
+
+void
+StateSetFile( const char* path, bool resume )
+{
+    g_free( sStateFile );
+    sStateFile = g_strdup( path );
+    sResume = resume;
+}
+
+void
+StateSave( const StoragedState* state )
+{
+    GKeyFile* keyfile;
+    GError* error = NULL;
+    gsize length = 0;
+
+    if ( NULL == sStateFile )
+        return;
+
+    keyfile = g_key_file_new();
+    g_key_file_set_integer( keyfile, STATE_GROUP, "version", STATE_VERSION );
+    g_key_file_set_boolean( keyfile, STATE_GROUP, "inMSM", state->inMSM );
+    g_key_file_set_boolean( keyfile, STATE_GROUP, "unmount", state->unmount );
+    g_key_file_set_boolean( keyfile, STATE_GROUP, "needPostScripts", state->needPostScripts );
+    g_key_file_set_boolean( keyfile, STATE_GROUP, "hostConnected", state->hostConnected );
+    g_key_file_set_int64( keyfile, STATE_GROUP, "umountDeadline", state->umountDeadline );
+    g_key_file_set_int64( keyfile, STATE_GROUP, "signalInstance", state->signalInstance );
+    g_key_file_set_uint64( keyfile, STATE_GROUP, "signalSeq", state->signalSeq );
+    g_key_file_set_uint64( keyfile, STATE_GROUP, "lifetimeStarts", state->lifetimeStarts );
+    g_key_file_set_uint64( keyfile, STATE_GROUP, "lifetimeExits", state->lifetimeExits );
+    g_key_file_set_int64( keyfile, STATE_GROUP, "requestGapMs", state->requestGapMs );
+    g_key_file_set_int64( keyfile, STATE_GROUP, "lastRequest", state->lastRequest );
+
+    gchar* contents = g_key_file_to_data( keyfile, &length, NULL );
+
+    /* g_file_set_contents writes a temporary file and renames it over */
+    if ( !g_file_set_contents( sStateFile, contents, length, &error ) ) {
+        g_warning( "%s: %s", __func__, error->message );
+        g_error_free( error );
+    }
+
+    g_free( contents );
+    g_key_file_free( keyfile );
+}
+
+bool
+StateLoad( StoragedState* state )
+{
+    GKeyFile* keyfile = g_key_file_new();
+    GError* error = NULL;
+    bool loaded = false;
+
+    if ( NULL == sStateFile || !sResume )
+        goto out;
+
+    if ( !g_key_file_load_from_file( keyfile, sStateFile, G_KEY_FILE_NONE, &error ) ) {
+        g_debug( "%s: %s", __func__, error->message );
+        g_error_free( error );
+        goto out;
+    }
+
+    if ( g_key_file_get_integer( keyfile, STATE_GROUP, "version", NULL ) != STATE_VERSION ) {
+        g_warning( "%s: ignoring snapshot with unknown version", __func__ );
+        goto out;
+    }
+
+    state->inMSM = g_key_file_get_boolean( keyfile, STATE_GROUP, "inMSM", &error );
+    if ( !error ) state->unmount = g_key_file_get_boolean( keyfile, STATE_GROUP, "unmount", &error );
+    if ( !error ) state->needPostScripts = g_key_file_get_boolean( keyfile, STATE_GROUP, "needPostScripts", &error );
+    if ( !error ) state->hostConnected = g_key_file_get_boolean( keyfile, STATE_GROUP, "hostConnected", &error );
+    if ( !error ) state->umountDeadline = g_key_file_get_int64( keyfile, STATE_GROUP, "umountDeadline", &error );
+    if ( !error ) state->signalInstance = g_key_file_get_int64( keyfile, STATE_GROUP, "signalInstance", &error );
+    if ( !error ) state->signalSeq = g_key_file_get_uint64( keyfile, STATE_GROUP, "signalSeq", &error );
+    if ( !error ) state->lifetimeStarts = g_key_file_get_uint64( keyfile, STATE_GROUP, "lifetimeStarts", &error );
+    if ( !error ) state->lifetimeExits = g_key_file_get_uint64( keyfile, STATE_GROUP, "lifetimeExits", &error );
+    if ( !error ) state->requestGapMs = g_key_file_get_int64( keyfile, STATE_GROUP, "requestGapMs", &error );
+    if ( !error ) state->lastRequest = g_key_file_get_int64( keyfile, STATE_GROUP, "lastRequest", &error );
+    if ( error ) {
+        g_warning( "%s: ignoring damaged snapshot: %s", __func__, error->message );
+        g_error_free( error );
+        goto out;
+    }
+    loaded = true;
+
+out:
+    g_key_file_free( keyfile );
+    return loaded;
+}
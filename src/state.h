@@ -0,0 +1,71 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_STATE_H__
+#define __STORAGED_STATE_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+/*
+ * Snapshot of storaged's state, rewritten on every transition so that the
+ * next instance (after an idle exit or a crash) can pick up where this one
+ * left off instead of reconciling from scratch.  It belongs in /tmp/run,
+ * so that it doesn't outlive a reboot (and the monotonic clock stays
+ * comparable).
+ */
+
+typedef struct
+{
+    bool inMSM;                 /* in MSM or trying to get there */
+    bool unmount;               /* partition handed to the host */
+    bool needPostScripts;       /* pre-MSM scripts ran, post-MSM ones haven't */
+    bool hostConnected;         /* cable state we last acted on */
+    gint64 umountDeadline;      /* monotonic time (us) the unmount grace period ends; 0 if none */
+    gint64 signalInstance;      /* see SignalsGetSequence */
+    guint signalSeq;
+    guint lifetimeStarts;       /* see LifetimeGetState */
+    guint lifetimeExits;
+    gint64 requestGapMs;
+    gint64 lastRequest;         /* monotonic us */
+}
+StoragedState;
+
+/** StateSetFile
+ *
+ * Keep the snapshot in path.  Without one, StateSave does nothing and
+ * StateLoad finds nothing.
+ *
+ * @param resume  if false, start afresh: ignore whatever snapshot is there
+ */
+void StateSetFile( const char* path, bool resume );
+
+/** StateSave
+ *
+ * Replace the snapshot.  The file is written under a temporary name and
+ * renamed, so it is always either the old or the new snapshot.
+ */
+void StateSave( const StoragedState* state );
+
+/** StateLoad
+ *
+ * @return false if there is no usable snapshot
+ */
+bool StateLoad( StoragedState* state );
+
+#endif
@@ -0,0 +1,78 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_TRACE_H__
+#define __STORAGED_TRACE_H__
+
+#include <luna-service2/lunaservice.h>
+
+#include "flight.h"
+
+/*
+ * Static tracepoints in provider "storaged".  With the
+ * STORAGED_ENABLE_TRACEPOINTS cmake option these are USDT probes (a single
+ * nop each until perf, bpftrace or systemtap attaches).  List them with
+ * e.g. "bpftrace -l 'usdt:/usr/sbin/storaged:*'".  Either way every
+ * tracepoint is also kept in the flight recorder (see flight.h), so the
+ * arguments are always evaluated; keep them cheap.
+ *
+ *   handler__entry, handler__exit         (method)
+ *   nyx__set__mode__begin                 (mode)
+ *   nyx__set__mode__end                   (mode, nyx error, return code)
+ *   nyx__erase__begin                     (erase type)
+ *   nyx__erase__end                       (erase type, nyx error)
+ *   script__spawn                         (script directory)
+ *   script__exit                          (script directory, wait status)
+ *   signal__send                          (signal name, sequence number)
+ *   transition__begin, transition__finish, transition__abort
+ *   state__in__msm, state__unmount        (new value)
+ */
+
+#ifdef HAVE_SDT_TRACEPOINTS
+#include <sys/sdt.h>
+
+#define STORAGED_PROBE0(name)             DTRACE_PROBE(storaged, name)
+#define STORAGED_PROBE1(name, a)          DTRACE_PROBE1(storaged, name, a)
+#define STORAGED_PROBE2(name, a, b)       DTRACE_PROBE2(storaged, name, a, b)
+#define STORAGED_PROBE3(name, a, b, c)    DTRACE_PROBE3(storaged, name, a, b, c)
+#else
+#define STORAGED_PROBE0(name)             do { } while (0)
+#define STORAGED_PROBE1(name, a)          do { } while (0)
+#define STORAGED_PROBE2(name, a, b)       do { } while (0)
+#define STORAGED_PROBE3(name, a, b, c)    do { } while (0)
+#endif
+
+#define STORAGED_TRACE0(name) \
+    do { FLIGHT_RECORD0(name); STORAGED_PROBE0(name); } while (0)
+#define STORAGED_TRACE1(name, a) \
+    do { FLIGHT_RECORD1(name, a); STORAGED_PROBE1(name, a); } while (0)
+#define STORAGED_TRACE2(name, a, b) \
+    do { FLIGHT_RECORD2(name, a, b); STORAGED_PROBE2(name, a, b); } while (0)
+#define STORAGED_TRACE3(name, a, b, c) \
+    do { FLIGHT_RECORD3(name, a, b, c); STORAGED_PROBE3(name, a, b, c); } while (0)
+
+/*
+ * Run on every exit from a method handler; see LSTRACE_LSMESSAGE.
+ */
+static inline void
+trace_handler_exit( LSMessage** message )
+{
+    STORAGED_TRACE1(handler__exit, LSMessageGetMethod(*message));
+}
+
+#endif
@@ -0,0 +1,457 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <glob.h>
+#include <limits.h>
+#include <mntent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "tuning.h"
+#include "util.h"
+
+#define TUNING_GROUP            "tuning"
+#define TUNING_PROFILE_PREFIX   "profile "
+#define TUNING_UNSET            -1
+
+typedef struct
+{
+    gchar* name;
+    gint nofua;
+    gint readAheadKb;
+    gchar** schedulers;         /* tried in order; NULL to leave alone */
+    gint nrRequests;
+}
+TuningProfile;
+
+typedef struct
+{
+    gchar* path;
+    gchar* value;
+}
+SavedSetting;
+
+/* where gadget drivers keep their LUNs' backing files */
+static const char* sLunPatterns[] = {
+    "/sys/kernel/config/usb_gadget/*/functions/mass_storage.*/lun.*/file",
+    "/sys/devices/virtual/android_usb/android0/f_mass_storage/lun*/file",
+    "/sys/devices/platform/*/gadget/lun*/file",
+};
+
+static GPtrArray* sProfiles = NULL;     /* of TuningProfile* */
+static gchar* sProfileName = NULL;      /* configured */
+static gchar* sDevice = NULL;           /* noted */
+
+static GPtrArray* sSaved = NULL;        /* of SavedSetting*, in order applied */
+static gchar* sApplied = NULL;          /* profile currently applied */
+static guint sApplyCount = 0;
+static guint sFailed = 0;               /* settings the kernel refused */
+
+static TuningProfile*
+add_profile( const char* name )
+{
+    TuningProfile* profile = g_new0( TuningProfile, 1 );
+
+    profile->name = g_strdup( name );
+    profile->nofua = profile->readAheadKb = profile->nrRequests = TUNING_UNSET;
+    g_ptr_array_add( sProfiles, profile );
+    return profile;
+}
+
+static TuningProfile*
+find_profile( const char* name )
+{
+    guint i;
+
+    for ( i = 0; sProfiles && i < sProfiles->len; i++ ) {
+        TuningProfile* profile = g_ptr_array_index( sProfiles, i );
+        if ( !strcmp( profile->name, name ) )
+            return profile;
+    }
+    return NULL;
+}
+
+static void
+init_profiles( void )
+{
+    TuningProfile* profile;
+
+    if ( sProfiles )
+        return;
+    sProfiles = g_ptr_array_new();
+
+    add_profile( "default" );
+
+    /* long sequential transfers: a host copying files on or off */
+    profile = add_profile( "throughput" );
+    profile->nofua = 1;
+    profile->readAheadKb = 2048;
+    profile->schedulers = g_strsplit( "mq-deadline;deadline", ";", -1 );
+    profile->nrRequests = 256;
+
+    /* small scattered transfers: a host indexing or syncing */
+    profile = add_profile( "latency" );
+    profile->nofua = 0;
+    profile->readAheadKb = 128;
+    profile->schedulers = g_strsplit( "none;noop", ";", -1 );
+    profile->nrRequests = 64;
+
+    sProfileName = g_strdup( "default" );
+}
+
+static gint
+get_setting( GKeyFile* keyFile, const char* group, const char* key, gint current )
+{
+    GError* error = NULL;
+    gint value = g_key_file_get_integer( keyFile, group, key, &error );
+
+    if ( error ) {
+        g_error_free( error );
+        return current;
+    }
+    return value;
+}
+
+void
+TuningLoadConfig( const char* path )
+{
+    GKeyFile* keyFile = g_key_file_new();
+    gchar** groups;
+    gchar** group;
+
+    init_profiles();
+    if ( !g_key_file_load_from_file( keyFile, path, G_KEY_FILE_NONE, NULL ) ) {
+        g_key_file_free( keyFile );
+        return;
+    }
+
+    groups = g_key_file_get_groups( keyFile, NULL );
+    for ( group = groups; *group; group++ ) {
+        if ( !g_str_has_prefix( *group, TUNING_PROFILE_PREFIX ) )
+            continue;
+
+        const char* name = *group + strlen( TUNING_PROFILE_PREFIX );
+        TuningProfile* profile = find_profile( name );
+        if ( NULL == profile )
+            profile = add_profile( name );
+
+        profile->nofua = get_setting( keyFile, *group, "nofua", profile->nofua );
+        profile->readAheadKb = get_setting( keyFile, *group, "read_ahead_kb", profile->readAheadKb );
+        profile->nrRequests = get_setting( keyFile, *group, "nr_requests", profile->nrRequests );
+
+        gchar** schedulers = g_key_file_get_string_list( keyFile, *group, "scheduler", NULL, NULL );
+        if ( schedulers ) {
+            g_strfreev( profile->schedulers );
+            profile->schedulers = schedulers;
+        }
+    }
+    g_strfreev( groups );
+
+    gchar* name = g_key_file_get_string( keyFile, TUNING_GROUP, "profile", NULL );
+    if ( name ) {
+        if ( find_profile( name ) ) {
+            g_free( sProfileName );
+            sProfileName = name;
+        } else {
+            g_warning( "%s: %s: no profile \"%s\"", __func__, path, name );
+            g_free( name );
+        }
+    }
+
+    g_key_file_free( keyFile );
+}
+
+const gchar**
+TuningProfileNames( void )
+{
+    const gchar** names;
+    guint i;
+
+    init_profiles();
+    names = g_new0( const gchar*, sProfiles->len + 1 );
+    for ( i = 0; i < sProfiles->len; i++ )
+        names[i] = ((TuningProfile*)g_ptr_array_index( sProfiles, i ))->name;
+    return names;
+}
+
+void
+TuningNoteDevice( const char* mountpoint )
+{
+    struct mntent* ent;
+    FILE* mounts = setmntent( "/proc/self/mounts", "r" );
+
+    if ( NULL == mounts )
+        return;
+    while ( NULL != (ent = getmntent( mounts )) ) {
+        if ( !strcmp( ent->mnt_dir, mountpoint ) && g_str_has_prefix( ent->mnt_fsname, "/dev/" ) ) {
+            g_free( sDevice );
+            sDevice = g_strdup( ent->mnt_fsname );
+            break;
+        }
+    }
+    endmntent( mounts );
+}
+
+/**
+ * @brief remember current (taken over) as path's value to revert to
+ */
+static void
+save_setting( const char* path, gchar* current )
+{
+    SavedSetting* saved = g_new( SavedSetting, 1 );
+    saved->path = g_strdup( path );
+    saved->value = current;
+    g_ptr_array_add( sSaved, saved );
+}
+
+/**
+ * @brief write value to path, first saving what was there
+ *
+ * @param current  the value to save; taken over.  NULL to read it from path.
+ */
+static bool
+change_setting( const char* path, const char* value, gchar* current )
+{
+    if ( NULL == current )
+        current = read_sysfs( path );
+    if ( NULL == current )
+        return false;
+
+    if ( !strcmp( current, value ) ) {
+        g_free( current );
+        return true;
+    }
+    if ( !write_sysfs( path, value ) ) {
+        g_debug( "%s: %s refused %s", __func__, path, value );
+        g_free( current );
+        return false;
+    }
+
+    save_setting( path, current );
+    return true;
+}
+
+static void
+change_number( const char* path, gint value )
+{
+    gchar* text;
+
+    if ( TUNING_UNSET == value )
+        return;
+    text = g_strdup_printf( "%d", value );
+    if ( !change_setting( path, text, NULL ) )
+        sFailed++;
+    g_free( text );
+}
+
+/**
+ * @brief set the first of the schedulers the queue knows about
+ */
+static void
+change_scheduler( const char* path, gchar** schedulers )
+{
+    gchar* available = read_sysfs( path );
+    gchar* current = NULL;
+    gchar** scheduler;
+
+    if ( NULL == available || NULL == schedulers )
+        goto out;
+
+    /* "mq-deadline kyber [bfq] none": the current one is bracketed */
+    const char* open = strchr( available, '[' );
+    const char* close = open ? strchr( open, ']' ) : NULL;
+    if ( NULL == close )
+        goto out;
+    current = g_strndup( open + 1, close - open - 1 );
+
+    for ( scheduler = schedulers; *scheduler; scheduler++ ) {
+        if ( change_setting( path, *scheduler, g_strdup( current ) ) )
+            goto out;
+    }
+    sFailed++;
+
+out:
+    g_free( current );
+    g_free( available );
+}
+
+/**
+ * @brief the queue directory of a disk or partition in sysfs
+ */
+static gchar*
+queue_dir( const char* device )
+{
+    gchar* base = g_path_get_basename( device );
+    gchar* link = g_strdup_printf( "/sys/class/block/%s", base );
+    char real[ PATH_MAX ];
+    gchar* dir = NULL;
+
+    if ( realpath( link, real ) ) {
+        gchar* partition = g_build_filename( real, "partition", NULL );
+        /* a partition's queue is its disk's */
+        if ( g_file_test( partition, G_FILE_TEST_EXISTS ) )
+            dir = g_build_filename( real, "..", "queue", NULL );
+        else
+            dir = g_build_filename( real, "queue", NULL );
+        g_free( partition );
+    }
+
+    g_free( link );
+    g_free( base );
+    return dir;
+}
+
+static void
+change_lun_nofua( const char* device, gint nofua )
+{
+    int i;
+    size_t j;
+
+    if ( TUNING_UNSET == nofua )
+        return;
+
+    for ( i = 0; i < G_N_ELEMENTS( sLunPatterns ); i++ ) {
+        glob_t matches;
+        if ( 0 != glob( sLunPatterns[i], 0, NULL, &matches ) )
+            continue;
+        for ( j = 0; j < matches.gl_pathc; j++ ) {
+            gchar* backing = read_sysfs( matches.gl_pathv[j] );
+            if ( backing && !strcmp( backing, device ) ) {
+                gchar* dir = g_path_get_dirname( matches.gl_pathv[j] );
+                gchar* path = g_build_filename( dir, "nofua", NULL );
+                change_number( path, nofua );
+                g_free( path );
+                g_free( dir );
+            }
+            g_free( backing );
+        }
+        globfree( &matches );
+    }
+}
+
+bool
+TuningApplyProfile( const char* name, const char* device )
+{
+    TuningProfile* profile;
+
+    init_profiles();
+    if ( NULL == (profile = find_profile( name )) )
+        return false;
+
+    TuningRevert();
+    sSaved = g_ptr_array_new();
+    sApplied = g_strdup( name );
+    sApplyCount++;
+
+    gchar* queue = queue_dir( device );
+    if ( queue ) {
+        gchar* path;
+
+        path = g_build_filename( queue, "read_ahead_kb", NULL );
+        change_number( path, profile->readAheadKb );
+        g_free( path );
+
+        /* the scheduler first: switching resets nr_requests, so read the
+           original before */
+        gchar* requests = g_build_filename( queue, "nr_requests", NULL );
+        gchar* originalRequests = read_sysfs( requests );
+        guint changed = sSaved->len;
+
+        path = g_build_filename( queue, "scheduler", NULL );
+        change_scheduler( path, profile->schedulers );
+        g_free( path );
+
+        if ( sSaved->len > changed && originalRequests ) {
+            /* switched: TuningRevert puts it back after the scheduler */
+            save_setting( requests, originalRequests );
+            if ( TUNING_UNSET != profile->nrRequests ) {
+                gchar* text = g_strdup_printf( "%d", profile->nrRequests );
+                if ( !write_sysfs( requests, text ) )
+                    sFailed++;
+                g_free( text );
+            }
+        } else {
+            g_free( originalRequests );
+            change_number( requests, profile->nrRequests );
+        }
+        g_free( requests );
+
+        g_free( queue );
+    } else {
+        g_debug( "%s: no queue for %s", __func__, device );
+    }
+
+    change_lun_nofua( device, profile->nofua );
+
+    g_debug( "%s: %s on %s, %u settings changed", __func__, name, device, sSaved->len );
+    return true;
+}
+
+void
+TuningApply( void )
+{
+    init_profiles();
+    if ( NULL == sDevice || !strcmp( sProfileName, "default" ) )
+        return;
+    (void) TuningApplyProfile( sProfileName, sDevice );
+}
+
+void
+TuningRevert( void )
+{
+    if ( NULL == sSaved )
+        return;
+
+    /* switching scheduler resets nr_requests, so put the scheduler back
+       first and everything else after it */
+    int pass;
+    guint i;
+    for ( pass = 0; pass < 2; pass++ ) {
+        for ( i = 0; i < sSaved->len; i++ ) {
+            SavedSetting* saved = g_ptr_array_index( sSaved, i );
+            if ( (0 == pass) != g_str_has_suffix( saved->path, "/scheduler" ) )
+                continue;
+            if ( !write_sysfs( saved->path, saved->value ) )
+                g_warning( "%s: couldn't restore %s to %s", __func__, saved->path, saved->value );
+        }
+    }
+
+    for ( i = 0; i < sSaved->len; i++ ) {
+        SavedSetting* saved = g_ptr_array_index( sSaved, i );
+        g_free( saved->path );
+        g_free( saved->value );
+        g_free( saved );
+    }
+    g_ptr_array_free( sSaved, TRUE );
+    sSaved = NULL;
+    g_free( sApplied );
+    sApplied = NULL;
+}
+
+void
+TuningAppendStats( GString* out )
+{
+    init_profiles();
+    g_string_append_printf( out, "\"tuning\":{\"profile\":\"%s\", \"device\":\"%s\""
+                            ", \"applied\":%s, \"changed\":%u, \"applies\":%u, \"refused\":%u}",
+                            sProfileName, sDevice ? sDevice : "",
+                            sApplied ? "true" : "false", sSaved ? sSaved->len : 0,
+                            sApplyCount, sFailed );
+}
@@ -0,0 +1,92 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_TUNING_H__
+#define __STORAGED_TUNING_H__
+
+#include <stdbool.h>
+#include <glib.h>
+
+/*
+ * I/O tuning of the exported partition.  While a host has the partition, its
+ * copy throughput depends on the gadget LUN's nofua flag and on the block
+ * queue's read_ahead_kb, scheduler and nr_requests.  A named profile of
+ * those is applied once the partition is exported and the previous values
+ * are put back before it is remounted.
+ *
+ * Built in are "default" (change nothing), "throughput" and "latency".  More
+ * can be defined, and one chosen, in storaged.conf:
+ *
+ *   [tuning]
+ *   profile=throughput
+ *
+ *   [profile bulk]
+ *   nofua=1
+ *   read_ahead_kb=4096
+ *   scheduler=mq-deadline;deadline     (the first one the kernel accepts)
+ *   nr_requests=512
+ *
+ * Keys left out of a profile are left alone.
+ */
+
+/** TuningLoadConfig
+ *
+ * Read profiles, and the choice of profile, from the given key file, if it
+ * exists.
+ */
+void TuningLoadConfig( const char* path );
+
+/** TuningProfileNames
+ *
+ * @return the names of all known profiles, NULL-terminated; free the array
+ *         (not the names) with g_free
+ */
+const gchar** TuningProfileNames( void );
+
+/** TuningNoteDevice
+ *
+ * Remember which block device is mounted on mountpoint.  Call while it still
+ * is, before the partition is exported.
+ */
+void TuningNoteDevice( const char* mountpoint );
+
+/** TuningApplyProfile
+ *
+ * Apply the named profile to the given block device (and any gadget LUN
+ * backed by it), remembering the values it replaces.  Anything applied
+ * before is reverted first.
+ *
+ * @return false if there is no such profile
+ */
+bool TuningApplyProfile( const char* name, const char* device );
+
+/** TuningApply, TuningRevert
+ *
+ * Apply the configured profile to the noted device; put back what the last
+ * TuningApply or TuningApplyProfile changed.
+ */
+void TuningApply( void );
+void TuningRevert( void );
+
+/** TuningAppendStats
+ *
+ * Append the "tuning" member to a json object under construction.
+ */
+void TuningAppendStats( GString* out );
+
+#endif
@@ -18,6 +18,8 @@
 
 #include <stdbool.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "util.h"
 
@@ -40,10 +42,11 @@ isNumber( const gchar* name )
 }
 
 void
-log_blame( const char* prefix )
+scan_open_files( const char* prefix, OpenFileFunc func, gpointer data )
 {
     GDir* dir;
     const gchar* entry;
+    size_t prefixLen = strlen(prefix);
 
     dir = g_dir_open ("/proc", 0, NULL);
 
@@ -55,55 +58,81 @@ log_blame( const char* prefix )
 
     while ((entry = g_dir_read_name (dir)) != NULL)
     {
-        if (isNumber (entry))
-        {
-            gchar* fdpath = g_build_path ("/", "/proc", entry, "fd", NULL);
+        if (!isNumber (entry))
+            continue;
 
-            if (g_file_test(fdpath, G_FILE_TEST_IS_DIR))
+        gchar* fdpath = g_build_path ("/", "/proc", entry, "fd", NULL);
+        GDir* fddir = g_dir_open (fdpath, 0, NULL);
+
+        if (NULL != fddir)
+        {
+            const gchar *nentry;
+            while ((nentry = g_dir_read_name (fddir)) != NULL)
             {
-                GDir* fddir;
-                fddir = g_dir_open (fdpath, 0, NULL);
-
-                if (NULL != dir)
-                {
-                    const gchar *nentry;
-                    gchar* exe = NULL;
-                    while ((nentry = g_dir_read_name (fddir)) != NULL)
-                    {
-                        gchar *lnpath = g_build_path ("/", "/proc", entry, "fd", nentry, NULL);
-                        if (g_file_test(lnpath, G_FILE_TEST_IS_SYMLINK))
-                        {
-                            gchar* link = g_file_read_link (lnpath, NULL);
-                            if (g_ascii_strncasecmp (link, prefix, strlen(prefix)) == 0)
-                            {
-                                if (NULL == exe)
-                                {
-                                    gchar *epath = g_build_path ("/", "/proc", entry, "exe", NULL);
-                                    if (g_file_test(epath, G_FILE_TEST_IS_SYMLINK))
-                                    {
-                                        exe = g_file_read_link (epath, NULL);
-                                    }
-                                    else
-                                    {
-                                       exe = g_strdup_printf ("(unknown PID=%s)", entry);
-                                    }
-
-                                    g_warning ("Application %s (%s) has the following files open:", exe, entry);
-                                    g_free (epath);
-                                }
-                                g_warning ("file: (%s)", link);
-                            }
-                            g_free (link);
-                        }
-                        g_free (lnpath);
-                    }
-                    g_dir_close (fddir);
-                    if (NULL != exe)
-                        g_free (exe);
-                }
+                gchar *lnpath = g_build_path ("/", fdpath, nentry, NULL);
+                gchar* link = g_file_read_link (lnpath, NULL);
+                if (NULL != link && g_ascii_strncasecmp (link, prefix, prefixLen) == 0)
+                    func (entry, nentry, link, data);
+                g_free (link);
+                g_free (lnpath);
             }
-            g_free (fdpath);
+            g_dir_close (fddir);
         }
+        g_free (fdpath);
     }
     g_dir_close (dir);
+} /* scan_open_files */
+
+static void
+blame_file( const gchar* pid, const gchar* fd, const gchar* path, gpointer data )
+{
+    gchar** lastPid = data;
+
+    if (NULL == *lastPid || strcmp (*lastPid, pid) != 0)
+    {
+        gchar *epath = g_build_path ("/", "/proc", pid, "exe", NULL);
+        gchar* exe = g_file_read_link (epath, NULL);
+
+        if (NULL == exe)
+            exe = g_strdup_printf ("(unknown PID=%s)", pid);
+
+        g_warning ("Application %s (%s) has the following files open:", exe, pid);
+        g_free (exe);
+        g_free (epath);
+        g_free (*lastPid);
+        *lastPid = g_strdup (pid);
+    }
+    g_warning ("file: (%s)", path);
+}
+
+void
+log_blame( const char* prefix )
+{
+    gchar* lastPid = NULL;
+
+    scan_open_files (prefix, blame_file, &lastPid);
+    g_free (lastPid);
 } /* log_blame */
+
+gchar*
+read_sysfs( const char* path )
+{
+    gchar* contents = NULL;
+
+    if ( !g_file_get_contents( path, &contents, NULL, NULL ) )
+        return NULL;
+    return g_strchomp( contents );
+}
+
+bool
+write_sysfs( const char* path, const char* value )
+{
+    int fd = open( path, O_WRONLY | O_CLOEXEC );
+    bool ok;
+
+    if ( fd < 0 )
+        return false;
+    ok = write( fd, value, strlen( value ) ) == (ssize_t)strlen( value );
+    close( fd );
+    return ok;
+}
@@ -21,10 +21,10 @@
 
 #include <glib.h>
 
-
-void disable_lifetime_timer();
-
-void reset_lifetime_timer();
+#include "dispatch.h"
+#include "lifetime.h"
+#include "trace.h"
+#include "watchdog.h"
 
 #define LSREPORT(lse) g_critical( "in %s: %s => %s", __func__, \
                                   (lse).func, (lse).message )
@@ -46,8 +46,34 @@ void reset_lifetime_timer();
     }
 
 
+/*
+ * Must be the first statement of every method handler: besides logging the
+ * call it accounts for it, pushes back idle exit, tells the watchdog which handler is running and
+ * fires the handler__entry tracepoint, and arranges for the watchdog to be
+ * told and handler__exit to fire however the handler returns.
+ *
+ * Rate limited handlers use LSTRACE_LSMESSAGE_UNCOUNTED instead and call
+ * LifetimeActivity() only for the requests they let through, so that a
+ * flood doesn't keep storaged alive.
+ */
+static inline void
+lstrace_handler_exit( LSMessage** message )
+{
+    WatchdogLeave();
+    DispatchFinish();
+    trace_handler_exit( message );
+}
+
 #define LSTRACE_LSMESSAGE(message) \
+    LSTRACE_LSMESSAGE_UNCOUNTED(message); \
+    LifetimeActivity()
+
+#define LSTRACE_LSMESSAGE_UNCOUNTED(message) \
+    LSMessage* lstrace_message __attribute__((cleanup(lstrace_handler_exit))) = (message); \
     do { \
+        DispatchAccount(message); \
+        WatchdogEnter(__func__); \
+        STORAGED_TRACE1(handler__entry, LSMessageGetMethod(message)); \
         const char *payload = LSMessageGetPayload(message); \
         g_debug( "%s(%s)", __func__, (NULL == payload) ? "{}" : payload ); \
         struct json_object *object = json_tokener_parse(payload);	\
@@ -62,6 +88,21 @@ void reset_lifetime_timer();
     } while (0)
 
 
+/**
+ * called by scan_open_files for each matching open file
+ *
+ * @param pid   process id, as in /proc
+ * @param fd    file descriptor number, as in /proc/<pid>/fd
+ * @param path  what the descriptor refers to
+ */
+typedef void (*OpenFileFunc)( const gchar* pid, const gchar* fd, const gchar* path, gpointer data );
+
+/**
+ *  call func for every file descriptor, of every process, whose path starts
+ *  with prefix.  Walks all of /proc, so it isn't cheap.
+ */
+void scan_open_files( const char* prefix, OpenFileFunc func, gpointer data );
+
 /**
  *  write to syslog a list of apps that have open file descriptors inside some
  *  directory.  Typically this will be used to "blame" folks keeping files
@@ -73,5 +114,21 @@ void reset_lifetime_timer();
  */
 void log_blame( const char* dirPath );
 
+/**
+ *  read a sysfs (or procfs, or cgroupfs) attribute.
+ *
+ * @return its contents without the trailing newline, or NULL if it can't be
+ *         read.  Free with g_free.
+ */
+gchar* read_sysfs( const char* path );
+
+/**
+ *  write a sysfs (or procfs, or cgroupfs) attribute in a single write(), as
+ *  the kernel expects.
+ *
+ * @return false if it can't be opened or the kernel refused the value
+ */
+bool write_sysfs( const char* path, const char* value );
+
 
 #endif
@@ -0,0 +1,282 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <glib.h>
+
+#include "warmup.h"
+#include "metrics.h"
+#include "util.h"
+
+/*
+ * The hot list has one entry per line, a type letter and a path relative to
+ * the mount point: "f DCIM/100/IMG_0001.JPG" or "d DCIM/100".
+ */
+#define WARMUP_MAX_ENTRIES      512
+#define WARMUP_BUDGET_BYTES     (64 * 1024 * 1024)  /* read ahead at most this much in all */
+#define WARMUP_FILE_BYTES       (8 * 1024 * 1024)   /* ... and this much of any one file */
+#define WARMUP_DIR_THREADS      4
+
+typedef struct
+{
+    gchar* mountpoint;
+    gchar** entries;
+    gint64 start;               /* MetricsNow() */
+    guint files;
+    volatile gint dirs;         /* updated by the prewalk threads */
+    gint64 bytes;
+}
+Warmup;
+
+static gchar* sHotFile = NULL;
+static volatile gint sRunning = 0;
+static volatile gint sCancel = 0;   /* checked by the threads per entry */
+static GThread* sThread = NULL;     /* to be joined, main thread only */
+
+/* main thread only */
+static guint sRuns = 0;
+static guint sCancelled = 0;
+static guint sLastFiles = 0;
+static guint sLastDirs = 0;
+static gint64 sLastBytes = 0;
+static gint64 sLastUs = 0;
+
+typedef struct
+{
+    gsize prefixLen;            /* of the mount point, with its trailing '/' */
+    GHashTable* entries;        /* "f path" / "d path" -> 1 */
+}
+HotList;
+
+static void
+note_hot_file( const gchar* pid, const gchar* fd, const gchar* path, gpointer data )
+{
+    HotList* hot = data;
+
+    if ( g_hash_table_size( hot->entries ) >= WARMUP_MAX_ENTRIES )
+        return;
+    if ( strlen( path ) <= hot->prefixLen )
+        return;
+
+    const gchar* relative = path + hot->prefixLen;
+    gchar* dir = g_path_get_dirname( relative );
+
+    g_hash_table_insert( hot->entries, g_strconcat( "f ", relative, NULL ), GINT_TO_POINTER( 1 ) );
+    g_hash_table_insert( hot->entries, g_strconcat( "d ", dir, NULL ), GINT_TO_POINTER( 1 ) );
+
+    g_free( dir );
+}
+
+static void
+append_entry( gpointer key, gpointer value, gpointer data )
+{
+    g_string_append_printf( (GString*)data, "%s\n", (const gchar*)key );
+}
+
+void
+WarmupSetFile( const char* path )
+{
+    g_free( sHotFile );
+    sHotFile = g_strdup( path );
+}
+
+void
+WarmupRecord( const char* mountpoint )
+{
+    if ( NULL == sHotFile )
+        return;
+
+    gchar* prefix = g_strconcat( mountpoint, "/", NULL );
+    HotList hot = { strlen( prefix ), g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL ) };
+
+    scan_open_files( prefix, note_hot_file, &hot );
+
+    /* nothing open means nothing learned; keep the previous list */
+    if ( g_hash_table_size( hot.entries ) > 0 ) {
+        GString* contents = g_string_new( NULL );
+        GError* error = NULL;
+
+        g_hash_table_foreach( hot.entries, append_entry, contents );
+        if ( !g_file_set_contents( sHotFile, contents->str, contents->len, &error ) ) {
+            g_warning( "%s: %s", __func__, error->message );
+            g_error_free( error );
+        }
+        g_debug( "%s: %u hot entries under %s", __func__, g_hash_table_size( hot.entries ), mountpoint );
+        g_string_free( contents, TRUE );
+    }
+
+    g_hash_table_destroy( hot.entries );
+    g_free( prefix );
+}
+
+/**
+ * @brief pull the inodes of a directory's entries into the cache
+ */
+static void
+prewalk_dir( gpointer data, gpointer user_data )
+{
+    gchar* path = data;
+    Warmup* warmup = user_data;
+    DIR* dir = g_atomic_int_get( &sCancel ) ? NULL : opendir( path );
+
+    if ( dir ) {
+        struct dirent* entry;
+        struct stat st;
+
+        while ( !g_atomic_int_get( &sCancel ) && NULL != (entry = readdir( dir )) ) {
+            if ( entry->d_name[0] != '.' )
+                (void) fstatat( dirfd( dir ), entry->d_name, &st, AT_SYMLINK_NOFOLLOW );
+        }
+        closedir( dir );
+        g_atomic_int_inc( &warmup->dirs );
+    }
+    g_free( path );
+}
+
+/**
+ * @brief join the warmup thread, if there is one, and account for its run
+ */
+static void
+warmup_reap( void )
+{
+    Warmup* warmup;
+
+    if ( NULL == sThread )
+        return;
+    warmup = g_thread_join( sThread );
+    sThread = NULL;
+
+    if ( g_atomic_int_get( &sCancel ) ) {
+        sCancelled++;
+        g_debug( "%s: cancelled after %u files", __func__, warmup->files );
+        goto done;
+    }
+
+    sRuns++;
+    sLastFiles = warmup->files;
+    sLastDirs = g_atomic_int_get( &warmup->dirs );
+    sLastBytes = warmup->bytes;
+    sLastUs = MetricsNow() - warmup->start;
+    MetricsRecord( METRIC_WARMUP, warmup->start );
+    g_debug( "%s: %u files (%" G_GINT64_FORMAT " bytes) and %u directories in %" G_GINT64_FORMAT " us",
+             __func__, sLastFiles, sLastBytes, sLastDirs, sLastUs );
+
+done:
+    g_strfreev( warmup->entries );
+    g_free( warmup->mountpoint );
+    g_free( warmup );
+    g_atomic_int_set( &sCancel, 0 );
+    g_atomic_int_set( &sRunning, 0 );
+}
+
+static gboolean
+warmup_done( gpointer data )
+{
+    /* unless WarmupCancel got there first */
+    warmup_reap();
+    return FALSE;
+}
+
+static gpointer
+warmup_thread( gpointer data )
+{
+    Warmup* warmup = data;
+    GThreadPool* pool = g_thread_pool_new( prewalk_dir, warmup, WARMUP_DIR_THREADS, FALSE, NULL );
+    gchar** entry;
+
+    /* directories first: they're cheap and the walk proceeds in parallel */
+    for ( entry = warmup->entries; *entry; entry++ ) {
+        if ( (*entry)[0] == 'd' && (*entry)[1] == ' ' )
+            g_thread_pool_push( pool, g_build_filename( warmup->mountpoint, *entry + 2, NULL ), NULL );
+    }
+
+    for ( entry = warmup->entries; *entry && warmup->bytes < WARMUP_BUDGET_BYTES
+                                   && !g_atomic_int_get( &sCancel ); entry++ ) {
+        if ( (*entry)[0] != 'f' || (*entry)[1] != ' ' )
+            continue;
+
+        gchar* path = g_build_filename( warmup->mountpoint, *entry + 2, NULL );
+        int fd = open( path, O_RDONLY | O_CLOEXEC | O_NOATIME );
+        if ( fd < 0 )
+            fd = open( path, O_RDONLY | O_CLOEXEC );    /* O_NOATIME needs ownership */
+        g_free( path );
+        if ( fd < 0 )
+            continue;
+
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) ) {
+            off_t len = MIN( st.st_size, WARMUP_FILE_BYTES );
+            len = MIN( len, WARMUP_BUDGET_BYTES - warmup->bytes );
+            (void) posix_fadvise( fd, 0, len, POSIX_FADV_WILLNEED );
+            if ( readahead( fd, 0, len ) == 0 ) {
+                warmup->files++;
+                warmup->bytes += len;
+            }
+        }
+        close( fd );
+    }
+
+    g_thread_pool_free( pool, FALSE, TRUE );
+    g_idle_add( warmup_done, NULL );
+    return warmup;
+}
+
+void
+WarmupStart( const char* mountpoint )
+{
+    gchar* contents = NULL;
+
+    if ( NULL == sHotFile || !g_file_get_contents( sHotFile, &contents, NULL, NULL ) )
+        return;
+
+    if ( !g_atomic_int_compare_and_exchange( &sRunning, 0, 1 ) ) {
+        g_debug( "%s: already running", __func__ );
+        g_free( contents );
+        return;
+    }
+
+    Warmup* warmup = g_new0( Warmup, 1 );
+    warmup->mountpoint = g_strdup( mountpoint );
+    warmup->entries = g_strsplit( contents, "\n", WARMUP_MAX_ENTRIES + 1 );
+    warmup->start = MetricsNow();
+    g_free( contents );
+
+    sThread = g_thread_new( "warmup", warmup_thread, warmup );
+}
+
+void
+WarmupCancel( void )
+{
+    if ( NULL == sThread )
+        return;
+    g_atomic_int_set( &sCancel, 1 );
+    warmup_reap();
+}
+
+void
+WarmupAppendStats( GString* out )
+{
+    g_string_append_printf( out, "\"warmup\":{\"runs\":%u, \"cancelled\":%u, \"files\":%u, \"dirs\":%u"
+                            ", \"bytes\":%" G_GINT64_FORMAT ", \"lastMs\":%" G_GINT64_FORMAT "}",
+                            sRuns, sCancelled, sLastFiles, sLastDirs, sLastBytes, sLastUs / 1000 );
+}
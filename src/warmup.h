@@ -0,0 +1,67 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_WARMUP_H__
+#define __STORAGED_WARMUP_H__
+
+#include <glib.h>
+
+/*
+ * Cache warm-up after MSM.  While the partition is exported the page and
+ * dentry caches for it are thrown away, so the first applications to touch
+ * it after remount stall.  Before export we note which files are open there
+ * (and their directories) in a small hot list; after remount a background
+ * thread reads them back in, within an I/O budget, before PartitionAvail
+ * goes out.
+ */
+
+/** WarmupSetFile
+ *
+ * Keep the hot list in the given file.  Without one nothing is recorded or
+ * warmed.
+ */
+void WarmupSetFile( const char* path );
+
+/** WarmupRecord
+ *
+ * Note the files currently open under mountpoint, and their directories, in
+ * the hot list.  Call before the partition is exported.
+ */
+void WarmupRecord( const char* mountpoint );
+
+/** WarmupStart
+ *
+ * Start reading the hot list back in under mountpoint, in the background.
+ * Call once the partition is mounted again.
+ */
+void WarmupStart( const char* mountpoint );
+
+/** WarmupCancel
+ *
+ * Stop a warm-up still running and wait for its threads, so that nothing of
+ * storaged's is open on the partition.  Call before it is unmounted again.
+ */
+void WarmupCancel( void );
+
+/** WarmupAppendStats
+ *
+ * Append a "warmup" member to the json object being built in out.
+ */
+void WarmupAppendStats( GString* out );
+
+#endif
@@ -0,0 +1,235 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <execinfo.h>
+#include <glib.h>
+
+#include "watchdog.h"
+
+#define WATCHDOG_BEAT_MS   2000    /* heartbeat period, for work nobody named */
+#define WATCHDOG_POLL_MS   50      /* how often named work is checked on */
+#define WATCHDOG_STALL_MS  250     /* longer or later than this is a stall */
+#define WATCHDOG_MAX_FRAMES 32
+
+/* stall durations are counted in these buckets: 250ms, 500ms, 1s, ... */
+static const guint sBucketMs[] = { 250, 500, 1000, 2000, 5000, 10000 };
+static const char* sBucketNames[] = { "250ms", "500ms", "1s", "2s", "5s", "10s" };
+
+static gint64 sEpoch = 0;
+static pthread_t sMainThread;
+
+/* shared with the watchdog thread */
+static volatile gint sBeat = 0;                 /* ms since sEpoch of the last heartbeat */
+static gpointer volatile sCurrent = NULL;       /* what the loop is doing, if known */
+static gpointer volatile sLastStalled = NULL;   /* what it was doing in the last stall */
+static volatile gint sEnterMs = 0;              /* ms since sEpoch sCurrent began */
+static GMutex sLock;                            /* for sWake */
+static GCond sWake;                             /* named work has begun */
+
+/* filled in by the SIGUSR2 handler on the main thread */
+static void* sFrames[ WATCHDOG_MAX_FRAMES ];
+static volatile gint sNumFrames = 0;
+static volatile gint sCaptures = 0;
+
+/* main thread only */
+static gint64 sLastBeatUs = 0;
+static guint sStalls[ G_N_ELEMENTS(sBucketMs) ];
+static guint sMaxStallMs = 0;
+static bool sCountedSinceBeat = false;  /* a named stall has delayed the heartbeat */
+
+static guint
+now_ms( void )
+{
+    return (guint)((g_get_monotonic_time() - sEpoch) / 1000);
+}
+
+static void
+count_stall( guint stallMs )
+{
+    int i = G_N_ELEMENTS(sBucketMs) - 1;
+
+    while ( i > 0 && stallMs < sBucketMs[i] )
+        i--;
+    sStalls[i]++;
+    sMaxStallMs = MAX( sMaxStallMs, stallMs );
+}
+
+static gboolean
+heartbeat( gpointer data )
+{
+    gint64 now = g_get_monotonic_time();
+    guint lateMs = (guint)((now - sLastBeatUs) / 1000);
+
+    if ( lateMs > WATCHDOG_BEAT_MS )
+        lateMs -= WATCHDOG_BEAT_MS;
+    else
+        lateMs = 0;
+
+    /* named work is timed, and counted, by WatchdogLeave */
+    if ( lateMs >= WATCHDOG_STALL_MS && !sCountedSinceBeat )
+        count_stall( lateMs );
+    sCountedSinceBeat = false;
+
+    sLastBeatUs = now;
+    g_atomic_int_set( &sBeat, now_ms() );
+    return TRUE;
+}
+
+/*
+ * Runs on the main thread when the watchdog asks for its stack.  backtrace()
+ * was called once at startup so that it doesn't have to load libgcc (and
+ * malloc) here.
+ */
+static void
+capture_backtrace( int signal )
+{
+    g_atomic_int_set( &sNumFrames, backtrace( sFrames, WATCHDOG_MAX_FRAMES ) );
+    g_atomic_int_inc( &sCaptures );
+}
+
+static void
+report_stall( guint lateMs )
+{
+    const char* what = g_atomic_pointer_get( &sCurrent );
+    gint captures = g_atomic_int_get( &sCaptures );
+    int i;
+
+    g_atomic_pointer_set( &sLastStalled, (gpointer)what );
+    g_warning( "main loop stalled for %u ms in %s", lateMs, what ? what : "(unknown)" );
+
+    if ( pthread_kill( sMainThread, SIGUSR2 ) != 0 )
+        return;
+    for ( i = 0; i < 20 && g_atomic_int_get( &sCaptures ) == captures; i++ )
+        g_usleep( 5000 );
+    if ( g_atomic_int_get( &sCaptures ) == captures )
+        return;         /* the main thread has signals blocked, or is in the kernel for good */
+
+    int numFrames = g_atomic_int_get( &sNumFrames );
+    char** symbols = backtrace_symbols( sFrames, numFrames );
+    if ( NULL == symbols )
+        return;
+    /* skip capture_backtrace and the signal trampoline */
+    for ( i = 2; i < numFrames; i++ )
+        g_warning( "  #%d %s", i - 2, symbols[i] );
+    free( symbols );
+}
+
+/*
+ * While the loop is idle this thread sleeps for a heartbeat at a time; only
+ * while it runs named work (WatchdogEnter to WatchdogLeave) does it check
+ * every WATCHDOG_POLL_MS, so an idle storaged hardly wakes up.
+ */
+static gpointer
+watchdog_thread( gpointer data )
+{
+    gint reportedBeat = -1;
+    gint reportedEnter = -1;
+
+    for ( ;; ) {
+        g_mutex_lock( &sLock );
+        if ( NULL == g_atomic_pointer_get( &sCurrent ) )
+            (void) g_cond_wait_until( &sWake, &sLock, g_get_monotonic_time() + WATCHDOG_BEAT_MS * 1000 );
+        g_mutex_unlock( &sLock );
+        if ( NULL != g_atomic_pointer_get( &sCurrent ) )
+            g_usleep( WATCHDOG_POLL_MS * 1000 );
+
+        /* one report per stall */
+        gint enter = g_atomic_int_get( &sEnterMs );
+        guint busyMs = now_ms() - (guint)enter;
+        if ( NULL != g_atomic_pointer_get( &sCurrent ) && busyMs >= WATCHDOG_STALL_MS && enter != reportedEnter ) {
+            reportedEnter = enter;
+            report_stall( busyMs );
+            continue;
+        }
+
+        gint beat = g_atomic_int_get( &sBeat );
+        guint lateMs = now_ms() - (guint)beat;
+        if ( lateMs >= WATCHDOG_STALL_MS + WATCHDOG_BEAT_MS && beat != reportedBeat ) {
+            reportedBeat = beat;
+            report_stall( lateMs - WATCHDOG_BEAT_MS );
+        }
+    }
+    return NULL;
+}
+
+void
+WatchdogInit( GMainLoop* loop )
+{
+    struct sigaction action;
+    void* frame;
+
+    sEpoch = g_get_monotonic_time();
+    sLastBeatUs = sEpoch;
+    sMainThread = pthread_self();
+    (void) backtrace( &frame, 1 );
+
+    memset( &action, 0, sizeof(action) );
+    action.sa_handler = capture_backtrace;
+    action.sa_flags = SA_RESTART;
+    sigemptyset( &action.sa_mask );
+    sigaction( SIGUSR2, &action, NULL );
+
+    GSource* source = g_timeout_source_new( WATCHDOG_BEAT_MS );
+    g_source_set_priority( source, G_PRIORITY_HIGH );
+    g_source_set_callback( source, heartbeat, NULL, NULL );
+    g_source_attach( source, g_main_loop_get_context( loop ) );
+    g_source_unref( source );
+
+    g_thread_new( "watchdog", watchdog_thread, NULL );
+}
+
+void
+WatchdogEnter( const char* what )
+{
+    g_atomic_int_set( &sEnterMs, now_ms() );
+    g_mutex_lock( &sLock );
+    g_atomic_pointer_set( &sCurrent, (gpointer)what );
+    g_cond_signal( &sWake );
+    g_mutex_unlock( &sLock );
+}
+
+void
+WatchdogLeave( void )
+{
+    guint busyMs = now_ms() - (guint)g_atomic_int_get( &sEnterMs );
+
+    if ( NULL == g_atomic_pointer_get( &sCurrent ) )
+        return;
+    g_atomic_pointer_set( &sCurrent, NULL );
+    if ( busyMs >= WATCHDOG_STALL_MS ) {
+        count_stall( busyMs );
+        sCountedSinceBeat = true;
+    }
+}
+
+void
+WatchdogAppendStats( GString* out )
+{
+    const char* last = g_atomic_pointer_get( &sLastStalled );
+    int i;
+
+    g_string_append( out, "\"stalls\":{" );
+    for ( i = 0; i < G_N_ELEMENTS(sBucketMs); i++ )
+        g_string_append_printf( out, "\"%s\":%u, ", sBucketNames[i], sStalls[i] );
+    g_string_append_printf( out, "\"maxMs\":%u, \"last\":\"%s\"}", sMaxStallMs, last ? last : "" );
+}
@@ -0,0 +1,62 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+#ifndef __STORAGED_WATCHDOG_H__
+#define __STORAGED_WATCHDOG_H__
+
+#include <glib.h>
+
+/*
+ * Main loop stall watchdog.
+ *
+ * Everything storaged does runs on its main loop, so anything synchronous
+ * there (scripts, nyx calls, the /proc scan in log_blame) holds up every
+ * other client.  A separate thread watches the named work handlers and
+ * timers do (WatchdogEnter to WatchdogLeave) closely, and anything else
+ * through a slow high priority heartbeat on the loop; when either runs
+ * late it logs what the loop is stuck in, with a backtrace of the main
+ * thread.  Stalls are counted by duration for /diskmode/stats.
+ */
+
+/** WatchdogInit
+ *
+ * Start the heartbeat on loop and the watchdog thread.  Call from the
+ * thread that will run loop.
+ */
+void WatchdogInit( GMainLoop* loop );
+
+/** WatchdogEnter
+ *
+ * Name what the main loop is about to do; what must be a string literal
+ * (e.g. __func__), since the watchdog thread may read it at any time.
+ */
+void WatchdogEnter( const char* what );
+
+/** WatchdogLeave
+ *
+ * The main loop is done with what it was doing.
+ */
+void WatchdogLeave( void );
+
+/** WatchdogAppendStats
+ *
+ * Append a "stalls" member to the json object being built in out.
+ */
+void WatchdogAppendStats( GString* out );
+
+#endif
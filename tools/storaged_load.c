@@ -0,0 +1,402 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/*
+ * storaged-load: drive storaged's luna API from many clients at once and
+ * report per-method throughput and latency percentiles.
+ *
+ *   storaged-load [-c CLIENTS] [-t SECONDS] [-r METHOD=RATE]...
+ *
+ * Each -r sets the calls per second for one of the methods below; without
+ * any, a status-polling mix with one cable event a second is used.  Calls
+ * are spread round-robin over the clients and sent open-loop: latency is
+ * measured from when a call was due, not from when it went out, so a
+ * stalled storaged shows up as latency rather than as a lower send rate.
+ * Replies with "returnValue":false (e.g. throttled status queries) are
+ * counted as errors.
+ *
+ * Built as storaged-load it talks to the storaged on the local hub.  Built
+ * as storaged-load-standin it runs storaged's handlers in-process behind
+ * the luna-service2 stand-in used by the benchmarks, with a simulated
+ * backend, so it needs neither a hub nor root.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#ifdef STORAGED_LOAD_STANDIN
+#include "lsstub.h"
+#include "diskmode.h"
+#include "dispatch.h"
+#include "erase.h"
+#include "lifetime.h"
+#include "signals.h"
+#include "log.h"
+#include "main.h"
+#endif
+
+#define DEFAULT_CLIENTS 16
+#define DEFAULT_SECONDS 10
+#define GRACE_MS 2000       /* how long to wait for stragglers at the end */
+
+typedef struct
+{
+    const char* name;
+    const char* uri;
+    bool public_bus;
+    const char* payload;    /* NULL: alternate {"connected": true/false} */
+
+    double rate;
+    guint64 sent;
+    guint64 replies;
+    guint64 errors;
+    GArray* latencies;      /* guint32 microseconds */
+}
+LoadMethod;
+
+static LoadMethod sMethods[] = {
+    { "queryMSMStatus",  "luna://com.palm.storage/diskmode/queryMSMStatus",  true,  "{}" },
+    { "hostIsConnected", "luna://com.palm.storage/diskmode/hostIsConnected", false, "{}" },
+    { "history",         "luna://com.palm.storage/storaged/history",         true,  "{\"since\":0}" },
+    { "changed",         "luna://com.palm.storage/diskmode/changed",         false, NULL },
+};
+
+typedef struct
+{
+    LoadMethod* method;
+    gint64 due;
+}
+PendingCall;
+
+static GMainLoop* sLoop = NULL;
+static LSHandle** sPublicClients = NULL;
+static LSHandle** sPrivateClients = NULL;
+static int sNumClients = DEFAULT_CLIENTS;
+static guint sNextClient = 0;
+static gint64 sStart = 0;
+static gint64 sEnd = 0;
+static guint64 sOutstanding = 0;
+
+#ifdef STORAGED_LOAD_STANDIN
+/*
+ * Simulated backend: the driver is always there and every mode change
+ * succeeds immediately.
+ */
+static bool
+standin_backend_open( const char* arg )
+{
+    return true;
+}
+
+static nyx_error_t
+standin_backend_get_state( int* state )
+{
+    *state = NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE;
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+standin_backend_set_mode( nyx_mass_storage_mode_t mode,
+                          nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    *ret_status = NYX_MASS_STORAGE_MODE_SUCCESS;
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+standin_backend_erase_partition( nyx_system_erase_type_t type )
+{
+    return NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+standin_backend_register_change_callback( nyx_device_callback_function_t callback,
+                                          void* context )
+{
+    return NYX_ERROR_NONE;
+}
+
+static const StorageBackend sStandInBackend = {
+    .name = "standin",
+    .open = standin_backend_open,
+    .get_state = standin_backend_get_state,
+    .set_mode = standin_backend_set_mode,
+    .erase_partition = standin_backend_erase_partition,
+    .register_change_callback = standin_backend_register_change_callback,
+    .host_connected = NULL,
+};
+
+const StorageBackend*
+GetStorageBackend( void )
+{
+    return &sStandInBackend;
+}
+
+static void
+start_standin( void )
+{
+    LSError lserror;
+    LSErrorInit( &lserror );
+
+    /* storaged quits its own loop when idle; give it one that never runs
+       so that can't end the load run early */
+    GMainLoop* serviceLoop = g_main_loop_new( NULL, FALSE );
+    LSPalmService* lsps = StubBusNew();
+    LSHandle* priv = LSPalmServiceGetPrivateConnection( lsps );
+    LSHandle* pub = LSPalmServiceGetPublicConnection( lsps );
+
+    DispatchInit( serviceLoop );
+    LifetimeInit( serviceLoop );
+    SignalsInit( lsps );
+    DiskModeInterfaceInit( serviceLoop, priv, pub, false );
+    EraseInit( serviceLoop, priv );
+    DispatchAttach( priv, "private", G_PRIORITY_DEFAULT, serviceLoop, &lserror );
+    DispatchAttach( pub, "public", G_PRIORITY_DEFAULT_IDLE, serviceLoop, &lserror );
+}
+#endif
+
+static bool
+handle_reply( LSHandle* lsh, LSMessage* reply, void* ctx )
+{
+    PendingCall* call = ctx;
+    LoadMethod* method = call->method;
+    guint32 us = (guint32)MIN( g_get_monotonic_time() - call->due, G_MAXUINT32 );
+    const char* payload = LSMessageGetPayload( reply );
+
+    method->replies++;
+    if ( payload && strstr( payload, "\"returnValue\":false" ) )
+        method->errors++;
+    g_array_append_val( method->latencies, us );
+
+    g_free( call );
+    if ( --sOutstanding == 0 && g_get_monotonic_time() >= sEnd )
+        g_main_loop_quit( sLoop );
+    return true;
+}
+
+static void
+send_call( LoadMethod* method, gint64 due )
+{
+    LSError lserror;
+    LSErrorInit( &lserror );
+    guint client = sNextClient++ % sNumClients;
+    LSHandle* lsh = method->public_bus ? sPublicClients[ client ] : sPrivateClients[ client ];
+    PendingCall* call = g_new( PendingCall, 1 );
+    const char* payload = method->payload;
+
+    if ( NULL == payload )
+        payload = (method->sent % 2) ? "{\"connected\": false}" : "{\"connected\": true}";
+
+    call->method = method;
+    call->due = due;
+    method->sent++;
+    if ( !LSCallOneReply( lsh, method->uri, payload, handle_reply, call, NULL, &lserror ) ) {
+        g_warning( "%s: %s", method->name, lserror.message );
+        LSErrorFree( &lserror );
+        method->errors++;
+        g_free( call );
+        return;
+    }
+    sOutstanding++;
+}
+
+/**
+ * @brief send every call that has come due since the last tick
+ */
+static gboolean
+tick( gpointer data )
+{
+    gint64 now = g_get_monotonic_time();
+    int i;
+
+    for ( i = 0; i < G_N_ELEMENTS(sMethods); i++ ) {
+        LoadMethod* method = &sMethods[i];
+        if ( method->rate <= 0 )
+            continue;
+        for ( ;; ) {
+            gint64 due = sStart + (gint64)(method->sent * G_USEC_PER_SEC / method->rate);
+            if ( due > now || due >= sEnd )
+                break;
+            send_call( method, due );
+        }
+    }
+
+    if ( now < sEnd )
+        return TRUE;
+    if ( sOutstanding == 0 )
+        g_main_loop_quit( sLoop );
+    return FALSE;
+}
+
+static gboolean
+grace_expired( gpointer data )
+{
+    g_main_loop_quit( sLoop );
+    return FALSE;
+}
+
+static int
+compare_latency( const void* a, const void* b )
+{
+    guint32 x = *(const guint32*)a, y = *(const guint32*)b;
+    return (x > y) - (x < y);
+}
+
+static guint32
+percentile( GArray* sorted, double p )
+{
+    if ( sorted->len == 0 )
+        return 0;
+    return g_array_index( sorted, guint32, (guint)((sorted->len - 1) * p) );
+}
+
+static void
+report( double seconds )
+{
+    int i;
+
+    for ( i = 0; i < G_N_ELEMENTS(sMethods); i++ ) {
+        LoadMethod* method = &sMethods[i];
+        if ( method->rate <= 0 )
+            continue;
+
+        g_array_sort( method->latencies, compare_latency );
+        printf( "{\"method\":\"%s\", \"sent\":%" G_GUINT64_FORMAT ", \"replies\":%" G_GUINT64_FORMAT
+                ", \"errors\":%" G_GUINT64_FORMAT ", \"lost\":%" G_GUINT64_FORMAT
+                ", \"throughput\":%.1f, \"p50Us\":%u, \"p99Us\":%u, \"p999Us\":%u, \"maxUs\":%u}\n",
+                method->name, method->sent, method->replies, method->errors,
+                method->sent - method->replies, method->replies / seconds,
+                percentile( method->latencies, 0.50 ), percentile( method->latencies, 0.99 ),
+                percentile( method->latencies, 0.999 ), percentile( method->latencies, 1.0 ) );
+    }
+}
+
+static bool
+set_rate( const char* spec )
+{
+    const char* eq = strchr( spec, '=' );
+    int i;
+
+    if ( NULL == eq )
+        return false;
+    for ( i = 0; i < G_N_ELEMENTS(sMethods); i++ ) {
+        if ( strlen( sMethods[i].name ) == (size_t)(eq - spec) &&
+             !strncmp( sMethods[i].name, spec, eq - spec ) ) {
+            sMethods[i].rate = g_ascii_strtod( eq + 1, NULL );
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+usage( const char* progname )
+{
+    int i;
+
+    fprintf( stderr, "usage: %s [-c CLIENTS] [-t SECONDS] [-r METHOD=RATE]...\n"
+                     "methods:", progname );
+    for ( i = 0; i < G_N_ELEMENTS(sMethods); i++ )
+        fprintf( stderr, " %s", sMethods[i].name );
+    fprintf( stderr, "\n" );
+}
+
+int
+main( int argc, char** argv )
+{
+    int seconds = DEFAULT_SECONDS;
+    bool haveRates = false;
+    int opt, i;
+
+    while ( (opt = getopt( argc, argv, "c:hr:t:" )) != -1 ) {
+        switch ( opt ) {
+        case 'c':
+            sNumClients = atoi( optarg );
+            break;
+        case 'r':
+            if ( !set_rate( optarg ) ) {
+                usage( argv[0] );
+                return EXIT_FAILURE;
+            }
+            haveRates = true;
+            break;
+        case 't':
+            seconds = atoi( optarg );
+            break;
+        case 'h':
+        default:
+            usage( argv[0] );
+            return EXIT_FAILURE;
+        }
+    }
+    if ( sNumClients <= 0 || seconds <= 0 ) {
+        usage( argv[0] );
+        return EXIT_FAILURE;
+    }
+    if ( !haveRates ) {
+        set_rate( "queryMSMStatus=200" );
+        set_rate( "hostIsConnected=50" );
+        set_rate( "changed=1" );
+    }
+
+    sLoop = g_main_loop_new( NULL, FALSE );
+
+#ifdef STORAGED_LOAD_STANDIN
+    g_log_set_default_handler( logFilter, NULL );
+    start_standin();
+#endif
+
+    sPublicClients = g_new0( LSHandle*, sNumClients );
+    sPrivateClients = g_new0( LSHandle*, sNumClients );
+    for ( i = 0; i < sNumClients; i++ ) {
+        LSError lserror;
+        LSErrorInit( &lserror );
+        if ( !LSRegisterPubPriv( NULL, &sPublicClients[i], true, &lserror ) ||
+             !LSGmainAttach( sPublicClients[i], sLoop, &lserror ) ||
+             !LSRegisterPubPriv( NULL, &sPrivateClients[i], false, &lserror ) ||
+             !LSGmainAttach( sPrivateClients[i], sLoop, &lserror ) ) {
+            fprintf( stderr, "%s: registering client %d: %s\n", argv[0], i, lserror.message );
+            LSErrorFree( &lserror );
+            return EXIT_FAILURE;
+        }
+    }
+
+    for ( i = 0; i < G_N_ELEMENTS(sMethods); i++ )
+        sMethods[i].latencies = g_array_new( FALSE, FALSE, sizeof(guint32) );
+
+    sStart = g_get_monotonic_time();
+    sEnd = sStart + (gint64)seconds * G_USEC_PER_SEC;
+    g_timeout_add( 1, tick, NULL );
+    g_timeout_add( seconds * 1000 + GRACE_MS, grace_expired, NULL );
+    g_main_loop_run( sLoop );
+
+    report( seconds );
+    printf( "{\"clients\":%d, \"seconds\":%d, \"outstanding\":%" G_GUINT64_FORMAT "}\n",
+            sNumClients, seconds, sOutstanding );
+
+    for ( i = 0; i < sNumClients; i++ ) {
+        LSUnregister( sPublicClients[i], NULL );
+        LSUnregister( sPrivateClients[i], NULL );
+    }
+    g_main_loop_unref( sLoop );
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,344 @@
+/* @@@LICENSE
+*
+*      Copyright (c) 2002-2013 LG Electronics, Inc.
+*
+* Licensed under the Apache License, Version 2.0 (the "License");
+* you may not use this file except in compliance with the License.
+* You may obtain a copy of the License at
+*
+* http://www.apache.org/licenses/LICENSE-2.0
+*
+* Unless required by applicable law or agreed to in writing, software
+* distributed under the License is distributed on an "AS IS" BASIS,
+* WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+* See the License for the specific language governing permissions and
+* limitations under the License.
+*
+* LICENSE@@@ */
+
+/*
+ * storaged-replay: feed a trace recorded with "storaged -r FILE" back
+ * through storaged's handlers, deterministically, and report how long each
+ * method and timer took.
+ *
+ *   storaged-replay TRACE [SPEED [SESSION]]
+ *
+ * A trace holds one session per storaged instance that recorded to it;
+ * SESSION picks one (from 1; the default is the last).
+ * SPEED 1 (the default) keeps the recorded gaps between events, 10 replays
+ * ten times faster and 0 as fast as possible.  Backend calls are answered
+ * with the recorded results, in order, and timers fire when the trace says
+ * they did, so the outcome doesn't depend on the speed.  The instance starts
+ * from the state snapshot the recorded one started from, so a session that
+ * resumed resumes again; an idle exit the recording made that the replay
+ * didn't arm is a divergence.  Results are printed one json object per
+ * line; "divergences" counts the places where storaged no longer did what
+ * the recording did.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <luna-service2/lunaservice.h>
+
+#include "lsstub.h"
+#include "diskmode.h"
+#include "erase.h"
+#include "signals.h"
+#include "util.h"
+#include "log.h"
+#include "main.h"
+#include "metrics.h"
+#include "recorder.h"
+
+typedef struct
+{
+    const RecorderHeader* header;
+    const char* data;
+}
+Record;
+
+/**
+ * @brief where the session starting at offset ends: at the next session's
+ * magic, the end of the trace or a torn record
+ */
+static gsize
+session_end( const gchar* contents, gsize length, gsize offset )
+{
+    gsize magicLen = strlen( RECORDER_MAGIC );
+
+    offset += magicLen;
+    while ( offset + sizeof(RecorderHeader) <= length ) {
+        /* a record's type byte never matches the magic's first */
+        if ( offset + magicLen <= length && !memcmp( contents + offset, RECORDER_MAGIC, magicLen ) )
+            return offset;
+        const RecorderHeader* header = (const RecorderHeader*)(contents + offset);
+        if ( offset + sizeof(RecorderHeader) + header->length > length )
+            break;
+        offset += sizeof(RecorderHeader) + header->length;
+    }
+    return MIN( offset, length );
+}
+
+static GQueue sGetStateResults = G_QUEUE_INIT;
+static GQueue sSetModeResults = G_QUEUE_INIT;
+static GQueue sEraseResults = G_QUEUE_INIT;
+static guint sDivergences = 0;
+
+/*
+ * Replay backend: answers from the recorded results
+ */
+static const gint32*
+next_result( GQueue* results, const char* what )
+{
+    Record* rec = g_queue_pop_head( results );
+    if ( NULL == rec ) {
+        g_warning( "%s: no recorded result left", what );
+        sDivergences++;
+        return NULL;
+    }
+    return (const gint32*)rec->data;
+}
+
+static bool
+replay_backend_open( const char* arg )
+{
+    return true;
+}
+
+static nyx_error_t
+replay_backend_get_state( int* state )
+{
+    const gint32* result = next_result( &sGetStateResults, "get_state" );
+    if ( NULL == result ) {
+        *state = NYX_MASS_STORAGE_MODE_DRIVER_AVAILABLE;
+        return NYX_ERROR_NONE;
+    }
+    *state = result[1];
+    return result[0];
+}
+
+static nyx_error_t
+replay_backend_set_mode( nyx_mass_storage_mode_t mode,
+                         nyx_mass_storage_mode_return_code_t* ret_status )
+{
+    const gint32* result = next_result( &sSetModeResults, "set_mode" );
+    if ( NULL == result ) {
+        *ret_status = NYX_MASS_STORAGE_MODE_SUCCESS;
+        return NYX_ERROR_NONE;
+    }
+    if ( result[0] != mode ) {
+        g_warning( "set_mode: asked for mode %d, recording has %d", mode, result[0] );
+        sDivergences++;
+    }
+    *ret_status = result[2];
+    return result[1];
+}
+
+static nyx_error_t
+replay_backend_erase_partition( nyx_system_erase_type_t type )
+{
+    const gint32* result = next_result( &sEraseResults, "erase" );
+    return result ? result[1] : NYX_ERROR_NONE;
+}
+
+static nyx_error_t
+replay_backend_register_change_callback( nyx_device_callback_function_t callback,
+                                         void* context )
+{
+    return NYX_ERROR_NONE;
+}
+
+static const StorageBackend sReplayBackend = {
+    .name = "replay",
+    .open = replay_backend_open,
+    .get_state = replay_backend_get_state,
+    .set_mode = replay_backend_set_mode,
+    .erase_partition = replay_backend_erase_partition,
+    .register_change_callback = replay_backend_register_change_callback,
+    .host_connected = NULL,
+};
+
+const StorageBackend*
+GetStorageBackend( void )
+{
+    return &sReplayBackend;
+}
+
+/*
+ * Per-event latency
+ */
+typedef struct
+{
+    guint count;
+    gint64 total;
+    gint64 max;
+}
+Latency;
+
+static GHashTable* sLatencies = NULL;
+
+static void
+account( const char* name, gint64 us )
+{
+    Latency* latency = g_hash_table_lookup( sLatencies, name );
+    if ( NULL == latency ) {
+        latency = g_new0( Latency, 1 );
+        g_hash_table_insert( sLatencies, g_strdup( name ), latency );
+    }
+    latency->count++;
+    latency->total += us;
+    latency->max = MAX( latency->max, us );
+}
+
+static void
+print_latency( gpointer key, gpointer value, gpointer data )
+{
+    Latency* latency = value;
+    printf( "{\"event\":\"%s\", \"count\":%u, \"meanUs\":%" G_GINT64_FORMAT ", \"maxUs\":%" G_GINT64_FORMAT "}\n",
+            (const char*)key, latency->count, latency->total / latency->count, latency->max );
+}
+
+static const char* sTimerNames[ RECORDER_NUM_TIMERS ] = { "timer:umount", "timer:lifetime", "timer:reconcile", "timer:resume",
+                                                          "timer:mount" };
+
+int
+main( int argc, char** argv )
+{
+    gchar* contents = NULL;
+    gsize length = 0;
+    gdouble speed = 1.0;
+    GError* error = NULL;
+    GQueue events = G_QUEUE_INIT;
+
+    if ( argc < 2 ) {
+        fprintf( stderr, "usage: %s TRACE [SPEED [SESSION]]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+    if ( argc > 2 )
+        speed = g_ascii_strtod( argv[2], NULL );
+
+    if ( !g_file_get_contents( argv[1], &contents, &length, &error ) ) {
+        fprintf( stderr, "%s: %s\n", argv[0], error->message );
+        return EXIT_FAILURE;
+    }
+    if ( length < strlen( RECORDER_MAGIC ) || memcmp( contents, RECORDER_MAGIC, strlen( RECORDER_MAGIC ) ) ) {
+        fprintf( stderr, "%s: %s is not a storaged trace\n", argv[0], argv[1] );
+        return EXIT_FAILURE;
+    }
+
+    /* find the session to replay */
+    guint sessions = 0;
+    guint wanted = argc > 3 ? (guint)atoi( argv[3] ) : 0;
+    gsize offset = 0, start = 0, end = 0;
+    while ( offset + strlen( RECORDER_MAGIC ) <= length
+            && !memcmp( contents + offset, RECORDER_MAGIC, strlen( RECORDER_MAGIC ) ) ) {
+        gsize next = session_end( contents, length, offset );
+        sessions++;
+        if ( 0 == wanted || sessions == wanted ) {
+            start = offset;
+            end = next;
+        }
+        offset = next;
+    }
+    if ( wanted > sessions ) {
+        fprintf( stderr, "%s: %s has only %u sessions\n", argv[0], argv[1], sessions );
+        return EXIT_FAILURE;
+    }
+    printf( "{\"sessions\":%u, \"replaying\":%u}\n", sessions, wanted ? wanted : sessions );
+
+    /* split the session: backend results are consumed as storaged asks for
+       them, messages and timers drive the replay */
+    offset = start + strlen( RECORDER_MAGIC );
+    while ( offset + sizeof(RecorderHeader) <= end ) {
+        Record* rec = g_new( Record, 1 );
+        rec->header = (const RecorderHeader*)(contents + offset);
+        rec->data = contents + offset + sizeof(RecorderHeader);
+        offset += sizeof(RecorderHeader) + rec->header->length;
+        if ( offset > end ) {
+            g_free( rec );
+            break;      /* torn last record */
+        }
+
+        switch ( rec->header->type ) {
+        case RECORDER_GET_STATE: g_queue_push_tail( &sGetStateResults, rec ); break;
+        case RECORDER_SET_MODE:  g_queue_push_tail( &sSetModeResults, rec ); break;
+        case RECORDER_ERASE:     g_queue_push_tail( &sEraseResults, rec ); break;
+        case RECORDER_SNAPSHOT:
+            RecorderReplaySnapshot( rec->data, rec->header->length );
+            g_free( rec );
+            break;
+        default:                 g_queue_push_tail( &events, rec ); break;
+        }
+    }
+
+    g_log_set_default_handler( logFilter, NULL );
+    sLatencies = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, g_free );
+
+    RecorderSetReplay();
+
+    GMainLoop* loop = g_main_loop_new( NULL, FALSE );
+    LSPalmService* lsps = StubBusNew();
+    LSHandle* priv = LSPalmServiceGetPrivateConnection( lsps );
+    LSHandle* pub = LSPalmServiceGetPublicConnection( lsps );
+
+    LifetimeInit( loop );
+    SignalsInit( lsps );
+    DiskModeInterfaceInit( loop, priv, pub, false );
+    EraseInit( loop, priv );
+
+    gint64 replayStart = g_get_monotonic_time();
+    Record* rec;
+    while ( NULL != (rec = g_queue_pop_head( &events )) ) {
+        if ( speed > 0 ) {
+            gint64 due = replayStart + (gint64)(rec->header->timestamp / speed);
+            gint64 now = g_get_monotonic_time();
+            if ( due > now )
+                g_usleep( due - now );
+        }
+
+        gint64 start = g_get_monotonic_time();
+
+        if ( rec->header->type == RECORDER_MESSAGE ) {
+            /* connection\0category\0method\0payload */
+            gchar* data = g_strndup( rec->data, rec->header->length );
+            const char* connection = data;
+            const char* category = connection + strlen( connection ) + 1;
+            const char* method = category + strlen( category ) + 1;
+            const char* payload = method + strlen( method ) + 1;
+            gchar* name = g_strdup_printf( "%s%s/%s", strcmp( connection, "public" ) ? "" : "public:",
+                                           category, method );
+
+            StubBusCall( strcmp( connection, "public" ) ? priv : pub, category, method, payload, ":replay" );
+            account( name, g_get_monotonic_time() - start );
+
+            g_free( name );
+            g_free( data );
+        } else if ( rec->header->type == RECORDER_TIMER ) {
+            gint32 which = *(const gint32*)rec->data;
+            if ( which < 0 || which >= RECORDER_NUM_TIMERS || !RecorderFireTimer( which ) ) {
+                g_warning( "timer %d fired in the recording but isn't armed", which );
+                sDivergences++;
+            } else {
+                account( sTimerNames[ which ], g_get_monotonic_time() - start );
+            }
+        }
+        g_free( rec );
+    }
+
+    g_hash_table_foreach( sLatencies, print_latency, NULL );
+
+    GString* stages = g_string_new( "{" );
+    MetricsAppendStats( stages );
+    g_string_append( stages, "}" );
+    printf( "%s\n", stages->str );
+    g_string_free( stages, TRUE );
+
+    printf( "{\"divergences\":%u, \"unusedResults\":%u}\n", sDivergences,
+            g_queue_get_length( &sGetStateResults ) + g_queue_get_length( &sSetModeResults ) +
+            g_queue_get_length( &sEraseResults ) );
+
+    g_main_loop_unref( loop );
+    return sDivergences ? EXIT_FAILURE : EXIT_SUCCESS;
+}